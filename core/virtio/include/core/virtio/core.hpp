@@ -1,7 +1,9 @@
 
+#include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <memory>
 #include <vector>
 
 #include <arch/dma_structs.hpp>
@@ -10,6 +12,7 @@
 #include <arch/register.hpp>
 #include <arch/variable.hpp>
 #include <async/doorbell.hpp>
+#include <async/result.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/hw/client.hpp>
 
@@ -32,9 +35,11 @@ inline constexpr arch::scalar_register<uint32_t> PCI_DEVICE_FEATURE_SELECT(0);
 inline constexpr arch::scalar_register<uint32_t> PCI_DEVICE_FEATURE_WINDOW(4);
 inline constexpr arch::scalar_register<uint32_t> PCI_DRIVER_FEATURE_SELECT(8);
 inline constexpr arch::scalar_register<uint32_t> PCI_DRIVER_FEATURE_WINDOW(12);
+inline constexpr arch::scalar_register<uint16_t> PCI_MSIX_CONFIG(16);
 inline constexpr arch::scalar_register<uint8_t> PCI_DEVICE_STATUS(20);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_SELECT(22);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_SIZE(24);
+inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_MSIX_VECTOR(26);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_ENABLE(28);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_NOTIFY(30);
 inline constexpr arch::scalar_register<uint32_t> PCI_QUEUE_TABLE[] = {
@@ -53,6 +58,19 @@ enum {
 	PCI_L_DEVICE_SPECIFIC = 20
 };
 
+// Value of PCI_MSIX_CONFIG and PCI_QUEUE_MSIX_VECTOR that disables MSI-X notifications.
+enum {
+	PCI_NO_VECTOR = 0xFFFF
+};
+
+// Feature bits that are negotiated by the transport itself.
+enum {
+	VIRTIO_F_INDIRECT_DESC = 28,
+	VIRTIO_F_EVENT_IDX = 29,
+	VIRTIO_F_VERSION_1 = 32,
+	VIRTIO_F_RING_PACKED = 34
+};
+
 // bits of the device status register
 enum {
 	ACKNOWLEDGE = 1,
@@ -66,11 +84,26 @@ enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains an indirect descriptor table
+
+	// Bits of the spec::PackedDescriptor::flags field (in addition to the bits above).
+	VIRTQ_DESC_F_AVAIL = 1 << 7,
+	VIRTQ_DESC_F_USED = 1 << 15,
+
+	// Bits of the spec::AvailableRing::flags field.
+	VIRTQ_AVAIL_F_NO_INTERRUPT = 1, // no need to interrupt the driver
 
 	// Bits of the spec::UsedRing::flags field.
 	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
 };
 
+// Values of the spec::EventSuppression::flags field.
+enum {
+	RING_EVENT_FLAGS_ENABLE = 0,
+	RING_EVENT_FLAGS_DISABLE = 1,
+	RING_EVENT_FLAGS_DESC = 2 // only if VIRTIO_F_EVENT_IDX was negotiated
+};
+
 namespace spec {
 	struct Descriptor {
 		arch::scalar_variable<uint64_t> address;
@@ -116,6 +149,22 @@ namespace spec {
 
 		arch::scalar_variable<uint16_t> eventIndex;
 	};
+
+	// Element of a packed virtq.
+	struct PackedDescriptor {
+		arch::scalar_variable<uint64_t> address;
+		arch::scalar_variable<uint32_t> length;
+		arch::scalar_variable<uint16_t> id;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(PackedDescriptor) == 16);
+
+	// Driver and device event suppression structures of a packed virtq.
+	struct EventSuppression {
+		arch::scalar_variable<uint16_t> offsetWrap;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(EventSuppression) == 4);
 };
 
 struct DeviceSpace;
@@ -136,7 +185,7 @@ struct QueueInfo {
  * - Call discover() to obtain a transport.
  * - Negotiate features via Transport::checkDeviceFeature() / acknowledgeDriverFeature().
  * - Call Transport::finalizeFeatures().
- * - Call Transport::claimQueues().
+ * - Call (and await) Transport::claimQueues().
  * - Call Transport::setupQueue() for each virtq.
  * - Call Transport::runDevice().
  */
@@ -155,7 +204,11 @@ struct Transport {
 	virtual void acknowledgeDriverFeature(unsigned int feature) = 0;
 	virtual void finalizeFeatures() = 0;
 
-	virtual void claimQueues(unsigned int max_index) = 0;
+	// Keeps finalizeFeatures() from negotiating packed virtqs (e.g., to compare ring formats).
+	virtual void disablePackedRings() = 0;
+
+	// Also sets up the MSI-X vectors (if any); hence, this is asynchronous.
+	virtual async::result<void> claimQueues(unsigned int max_index) = 0;
 
 	virtual Queue *setupQueue(unsigned int index) = 0;
 
@@ -177,7 +230,7 @@ struct DeviceSpace {
 		} else {
 			static_assert(sizeof(typename RT::rep_type) == 4,
 					"Unsupported size for DeviceSpace::load()");
-			auto v = _transport->loadConfig16(r.offset());
+			auto v = _transport->loadConfig32(r.offset());
 			return static_cast<typename RT::rep_type>(v);
 		}
 	}
@@ -213,10 +266,13 @@ inline constexpr DeviceToHostType deviceToHost;
 // Handle to a virtq descriptor.
 struct Handle {
 	Handle()
-	: _queue{nullptr}, _tableIndex{0} { }
+	: _queue{nullptr}, _indirectTable{nullptr}, _tableIndex{0} { }
 
 	Handle(Queue *queue, size_t table_index);
 
+	// Constructs a handle to a descriptor of an indirect table.
+	Handle(Queue *queue, spec::Descriptor *table, size_t table_index);
+
 	explicit operator bool() {
 		return _queue;
 	}
@@ -232,8 +288,21 @@ struct Handle {
 
 	void setupLink(Handle other);
 
+	// Attaches an indirect table with room for max_segments descriptors to this descriptor.
+	// The table is reused for later requests that are posted to the same descriptor.
+	// Requires Queue::supportsIndirect().
+	void setupIndirect(size_t max_segments);
+
+	// Returns the descriptor at the given index of the indirect table.
+	// The length of the table is extended to include this descriptor.
+	Handle indirectSegment(size_t index);
+
 private:
+	spec::Descriptor *_descriptor();
+
 	Queue *_queue;
+	// Null for descriptors of the virtq's descriptor table.
+	spec::Descriptor *_indirectTable;
 	size_t _tableIndex;
 };
 
@@ -246,6 +315,7 @@ struct Chain {
 	Chain &operator= (const Chain &) = delete;
 
 	void append(Handle handle) {
+		assert(!_indirect);
 		if(_front) {
 			_back.setupLink(handle);
 			_back = handle;
@@ -255,6 +325,30 @@ struct Chain {
 		}
 	}
 
+	// Turns an empty chain into an indirect chain. Such chains only occupy
+	// a single descriptor (i.e., head) of the virtq; instead of calling append(),
+	// appendIndirect() is used to add descriptors from an indirect table.
+	void setupIndirect(Handle head, size_t max_segments) {
+		assert(!_front);
+		head.setupIndirect(max_segments);
+		_front = head;
+		_back = head;
+		_indirect = true;
+	}
+
+	void appendIndirect() {
+		assert(_indirect);
+		auto segment = _front.indirectSegment(_numSegments);
+		if(_numSegments)
+			_back.setupLink(segment);
+		_back = segment;
+		_numSegments++;
+	}
+
+	bool isIndirect() {
+		return _indirect;
+	}
+
 	Handle front() {
 		return _front;
 	}
@@ -270,9 +364,12 @@ struct Chain {
 private:
 	Handle _front;
 	Handle _back;
+	bool _indirect = false;
+	size_t _numSegments = 0;
 };
 
 // Helper functions that obtain descriptor from a queue as needed.
+// For indirect chains, the descriptors are taken from the chain's indirect table instead.
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view);
 async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
@@ -282,12 +379,52 @@ struct Request {
 	void (*complete)(Request *);
 };
 
+// Tunables of the interrupt mitigation scheme: after an IRQ, queue interrupts are
+// disabled and the used ring is polled until it stays empty for idleTimeout.
+struct MitigationParameters {
+	// If false, each IRQ drains the used ring and interrupts are never disabled.
+	bool enable = true;
+
+	// Maximal number of completions that are processed before the poll loop yields.
+	size_t pollBudget = 64;
+
+	// Delay (in nanoseconds) between two polls of an empty used ring.
+	uint64_t pollInterval = 20'000;
+
+	// Interrupts are re-enabled once the used ring stayed empty for this long.
+	uint64_t idleTimeout = 200'000;
+
+	// Print the queue statistics whenever polling mode is left.
+	bool logStats = false;
+};
+
+// Applies to all queues that are set up afterwards.
+void setDefaultMitigation(const MitigationParameters &parameters);
+
+struct QueueStats {
+	uint64_t numInterrupts = 0;
+	uint64_t numCompletions = 0;
+	uint64_t numNotifications = 0;
+
+	// Completions that were processed by the poll loop (i.e., without an IRQ).
+	uint64_t numPolledCompletions = 0;
+	uint64_t numPollRounds = 0;
+};
+
 // Represents a single virtq.
+// Both split and packed virtqs are supported; the Handle API is the same for both.
 struct Queue {
 	friend struct Handle;
 
+	// Constructs a split virtq.
 	Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-			spec::AvailableRing *available, spec::UsedRing *used);
+			spec::AvailableRing *available, spec::UsedRing *used,
+			bool event_index, bool indirect);
+
+	// Constructs a packed virtq.
+	Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			bool event_index, bool indirect);
 protected:
 	~Queue() = default;
 
@@ -301,15 +438,39 @@ public:
 		return _queueSize;
 	}
 
+	// Returns true if VIRTIO_F_INDIRECT_DESC was negotiated.
+	bool supportsIndirect() {
+		return _useIndirect;
+	}
+
+	// Returns the number of descriptors that can be obtained without waiting.
+	size_t numFreeDescriptors() {
+		return _descriptorStack.size();
+	}
+
 	// Allocates a single descriptor.
 	// The descriptor is automatically freed when the device returns it.
 	async::result<Handle> obtainDescriptor();
 
+	// Allocates count descriptors at once; waits until all of them are available.
+	async::result<void> obtainDescriptors(Handle *handles, size_t count);
+
 	// Posts a descriptor to the virtq's available ring.
 	void postDescriptor(Handle descriptor, Request *request,
 			void (*complete)(Request *));
 
+	// Like postDescriptor() but the descriptor only becomes visible to the device
+	// once publishDescriptors() is called. This allows drivers to publish a batch
+	// of descriptors with a single update of the available ring.
+	// Note that staged descriptors are not processed by the device; drivers must
+	// publish them before waiting for descriptors to be freed.
+	void stageDescriptor(Handle descriptor, Request *request,
+			void (*complete)(Request *));
+
+	void publishDescriptors();
+
 	// Notifies the device that new descriptors have been posted.
+	// All staged descriptors must be published before calling this function.
 	void notify();
 
 	async::result<void> submitDescriptor(Handle descriptor) {
@@ -328,13 +489,43 @@ public:
 	}
 
 	// Processes interrupts for this virtq.
-	// Calls retrieveDescriptor() to complete individual requests.
+	// Completes requests from the used ring and enters polling mode if necessary.
 	void processInterrupt();
 
+	void setMitigation(const MitigationParameters &parameters) {
+		_mitigation = parameters;
+	}
+
+	const QueueStats &stats() {
+		return _stats;
+	}
+
+	void dumpStats();
+
 protected:
 	virtual void notifyTransport() = 0;
 
 private:
+	// Completes at most budget requests from the used ring.
+	// Returns the number of completed requests.
+	size_t _retireCompletions(size_t budget);
+
+	// Returns true if the device has used elements that we did not process yet.
+	bool _hasCompletions();
+
+	// Returns the descriptors of a chain to the descriptor stack.
+	// Returns the length of the chain.
+	size_t _freeChain(size_t table_index);
+
+	// Converts the indirect table of a descriptor to the packed layout.
+	void _convertIndirect(size_t table_index);
+
+	void _disableInterrupts();
+	// Returns false if the used ring is not empty after interrupts were enabled.
+	bool _enableInterrupts();
+
+	async::detached _pollUsedRing(bool exhausted);
+
 	// Index of this queue as part of its owning device.
 	unsigned int _queueIndex;
 
@@ -342,21 +533,72 @@ private:
 	size_t _queueSize;
 
 	// Pointers to different data structures of this virtq.
+	// For packed virtqs, _table points to a staging area that is not visible to the device;
+	// postDescriptor() copies descriptor chains from the staging area into _packedRing.
 	spec::Descriptor *_table;
-	spec::AvailableRing *_availableRing;
-	spec::UsedRing *_usedRing;
-	spec::AvailableExtra *_availableExtra;
-	spec::UsedExtra *_usedExtra;
+	spec::AvailableRing *_availableRing = nullptr;
+	spec::UsedRing *_usedRing = nullptr;
+	spec::AvailableExtra *_availableExtra = nullptr;
+	spec::UsedExtra *_usedExtra = nullptr;
+	spec::PackedDescriptor *_packedRing = nullptr;
+	spec::EventSuppression *_driverEvent = nullptr;
+	spec::EventSuppression *_deviceEvent = nullptr;
+
+	std::unique_ptr<spec::Descriptor[]> _stagingTable;
 
 	// Keeps track of unused descriptor indices.
 	std::vector<uint16_t> _descriptorStack;
 
+	// Available ring index including staged descriptors (split virtqs only).
+	uint16_t _stagedHead = 0;
+
+	// Slots and flags of staged chain heads (packed virtqs only).
+	struct StagedHead {
+		uint16_t slot;
+		uint16_t flags;
+	};
+	std::vector<StagedHead> _stagedHeads;
+
 	async::doorbell _descriptorDoorbell;
 
 	std::vector<Request *> _activeRequests;
 
 	// Keeps track of which entries in the used ring have already been processed.
 	uint16_t _progressHead;
+
+	// True if VIRTIO_F_EVENT_IDX was negotiated.
+	bool _useEventIndex;
+
+	bool _useIndirect;
+
+	// Indirect tables, indexed by the descriptor that refers to them.
+	// Tables are allocated from a DMA pool on first use and only grow afterwards.
+	struct IndirectTable {
+		arch::dma_array<spec::Descriptor> descriptors;
+		uintptr_t physical = 0;
+	};
+	std::vector<IndirectTable> _indirectTables;
+
+	bool _packed;
+
+	// Value of the available ring's head index at the last notification.
+	uint16_t _notifiedHead = 0;
+
+	// Next slots of the packed ring that the driver fills and that the device uses,
+	// together with their wrap counters.
+	uint16_t _availSlot = 0;
+	bool _availWrap = true;
+	uint16_t _usedSlot = 0;
+	bool _usedWrap = true;
+
+	// Number of descriptors that were made available since the last notification.
+	uint16_t _numAdded = 0;
+
+	MitigationParameters _mitigation;
+	QueueStats _stats;
+
+	// True while interrupts are disabled and _pollUsedRing() is running.
+	bool _polling = false;
 };
 
 } // namespace virtio_core
@@ -1,8 +1,10 @@
 
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <optional>
 
+#include <arch/dma_pool.hpp>
 #include <core/virtio/core.hpp>
 #include <fafnir/dsl.hpp>
 #include <protocols/kernlet/compiler.hpp>
@@ -92,7 +94,10 @@ struct LegacyPciTransport : Transport {
 	void acknowledgeDriverFeature(unsigned int feature) override;
 	void finalizeFeatures() override;
 
-	void claimQueues(unsigned int max_index) override;
+	// Legacy devices do not support packed virtqs.
+	void disablePackedRings() override { }
+
+	async::result<void> claimQueues(unsigned int max_index) override;
 	Queue *setupQueue(unsigned int index) override;
 
 	void runDevice() override;
@@ -103,6 +108,8 @@ private:
 	protocols::hw::Device _hwDevice;
 	arch::io_space _legacySpace;
 	helix::UniqueDescriptor _irq;
+	bool _useEventIndex = false;
+	bool _useIndirect = false;
 
 	std::vector<std::unique_ptr<LegacyPciQueue>> _queues;
 };
@@ -110,7 +117,8 @@ private:
 struct LegacyPciQueue final : Queue {
 	LegacyPciQueue(LegacyPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
-			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used);
+			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+			bool event_index, bool indirect);
 
 protected:
 	void notifyTransport() override;
@@ -152,11 +160,20 @@ void LegacyPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void LegacyPciTransport::finalizeFeatures() {
-	// Does nothing for now.
+	if(checkDeviceFeature(VIRTIO_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_F_EVENT_IDX);
+		_useEventIndex = true;
+	}
+
+	if(checkDeviceFeature(VIRTIO_F_INDIRECT_DESC)) {
+		acknowledgeDriverFeature(VIRTIO_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
 }
 
-void LegacyPciTransport::claimQueues(unsigned int max_index) {
+async::result<void> LegacyPciTransport::claimQueues(unsigned int max_index) {
 	_queues.resize(max_index);
+	co_return;
 }
 
 Queue *LegacyPciTransport::setupQueue(unsigned int queue_index) {
@@ -197,7 +214,7 @@ Queue *LegacyPciTransport::setupQueue(unsigned int queue_index) {
 	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
 	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
 	_queues[queue_index] = std::make_unique<LegacyPciQueue>(this, queue_index, queue_size,
-			table, available, used);
+			table, available, used, _useEventIndex, _useIndirect);
 	
 	// Hand the queue to the device.
 	uintptr_t table_physical;
@@ -251,8 +268,10 @@ async::detached LegacyPciTransport::_processIrqs() {
 
 LegacyPciQueue::LegacyPciQueue(LegacyPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
-		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used)
-: Queue{queue_index, queue_size, table, available, used}, _transport{transport} { }
+		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+		bool event_index, bool indirect)
+: Queue{queue_index, queue_size, table, available, used, event_index, indirect},
+		_transport{transport} { }
 
 void LegacyPciQueue::notifyTransport() {
 	_transport->_legacySpace.store(PCI_L_QUEUE_NOTIFY, queueIndex());
@@ -274,7 +293,7 @@ struct StandardPciTransport : Transport {
 	StandardPciTransport(protocols::hw::Device hw_device,
 			Mapping common_mapping, Mapping notify_mapping,
 			Mapping isr_mapping, Mapping device_mapping,
-			unsigned int notify_multiplier, helix::UniqueDescriptor irq);
+			unsigned int notify_multiplier, unsigned int num_msis);
 
 	protocols::hw::Device &hwDevice() override {
 		return _hwDevice;
@@ -288,7 +307,11 @@ struct StandardPciTransport : Transport {
 	void acknowledgeDriverFeature(unsigned int feature) override;
 	void finalizeFeatures() override;
 
-	void claimQueues(unsigned int max_index) override;
+	void disablePackedRings() override {
+		_disablePackedRings = true;
+	}
+
+	async::result<void> claimQueues(unsigned int max_index) override;
 	Queue *setupQueue(unsigned int index) override;
 
 	void runDevice() override;
@@ -300,6 +323,9 @@ private:
 	arch::mem_space _deviceSpace() { return arch::mem_space{_deviceMapping.get()}; }
 
 	async::detached _processIrqs();
+	// Used instead of _processIrqs() if each virtq has its own MSI-X vector.
+	async::detached _processConfigMsi();
+	async::detached _processQueueMsi(StandardPciQueue *queue);
 
 	protocols::hw::Device _hwDevice;
 	Mapping _commonMapping;
@@ -307,7 +333,17 @@ private:
 	Mapping _isrMapping;
 	Mapping _deviceMapping;
 	unsigned int _notifyMultiplier;
+	unsigned int _numMsis;
+	// MSI-X vector 0 signals configuration changes, vector i + 1 belongs to virtq i.
+	bool _useMsi = false;
+	bool _useEventIndex = false;
+	bool _useIndirect = false;
+	bool _usePackedRings = false;
+	bool _disablePackedRings = false;
 	helix::UniqueDescriptor _irq;
+	helix::UniqueDescriptor _configMsi;
+	// Indexed by virtq index.
+	std::vector<helix::UniqueDescriptor> _queueMsis;
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
 };
@@ -316,7 +352,12 @@ struct StandardPciQueue final : Queue {
 	StandardPciQueue(StandardPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
 			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
-			arch::scalar_register<uint16_t> notify_register);
+			bool event_index, bool indirect, arch::scalar_register<uint16_t> notify_register);
+
+	StandardPciQueue(StandardPciTransport *transport,
+			unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			bool event_index, bool indirect, arch::scalar_register<uint16_t> notify_register);
 
 protected:
 	void notifyTransport() override;
@@ -329,11 +370,11 @@ private:
 StandardPciTransport::StandardPciTransport(protocols::hw::Device hw_device,
 		Mapping common_mapping, Mapping notify_mapping,
 		Mapping isr_mapping, Mapping device_mapping,
-		unsigned int notify_multiplier, helix::UniqueDescriptor irq)
+		unsigned int notify_multiplier, unsigned int num_msis)
 : _hwDevice{std::move(hw_device)},
 		_commonMapping{std::move(common_mapping)}, _notifyMapping{std::move(notify_mapping)},
 		_isrMapping{std::move(isr_mapping)}, _deviceMapping{std::move(device_mapping)},
-		_notifyMultiplier{notify_multiplier}, _irq{std::move(irq)} { }
+		_notifyMultiplier{notify_multiplier}, _numMsis{num_msis} { }
 
 uint8_t StandardPciTransport::loadConfig8(size_t offset) {
 	return _deviceSpace().load(arch::scalar_register<uint8_t>(offset));
@@ -360,16 +401,50 @@ void StandardPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void StandardPciTransport::finalizeFeatures() {
-	assert(checkDeviceFeature(32));
-	acknowledgeDriverFeature(32);
+	assert(checkDeviceFeature(VIRTIO_F_VERSION_1));
+	acknowledgeDriverFeature(VIRTIO_F_VERSION_1);
+
+	if(checkDeviceFeature(VIRTIO_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_F_EVENT_IDX);
+		_useEventIndex = true;
+	}
+
+	if(checkDeviceFeature(VIRTIO_F_INDIRECT_DESC)) {
+		acknowledgeDriverFeature(VIRTIO_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
+
+	// Packed virtqs need fewer cache lines per request; prefer them if available.
+	if(checkDeviceFeature(VIRTIO_F_RING_PACKED) && !_disablePackedRings) {
+		acknowledgeDriverFeature(VIRTIO_F_RING_PACKED);
+		_usePackedRings = true;
+	}
+	std::cout << "core-virtio: Using " << (_usePackedRings ? "packed" : "split")
+			<< " virtqs" << std::endl;
 
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | FEATURES_OK);
 	auto confirm = _commonSpace().load(PCI_DEVICE_STATUS);
 	assert(confirm & FEATURES_OK);
 }
 
-void StandardPciTransport::claimQueues(unsigned int max_index) {
+async::result<void> StandardPciTransport::claimQueues(unsigned int max_index) {
 	_queues.resize(max_index);
+
+	// Only use MSI-X if we can dedicate a vector to each virtq.
+	if(_numMsis <= max_index)
+		co_return;
+
+	// The kernel enables MSI-X when the first MSI is accessed. Devices reject
+	// vectors (i.e., read back PCI_NO_VECTOR) that are programmed before that.
+	_configMsi = co_await _hwDevice.accessMsi(0);
+	for(unsigned int i = 0; i < max_index; i++)
+		_queueMsis.push_back(co_await _hwDevice.accessMsi(i + 1));
+
+	// Once MSI-X is enabled, INTx is disabled; we cannot fall back to it.
+	_commonSpace().store(PCI_MSIX_CONFIG, 0);
+	if(_commonSpace().load(PCI_MSIX_CONFIG) == PCI_NO_VECTOR)
+		throw std::runtime_error("Device rejected MSI-X configuration vector");
+	_useMsi = true;
 }
 
 Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
@@ -377,25 +452,39 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	assert(!_queues[queue_index]);
 
 	_commonSpace().store(PCI_QUEUE_SELECT, queue_index);
+	if(_useMsi) {
+		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, queue_index + 1);
+		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) == PCI_NO_VECTOR)
+			throw std::runtime_error("Device rejected MSI-X vector of virtq");
+	}
 	auto queue_size = _commonSpace().load(PCI_QUEUE_SIZE);
 	auto notify_index = _commonSpace().load(PCI_QUEUE_NOTIFY);
 	assert(queue_size);
 
-	// TODO: Ensure that the queue size is indeed a power of 2.
-
-	// Determine the queue size in bytes.
-	constexpr size_t available_align = 2;
-	constexpr size_t used_align = 4;
-
-	auto available_offset = (queue_size * sizeof(spec::Descriptor)
-				+ (available_align - 1))
-			& ~size_t(available_align - 1);
-	auto used_offset = (available_offset + queue_size * sizeof(spec::AvailableRing::Element)
-				+ sizeof(spec::AvailableExtra) + (used_align - 1))
-			& ~size_t(used_align - 1);
-
-	auto region_size = used_offset + queue_size * sizeof(spec::UsedRing::Element)
-				+ sizeof(spec::UsedExtra);
+	// For packed virtqs, the available and used areas are the driver
+	// and device event suppression structures.
+	size_t available_offset, used_offset, region_size;
+	if(_usePackedRings) {
+		available_offset = queue_size * sizeof(spec::PackedDescriptor);
+		used_offset = available_offset + sizeof(spec::EventSuppression);
+		region_size = used_offset + sizeof(spec::EventSuppression);
+	}else{
+		// TODO: Ensure that the queue size is indeed a power of 2.
+
+		// Determine the queue size in bytes.
+		constexpr size_t available_align = 2;
+		constexpr size_t used_align = 4;
+
+		available_offset = (queue_size * sizeof(spec::Descriptor)
+					+ (available_align - 1))
+				& ~size_t(available_align - 1);
+		used_offset = (available_offset + queue_size * sizeof(spec::AvailableRing::Element)
+					+ sizeof(spec::AvailableExtra) + (used_align - 1))
+				& ~size_t(used_align - 1);
+
+		region_size = used_offset + queue_size * sizeof(spec::UsedRing::Element)
+					+ sizeof(spec::UsedExtra);
+	}
 
 	// Allocate physical memory for the virtq structs.
 	assert(region_size < 0x4000); // FIXME: do not hardcode 0x4000
@@ -407,12 +496,23 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	HEL_CHECK(helCloseDescriptor(memory));
 
 	// Setup the memory region.
-	auto table = reinterpret_cast<spec::Descriptor *>((char *)window);
-	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
-	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
-	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
-			table, available, used,
-			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
+	auto table = (char *)window;
+	auto available = (char *)window + available_offset;
+	auto used = (char *)window + used_offset;
+	arch::scalar_register<uint16_t> notify_register{_notifyMultiplier * notify_index};
+	if(_usePackedRings) {
+		_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
+				reinterpret_cast<spec::PackedDescriptor *>(table),
+				reinterpret_cast<spec::EventSuppression *>(available),
+				reinterpret_cast<spec::EventSuppression *>(used),
+				_useEventIndex, _useIndirect, notify_register);
+	}else{
+		_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
+				reinterpret_cast<spec::Descriptor *>(table),
+				reinterpret_cast<spec::AvailableRing *>(available),
+				reinterpret_cast<spec::UsedRing *>(used),
+				_useEventIndex, _useIndirect, notify_register);
+	}
 
 	// Hand the queue to the device.
 	uintptr_t table_physical, available_physical, used_physical;
@@ -438,6 +538,16 @@ void StandardPciTransport::runDevice() {
 }
 
 async::detached StandardPciTransport::_processIrqs() {
+	if(_useMsi) {
+		_processConfigMsi();
+		for(auto &queue : _queues)
+			if(queue)
+				_processQueueMsi(queue.get());
+		co_return;
+	}
+
+	_irq = co_await _hwDevice.accessIrq();
+
 	co_await connectKernletCompiler();
 
 	std::vector<uint8_t> kernlet_program;
@@ -514,11 +624,64 @@ async::detached StandardPciTransport::_processIrqs() {
 	}
 }
 
+async::detached StandardPciTransport::_processConfigMsi() {
+	auto &irq = _configMsi;
+	HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckKick, 0));
+
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(irq, &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
+
+		std::cout << "core-virtio: Configuration change" << std::endl;
+		auto status = _commonSpace().load(PCI_DEVICE_STATUS);
+		assert(!(status & DEVICE_NEEDS_RESET));
+	}
+}
+
+async::detached StandardPciTransport::_processQueueMsi(StandardPciQueue *queue) {
+	auto &irq = _queueMsis[queue->queueIndex()];
+	// Completions are processed by this thread; avoid waking it up from another CPU.
+	HEL_CHECK(helSetIrqAffinity(irq.getHandle(), kHelIrqAffinityThisCpu, 0));
+	HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckKick, 0));
+
+	// Requests might have completed before the MSI was set up.
+	queue->processInterrupt();
+
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(irq, &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		// MSIs are never shared. Acknowledge before processing the virtq
+		// such that completions that race with processInterrupt() raise a new IRQ.
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
+		queue->processInterrupt();
+	}
+}
+
 StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
-		arch::scalar_register<uint16_t> notify_register)
-: Queue{queue_index, queue_size, table, available, used},
+		bool event_index, bool indirect, arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, table, available, used, event_index, indirect},
+		_transport{transport}, _notifyRegister{notify_register} { }
+
+StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
+		unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		bool event_index, bool indirect, arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, ring, driver_event, device_event, event_index, indirect},
 		_transport{transport}, _notifyRegister{notify_register} { }
 
 void StandardPciQueue::notifyTransport() {
@@ -534,7 +697,6 @@ void StandardPciQueue::notifyTransport() {
 async::result<std::unique_ptr<Transport>>
 discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 	auto info = co_await hw_device.getPciInfo();
-	auto irq = co_await hw_device.accessIrq();
 
 	if(mode == DiscoverMode::transitional || mode == DiscoverMode::modernOnly) {
 		std::optional<Mapping> common_mapping;
@@ -590,7 +752,7 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 			co_return std::make_unique<StandardPciTransport>(std::move(hw_device),
 					std::move(*common_mapping), std::move(*notify_mapping),
 					std::move(*isr_mapping), std::move(*device_mapping),
-					notify_multiplier, std::move(irq));
+					notify_multiplier, info.numMsis);
 		}
 	}
 
@@ -611,6 +773,8 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 			legacy_space.store(PCI_L_DEVICE_STATUS,
 					legacy_space.load(PCI_L_DEVICE_STATUS) | DRIVER);
 
+			auto irq = co_await hw_device.accessIrq();
+
 			std::cout << "virtio: Using legacy PCI transport" << std::endl;
 			co_return std::make_unique<LegacyPciTransport>(std::move(hw_device),
 					legacy_space, std::move(irq));
@@ -624,8 +788,16 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 // Handle
 // --------------------------------------------------------
 
+namespace {
+	// Indirect tables must be physically contiguous.
+	arch::contiguous_pool indirectPool;
+}
+
 Handle::Handle(Queue *queue, size_t table_index)
-: _queue{queue}, _tableIndex{table_index} { }
+: _queue{queue}, _indirectTable{nullptr}, _tableIndex{table_index} { }
+
+Handle::Handle(Queue *queue, spec::Descriptor *table, size_t table_index)
+: _queue{queue}, _indirectTable{table}, _tableIndex{table_index} { }
 
 void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 	assert(view.size());
@@ -633,7 +805,7 @@ void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 	uintptr_t physical;
 	HEL_CHECK(helPointerPhysical(view.data(), &physical));
 	
-	auto descriptor = _queue->_table + _tableIndex;
+	auto descriptor = _descriptor();
 	descriptor->address.store(physical);
 	descriptor->length.store(view.size());
 }
@@ -644,18 +816,63 @@ void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	uintptr_t physical;
 	HEL_CHECK(helPointerPhysical(view.data(), &physical));
 	
-	auto descriptor = _queue->_table + _tableIndex;
+	auto descriptor = _descriptor();
 	descriptor->address.store(physical);
 	descriptor->length.store(view.size());
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
 }
 
 void Handle::setupLink(Handle other) {
-	auto descriptor = _queue->_table + _tableIndex;
+	// Links are only possible within the same table.
+	assert(_indirectTable == other._indirectTable);
+	auto descriptor = _descriptor();
 	descriptor->next.store(other._tableIndex);
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_NEXT);
 }
 
+void Handle::setupIndirect(size_t max_segments) {
+	assert(_queue->_useIndirect);
+	assert(!_indirectTable);
+	// The virtio specification limits the length of chains to the queue size.
+	assert(max_segments && max_segments <= _queue->_queueSize);
+
+	auto &table = _queue->_indirectTables[_tableIndex];
+	if(table.descriptors.size() < max_segments) {
+		table.descriptors = arch::dma_array<spec::Descriptor>{&indirectPool, max_segments};
+		HEL_CHECK(helPointerPhysical(table.descriptors.data(), &table.physical));
+	}
+
+	auto descriptor = _descriptor();
+	descriptor->address.store(table.physical);
+	descriptor->length.store(0);
+	descriptor->flags.store(VIRTQ_DESC_F_INDIRECT);
+}
+
+Handle Handle::indirectSegment(size_t index) {
+	assert(!_indirectTable);
+	auto &table = _queue->_indirectTables[_tableIndex];
+	assert(index < table.descriptors.size());
+
+	auto segment = table.descriptors.data() + index;
+	segment->address.store(0);
+	segment->length.store(0);
+	segment->flags.store(0);
+
+	auto descriptor = _descriptor();
+	assert(descriptor->flags.load() & VIRTQ_DESC_F_INDIRECT);
+	auto length = (index + 1) * sizeof(spec::Descriptor);
+	if(descriptor->length.load() < length)
+		descriptor->length.store(length);
+
+	return Handle{_queue, table.descriptors.data(), index};
+}
+
+spec::Descriptor *Handle::_descriptor() {
+	if(_indirectTable)
+		return _indirectTable + _tableIndex;
+	return _queue->_table + _tableIndex;
+}
+
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view) {
 	constexpr size_t page_size = 0x1000;
@@ -663,7 +880,11 @@ async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 	while(offset < view.size()) {
 		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
 		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
-		chain.append(co_await queue->obtainDescriptor());
+		if(chain.isIndirect()) {
+			chain.appendIndirect();
+		}else{
+			chain.append(co_await queue->obtainDescriptor());
+		}
 		chain.setupBuffer(hostToDevice, view.subview(offset, chunk));
 		offset += chunk;
 	}
@@ -676,7 +897,11 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 	while(offset < view.size()) {
 		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
 		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
-		chain.append(co_await queue->obtainDescriptor());
+		if(chain.isIndirect()) {
+			chain.appendIndirect();
+		}else{
+			chain.append(co_await queue->obtainDescriptor());
+		}
 		chain.setupBuffer(deviceToHost, view.subview(offset, chunk));
 		offset += chunk;
 	}
@@ -686,9 +911,38 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 // Queue
 // --------------------------------------------------------
 
+namespace {
+	MitigationParameters defaultMitigation;
+
+	// Returns true if an event index was crossed when an index moved from old_index
+	// to new_index (see vring_need_event() in the virtio specification).
+	bool needEvent(uint16_t event_index, uint16_t new_index, uint16_t old_index) {
+		return static_cast<uint16_t>(new_index - event_index - 1)
+				< static_cast<uint16_t>(new_index - old_index);
+	}
+
+	async::result<void> sleepFor(uint64_t nanos) {
+		uint64_t tick;
+		HEL_CHECK(helGetClock(&tick));
+
+		helix::AwaitClock await;
+		auto &&submit = helix::submitAwaitClock(&await, tick + nanos,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+	}
+}
+
+void setDefaultMitigation(const MitigationParameters &parameters) {
+	defaultMitigation = parameters;
+}
+
 Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-		spec::AvailableRing *available, spec::UsedRing *used)
-: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0} {
+		spec::AvailableRing *available, spec::UsedRing *used,
+		bool event_index, bool indirect)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0},
+		_useEventIndex{event_index}, _useIndirect{indirect}, _packed{false},
+		_mitigation{defaultMitigation} {
 	// Construct the hardware state.
 	_table = new (table) spec::Descriptor[_queueSize];
 	_availableRing = new (available) spec::AvailableRing;
@@ -715,6 +969,44 @@ Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *tabl
 	for(size_t i = 0; i < _queueSize; i++)
 		_descriptorStack.push_back(i);
 	_activeRequests.resize(_queueSize);
+	if(_useIndirect)
+		_indirectTables.resize(_queueSize);
+}
+
+Queue::Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		bool event_index, bool indirect)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0},
+		_useEventIndex{event_index}, _useIndirect{indirect}, _packed{true},
+		_mitigation{defaultMitigation} {
+	// Construct the hardware state.
+	_packedRing = new (ring) spec::PackedDescriptor[_queueSize];
+	_driverEvent = new (driver_event) spec::EventSuppression;
+	_deviceEvent = new (device_event) spec::EventSuppression;
+
+	// Descriptors with neither AVAIL nor USED set are not available
+	// as the wrap counters start at 1.
+	for(size_t i = 0; i < _queueSize; i++) {
+		_packedRing[i].address.store(0);
+		_packedRing[i].length.store(0);
+		_packedRing[i].id.store(0xFFFF);
+		_packedRing[i].flags.store(0);
+	}
+
+	_driverEvent->offsetWrap.store(0);
+	_driverEvent->flags.store(RING_EVENT_FLAGS_ENABLE);
+	_deviceEvent->offsetWrap.store(0);
+	_deviceEvent->flags.store(RING_EVENT_FLAGS_ENABLE);
+
+	// Construct the software state.
+	_stagingTable = std::make_unique<spec::Descriptor[]>(_queueSize);
+	_table = _stagingTable.get();
+	for(size_t i = 0; i < _queueSize; i++)
+		_descriptorStack.push_back(i);
+	_activeRequests.resize(_queueSize);
+	if(_useIndirect)
+		_indirectTables.resize(_queueSize);
+	_stagedHeads.reserve(_queueSize);
 }
 
 async::result<Handle> Queue::obtainDescriptor() {
@@ -736,40 +1028,194 @@ async::result<Handle> Queue::obtainDescriptor() {
 	}
 }
 
+async::result<void> Queue::obtainDescriptors(Handle *handles, size_t count) {
+	assert(count <= _queueSize);
+	while(_descriptorStack.size() < count)
+		co_await _descriptorDoorbell.async_wait();
+
+	for(size_t i = 0; i < count; i++) {
+		size_t table_index = _descriptorStack.back();
+		_descriptorStack.pop_back();
+
+		auto descriptor = _table + table_index;
+		descriptor->address.store(0);
+		descriptor->length.store(0);
+		descriptor->flags.store(0);
+
+		handles[i] = Handle{this, table_index};
+	}
+}
+
 void Queue::postDescriptor(Handle handle, Request *request,
 		void (*complete)(Request *)) {
+	stageDescriptor(handle, request, complete);
+	publishDescriptors();
+}
+
+void Queue::stageDescriptor(Handle handle, Request *request,
+		void (*complete)(Request *)) {
 	request->complete = complete;
 
 	assert(request);
 	assert(!_activeRequests[handle.tableIndex()]);
 	_activeRequests[handle.tableIndex()] = request;
 
-	auto enqueue_head = _availableRing->headIndex.load();
-	auto ring_index = enqueue_head & (_queueSize - 1);
+	if(_packed) {
+		// Copy the chain to consecutive slots of the ring. The flags of the first
+		// descriptor are written by publishDescriptors() such that the device
+		// never observes partial chains.
+		auto head_slot = _availSlot;
+		uint16_t head_flags = 0;
+		auto table_index = handle.tableIndex();
+		while(true) {
+			auto descriptor = _table + table_index;
+			auto flags = descriptor->flags.load();
+
+			uint16_t ring_flags = flags
+					& (VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_INDIRECT);
+			if(flags & VIRTQ_DESC_F_INDIRECT)
+				_convertIndirect(table_index);
+			ring_flags |= _availWrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+
+			auto element = _packedRing + _availSlot;
+			element->address.store(descriptor->address.load());
+			element->length.store(descriptor->length.load());
+			element->id.store(handle.tableIndex());
+			if(_availSlot == head_slot) {
+				head_flags = ring_flags;
+			}else{
+				element->flags.store(ring_flags);
+			}
+
+			if(++_availSlot == _queueSize) {
+				_availSlot = 0;
+				_availWrap = !_availWrap;
+			}
+			_numAdded++;
+
+			if(!(flags & VIRTQ_DESC_F_NEXT))
+				break;
+			table_index = descriptor->next.load();
+		}
+
+		_stagedHeads.push_back({head_slot, head_flags});
+		return;
+	}
+
+	auto ring_index = _stagedHead & (_queueSize - 1);
 	_availableRing->elements[ring_index].tableIndex.store(handle.tableIndex());
+	_stagedHead++;
+}
 
+void Queue::publishDescriptors() {
 	asm volatile ( "" : : : "memory" );
-	_availableRing->headIndex.store(enqueue_head + 1);
+
+	if(_packed) {
+		for(auto head : _stagedHeads)
+			_packedRing[head.slot].flags.store(head.flags);
+		_stagedHeads.clear();
+		return;
+	}
+
+	_availableRing->headIndex.store(_stagedHead);
 }
 
 void Queue::notify() {
-	asm volatile ( "" : : : "memory" );
-	if(!(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY))
+	assert(_packed ? _stagedHeads.empty() : _stagedHead == _availableRing->headIndex.load());
+
+	// The device's notification suppression state must be read after
+	// the new available ring index becomes visible.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	bool need_notify;
+	if(_packed) {
+		auto flags = _deviceEvent->flags.load();
+		if(flags == RING_EVENT_FLAGS_DESC) {
+			// The event offset is relative to the wrap counter that the device specifies.
+			auto offset_wrap = _deviceEvent->offsetWrap.load();
+			uint16_t event_index = offset_wrap & 0x7FFF;
+			if(static_cast<bool>(offset_wrap >> 15) != _availWrap)
+				event_index -= _queueSize;
+			need_notify = needEvent(event_index, _availSlot, _availSlot - _numAdded);
+		}else{
+			need_notify = (flags != RING_EVENT_FLAGS_DISABLE);
+		}
+		_numAdded = 0;
+	}else if(_useEventIndex) {
+		auto head = _availableRing->headIndex.load();
+		need_notify = needEvent(_usedExtra->eventIndex.load(), head, _notifiedHead);
+		_notifiedHead = head;
+	}else{
+		need_notify = !(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY);
+	}
+
+	if(need_notify) {
+		_stats.numNotifications++;
 		notifyTransport();
+	}
 }
 
 void Queue::processInterrupt() {
-	while(true) {
-		auto used_head = _usedRing->headIndex.load();
-		// TODO: I think this assertion is incorrect once we issue more than 2^16 requests.
-		assert(_progressHead <= used_head);
-		if(_progressHead == used_head)
-			break;
+	_stats.numInterrupts++;
+
+	// Interrupts that arrive in polling mode (e.g., because the device ignores
+	// VIRTQ_AVAIL_F_NO_INTERRUPT or because the IRQ is shared) are handled by the poll loop.
+	if(_polling)
+		return;
+
+	if(!_mitigation.enable) {
+		do {
+			_retireCompletions(SIZE_MAX);
+		} while(!_enableInterrupts());
+		return;
+	}
+
+	// Do not enter polling mode if the IRQ was not meant for this virtq.
+	auto count = _retireCompletions(_mitigation.pollBudget);
+	if(!count)
+		return;
+
+	_disableInterrupts();
+	_polling = true;
+	_pollUsedRing(count == _mitigation.pollBudget);
+}
+
+void Queue::dumpStats() {
+	std::cout << "core-virtio: Queue " << _queueIndex << ": "
+			<< _stats.numInterrupts << " interrupts, "
+			<< _stats.numCompletions << " completions ("
+			<< _stats.numPolledCompletions << " polled) in "
+			<< _stats.numPollRounds << " poll rounds, "
+			<< _stats.numNotifications << " notifications" << std::endl;
+}
+
+size_t Queue::_retireCompletions(size_t budget) {
+	size_t count = 0;
+	while(count < budget) {
+		size_t table_index;
+		if(_packed) {
+			auto element = _packedRing + _usedSlot;
+			auto flags = element->flags.load();
+			bool avail = flags & VIRTQ_DESC_F_AVAIL;
+			bool used = flags & VIRTQ_DESC_F_USED;
+			if(avail != used || used != _usedWrap)
+				break;
+
+			asm volatile ( "" : : : "memory" );
+
+			table_index = element->id.load();
+		}else{
+			auto used_head = _usedRing->headIndex.load();
+			// Both indices wrap around at 2^16.
+			assert(static_cast<uint16_t>(used_head - _progressHead) <= _queueSize);
+			if(_progressHead == used_head)
+				break;
 		
-		asm volatile ( "" : : : "memory" );
+			asm volatile ( "" : : : "memory" );
 
-		auto ring_index = _progressHead & (_queueSize - 1);
-		auto table_index = _usedRing->elements[ring_index].tableIndex.load();
+			auto ring_index = _progressHead & (_queueSize - 1);
+			table_index = _usedRing->elements[ring_index].tableIndex.load();
+		}
 		assert(table_index < _queueSize);
 
 		// Dequeue the Request object.
@@ -777,22 +1223,130 @@ void Queue::processInterrupt() {
 		assert(request);
 		_activeRequests[table_index] = nullptr;
 
-		// Free all descriptors in the descriptor chain.
-		auto chain_index = table_index;
-		while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
-			auto successor = _table[chain_index].next.load();
-			_descriptorStack.push_back(chain_index);
-			chain_index = successor;
+		// The device skips over all slots of the chain in the packed ring.
+		auto length = _freeChain(table_index);
+		if(_packed) {
+			_usedSlot += length;
+			if(_usedSlot >= _queueSize) {
+				_usedSlot -= _queueSize;
+				_usedWrap = !_usedWrap;
+			}
+		}else{
+			_progressHead++;
 		}
-		_descriptorStack.push_back(chain_index);
-		_descriptorDoorbell.ring();
 
 		// Call the completion handler.
 		request->complete(request);
+		count++;
+	}
+
+	_stats.numCompletions += count;
+	return count;
+}
 
-		_progressHead++;
+bool Queue::_hasCompletions() {
+	if(_packed) {
+		auto flags = _packedRing[_usedSlot].flags.load();
+		bool avail = flags & VIRTQ_DESC_F_AVAIL;
+		bool used = flags & VIRTQ_DESC_F_USED;
+		return avail == used && used == _usedWrap;
 	}
+	return _usedRing->headIndex.load() != _progressHead;
 }
 
-} // namespace virtio_core
+// Indirect tables of packed virtqs consist of spec::PackedDescriptor elements;
+// the chain is implied by the order of the elements.
+// As both structs have the same size, the table can be converted in place.
+void Queue::_convertIndirect(size_t table_index) {
+	auto descriptor = _table + table_index;
+	auto table = _indirectTables[table_index].descriptors.data();
+	auto elements = reinterpret_cast<spec::PackedDescriptor *>(table);
+	for(size_t i = 0; i < descriptor->length.load() / sizeof(spec::Descriptor); i++) {
+		auto flags = table[i].flags.load();
+		assert(!(flags & VIRTQ_DESC_F_NEXT) || table[i].next.load() == i + 1);
+		elements[i].id.store(0);
+		elements[i].flags.store(flags & VIRTQ_DESC_F_WRITE);
+	}
+}
+
+size_t Queue::_freeChain(size_t table_index) {
+	size_t length = 1;
+	auto chain_index = table_index;
+	while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
+		auto successor = _table[chain_index].next.load();
+		_descriptorStack.push_back(chain_index);
+		chain_index = successor;
+		length++;
+	}
+	_descriptorStack.push_back(chain_index);
+	_descriptorDoorbell.ring();
+	return length;
+}
+
+void Queue::_disableInterrupts() {
+	if(_packed) {
+		_driverEvent->flags.store(RING_EVENT_FLAGS_DISABLE);
+	}else if(_useEventIndex) {
+		// Move the used event index as far away as possible. We refresh it while polling.
+		_availableExtra->eventIndex.store(_progressHead + 0x8000);
+	}else{
+		_availableRing->flags.store(_availableRing->flags.load() | VIRTQ_AVAIL_F_NO_INTERRUPT);
+	}
+}
+
+bool Queue::_enableInterrupts() {
+	// Request an interrupt for the next used element.
+	if(_packed) {
+		if(_useEventIndex) {
+			_driverEvent->offsetWrap.store(_usedSlot | (uint16_t{_usedWrap} << 15));
+			_driverEvent->flags.store(RING_EVENT_FLAGS_DESC);
+		}else{
+			_driverEvent->flags.store(RING_EVENT_FLAGS_ENABLE);
+		}
+	}else if(_useEventIndex) {
+		_availableExtra->eventIndex.store(_progressHead);
+	}else{
+		_availableRing->flags.store(_availableRing->flags.load() & ~VIRTQ_AVAIL_F_NO_INTERRUPT);
+	}
+
+	// The device might have used an element before it observed the update above.
+	// Re-check the used ring to avoid missing that completion.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return !_hasCompletions();
+}
 
+async::detached Queue::_pollUsedRing(bool exhausted) {
+	uint64_t idle = 0;
+	while(true) {
+		// If the budget was exhausted, only yield to other coroutines.
+		if(exhausted) {
+			co_await sleepFor(0);
+		}else{
+			co_await sleepFor(_mitigation.pollInterval);
+			idle += _mitigation.pollInterval;
+		}
+
+		_stats.numPollRounds++;
+		auto count = _retireCompletions(_mitigation.pollBudget);
+		_stats.numPolledCompletions += count;
+		exhausted = (count == _mitigation.pollBudget);
+		if(count) {
+			_disableInterrupts();
+			idle = 0;
+			continue;
+		}
+		if(idle < _mitigation.idleTimeout)
+			continue;
+
+		if(_enableInterrupts())
+			break;
+		_disableInterrupts();
+		idle = 0;
+	}
+
+	_polling = false;
+	if(_mitigation.logStats)
+		dumpStats();
+}
+
+} // namespace virtio_core
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
+#include <arch/dma_structs.hpp>
+#include <arch/mem_space.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/hw/client.hpp>
+
+#include "spec.hpp"
+
+struct Controller;
+
+// Spins until cond() becomes true; returns false after one second.
+// One second is the timeout that the AHCI specification uses for most operations.
+template<typename F>
+bool waitFor(F cond) {
+	uint64_t start;
+	HEL_CHECK(helGetClock(&start));
+	while(!cond()) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		if(now - start > 1'000'000'000)
+			return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Port
+// --------------------------------------------------------
+
+// A port with an attached SATA disk.
+struct Port : blockfs::BlockDevice {
+	Port(Controller *controller, unsigned int index, arch::mem_space space);
+
+	// Returns false if there is no (usable) ATA device attached to the port.
+	async::result<bool> initialize();
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	// Called by the controller if the port's bit is set in the HBA's IS register.
+	void handleIrq();
+
+private:
+	enum class CommandType {
+		identify,
+		readLog, // The sector field stores the log address.
+		read,
+		write
+	};
+
+	struct Command {
+		CommandType type;
+		uint64_t sector;
+		void *buffer;
+		size_t numSectors;
+		// Number of times that the command failed and was reissued.
+		unsigned int retries = 0;
+		// Only used for READ LOG EXT: set if the command was aborted due to an error.
+		bool failed = false;
+		async::promise<void> promise;
+	};
+
+	// Splits a transfer into commands and submits all of them at once.
+	async::result<void> _transfer(CommandType type, uint64_t sector,
+			void *buffer, size_t num_sectors);
+
+	// Issues pending commands as long as there are free command slots.
+	void _submitPending();
+
+	// Returns true if the command is issued as an NCQ command.
+	bool _isQueued(Command *command) {
+		return _useNcq && (command->type == CommandType::read
+				|| command->type == CommandType::write);
+	}
+
+	// Restarts the port after an error and reissues all aborted commands.
+	void _recover();
+
+	// After an NCQ error, the device aborts all commands until the NCQ error log is read.
+	// The log identifies the failed command; the other commands are reissued as-is.
+	async::detached _recoverNcq(std::array<Command *, maxCommandSlots> aborted);
+
+	// Queues an aborted command in front of the pending commands. Commands that
+	// failed themselves are only retried a few times.
+	void _reissue(Command *command, bool failed);
+
+	// Fills the command header and command table of a slot.
+	void _setupCommand(size_t slot, Command *command);
+
+	// Returns the number of PRDT entries that were used.
+	size_t _setupPrdt(CommandTable *table, void *buffer, size_t size);
+
+	Controller *_controller;
+	unsigned int _index;
+	arch::mem_space _space;
+
+	arch::dma_object<CommandList> _commandList;
+	arch::dma_object<ReceivedFis> _receivedFis;
+	std::vector<arch::dma_object<CommandTable>> _commandTables;
+
+	std::deque<Command *> _pendingQueue;
+
+	// Commands that occupy each slot.
+	Command *_slots[maxCommandSlots] = {};
+
+	// Bit mask of slots that were issued but did not complete yet.
+	uint32_t _issuedSlots = 0;
+
+	// Set while a non-queued command is issued; no other commands may be issued then.
+	bool _nonQueuedIssued = false;
+
+	// Number of slots that we use (i.e., the queue depth).
+	size_t _numSlots = 1;
+
+	bool _useNcq = false;
+	bool _supportsLba48 = false;
+	uint64_t _numSectors = 0;
+};
+
+// --------------------------------------------------------
+// Controller
+// --------------------------------------------------------
+
+struct Controller {
+	Controller(protocols::hw::Device hw_device, helix::Mapping mapping,
+			helix::UniqueDescriptor mmio, helix::UniqueIrq irq);
+
+	async::detached run();
+
+	arch::dma_pool *dmaPool() {
+		return &_dmaPool;
+	}
+
+	// Number of command slots per port.
+	size_t numCommandSlots() {
+		return ((_cap >> cap::numSlotsShift) & cap::numSlotsMask) + 1;
+	}
+
+	bool supportsNcq() {
+		return _cap & cap::sncq;
+	}
+
+	bool supports64Bit() {
+		return _cap & cap::s64a;
+	}
+
+private:
+	async::detached _handleIrqs();
+
+	protocols::hw::Device _hwDevice;
+	helix::Mapping _mapping;
+	helix::UniqueDescriptor _mmio;
+	helix::UniqueIrq _irq;
+	arch::mem_space _space;
+	arch::contiguous_pool _dmaPool;
+
+	uint32_t _cap = 0;
+
+	// Indexed by port number. Null if no disk is attached to the port.
+	std::unique_ptr<Port> _ports[32];
+};
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdio.h>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "ahci.hpp"
+
+namespace {
+	constexpr bool logIrqs = false;
+}
+
+Controller::Controller(protocols::hw::Device hw_device, helix::Mapping mapping,
+		helix::UniqueDescriptor mmio, helix::UniqueIrq irq)
+: _hwDevice{std::move(hw_device)}, _mapping{std::move(mapping)},
+		_mmio{std::move(mmio)}, _irq{std::move(irq)},
+		_space{_mapping.get()} { }
+
+async::detached Controller::run() {
+	// Enable bus mastering in the PCI command register.
+	auto command = co_await _hwDevice.loadPciSpace(0x04, 2);
+	co_await _hwDevice.storePciSpace(0x04, 2, command | 0x04);
+
+	// Reset the HBA to get into a known state. This also stops all ports.
+	_space.store(regs::ghc, ghc::ae);
+	_space.store(regs::ghc, ghc::ae | ghc::hr);
+	if(!waitFor([&] { return !(_space.load(regs::ghc) & ghc::hr); })) {
+		printf("block/ahci: HBA reset does not complete\n");
+		co_return;
+	}
+	_space.store(regs::ghc, ghc::ae);
+
+	_cap = _space.load(regs::cap);
+	auto version = _space.load(regs::vs);
+	auto implemented = _space.load(regs::pi);
+
+	// Give the PHYs time to (re-)establish their links. Ports without a link
+	// after this are ignored by Port::initialize().
+	waitFor([&] {
+		for(unsigned int i = 0; i < 32; i++) {
+			if(!(implemented & (1u << i)))
+				continue;
+			auto ssts = _space.subspace(0x100 + i * 0x80).load(port_regs::ssts);
+			if((ssts & port_ssts::detMask) != port_ssts::detPresent)
+				return false;
+		}
+		return true;
+	});
+	printf("block/ahci: AHCI %x.%x, %u command slots, %s NCQ, %s 64-bit addressing\n",
+			version >> 16, version & 0xFFFF, static_cast<unsigned int>(numCommandSlots()),
+			supportsNcq() ? "supports" : "doesn't support",
+			supports64Bit() ? "supports" : "doesn't support");
+
+	// Ports are initialized using commands; hence, we need IRQs at this point.
+	_space.store(regs::is, 0xFFFFFFFF);
+	co_await _hwDevice.enableBusIrq();
+	_handleIrqs();
+	_space.store(regs::ghc, ghc::ae | ghc::ie);
+
+	Port *disk = nullptr;
+	for(unsigned int i = 0; i < 32; i++) {
+		if(!(implemented & (1u << i)))
+			continue;
+
+		// The port must be visible to _handleIrqs() during initialization.
+		_ports[i] = std::make_unique<Port>(this, i, _space.subspace(0x100 + i * 0x80));
+		if(!(co_await _ports[i]->initialize())) {
+			_ports[i] = nullptr;
+			continue;
+		}
+
+		if(!disk)
+			disk = _ports[i].get();
+	}
+
+	// TODO: Support more than one device.
+	if(disk)
+		blockfs::runDevice(disk);
+}
+
+async::detached Controller::_handleIrqs() {
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(_irq, &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		auto is = _space.load(regs::is);
+		if(!is) {
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, sequence));
+			continue;
+		}
+		if(logIrqs)
+			std::cout << "block/ahci: IRQ for ports " << std::hex << is << std::dec << std::endl;
+
+		// The port IS registers must be cleared before the HBA IS register.
+		for(unsigned int i = 0; i < 32; i++) {
+			if(!(is & (1u << i)))
+				continue;
+			if(_ports[i]) {
+				_ports[i]->handleIrq();
+			}else{
+				auto port_space = _space.subspace(0x100 + i * 0x80);
+				port_space.store(port_regs::is, port_space.load(port_regs::is));
+			}
+		}
+		_space.store(regs::is, is);
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+	}
+}
@@ -0,0 +1,442 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "ahci.hpp"
+
+namespace {
+	constexpr bool logCommands = false;
+
+	// Set to false to issue one (non-queued) command at a time, even if NCQ is available.
+	constexpr bool enableNcq = true;
+
+	// Number of times that a failed command is retried before we give up.
+	constexpr unsigned int maxRetries = 3;
+
+	uintptr_t physicalOf(void *pointer) {
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical(pointer, &physical));
+		return physical;
+	}
+}
+
+Port::Port(Controller *controller, unsigned int index, arch::mem_space space)
+: BlockDevice{512}, _controller{controller}, _index{index}, _space{space} { }
+
+async::result<bool> Port::initialize() {
+	auto ssts = _space.load(port_regs::ssts);
+	if((ssts & port_ssts::detMask) != port_ssts::detPresent
+			|| ((ssts >> port_ssts::ipmShift) & port_ssts::ipmMask) != port_ssts::ipmActive)
+		co_return false;
+
+	auto signature = _space.load(port_regs::sig);
+	if(signature != port_sig::ata) {
+		printf("block/ahci: Ignoring device with signature %x on port %u\n",
+				signature, _index);
+		co_return false;
+	}
+
+	// The command list and FIS receive engines must be stopped before they are reconfigured.
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) & ~port_cmd::st);
+	if(!waitFor([&] { return !(_space.load(port_regs::cmd) & port_cmd::cr); })) {
+		printf("block/ahci: Port %u does not stop\n", _index);
+		co_return false;
+	}
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) & ~port_cmd::fre);
+	if(!waitFor([&] { return !(_space.load(port_regs::cmd) & port_cmd::fr); })) {
+		printf("block/ahci: Port %u does not stop receiving FISes\n", _index);
+		co_return false;
+	}
+
+	// Allocate the command list, the received FIS area and one command table per slot.
+	// The pool allocates in 32-bit physical memory; hence, the upper halves are zero.
+	auto pool = _controller->dmaPool();
+	_commandList = arch::dma_object<CommandList>{pool};
+	_receivedFis = arch::dma_object<ReceivedFis>{pool};
+	memset(_commandList.data(), 0, sizeof(CommandList));
+	memset(_receivedFis.data(), 0, sizeof(ReceivedFis));
+
+	for(size_t i = 0; i < _controller->numCommandSlots(); i++) {
+		_commandTables.push_back(arch::dma_object<CommandTable>{pool});
+		auto physical = physicalOf(_commandTables.back().data());
+		_commandList->slots[i].ctba = physical;
+		_commandList->slots[i].ctbaUpper = physical >> 32;
+	}
+
+	auto list_physical = physicalOf(_commandList.data());
+	auto fis_physical = physicalOf(_receivedFis.data());
+	_space.store(port_regs::clb, list_physical);
+	_space.store(port_regs::clbu, list_physical >> 32);
+	_space.store(port_regs::fb, fis_physical);
+	_space.store(port_regs::fbu, fis_physical >> 32);
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) | port_cmd::fre);
+
+	_space.store(port_regs::serr, 0xFFFFFFFF);
+	_space.store(port_regs::is, 0xFFFFFFFF);
+
+	if(!waitFor([&] {
+		return !(_space.load(port_regs::tfd) & (port_tfd::bsy | port_tfd::drq));
+	})) {
+		printf("block/ahci: Device on port %u stays busy\n", _index);
+		co_return false;
+	}
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) | port_cmd::st);
+	_space.store(port_regs::ie, port_is::dhrs | port_is::pss | port_is::sdbs
+			| port_is::dps | port_is::errors);
+
+	// Identify the device. At this point, only a single slot is used.
+	arch::dma_buffer identify{pool, 512};
+	co_await _transfer(CommandType::identify, 0, identify.data(), 1);
+	auto words = reinterpret_cast<uint16_t *>(identify.data());
+
+	char model[41];
+	for(int i = 0; i < 20; i++) {
+		// The model name is stored as big endian words.
+		model[2 * i] = words[27 + i] >> 8;
+		model[2 * i + 1] = words[27 + i] & 0xFF;
+	}
+	model[40] = 0;
+
+	_supportsLba48 = words[83] & (1 << 10);
+	if(_supportsLba48) {
+		_numSectors = static_cast<uint64_t>(words[100])
+				| (static_cast<uint64_t>(words[101]) << 16)
+				| (static_cast<uint64_t>(words[102]) << 32)
+				| (static_cast<uint64_t>(words[103]) << 48);
+	}else{
+		_numSectors = static_cast<uint64_t>(words[60])
+				| (static_cast<uint64_t>(words[61]) << 16);
+	}
+
+	// Word 76 bit 8 indicates NCQ support; word 75 stores the queue depth minus one.
+	if(enableNcq && _controller->supportsNcq() && (words[76] & (1 << 8))) {
+		_useNcq = true;
+		_numSlots = std::min(_controller->numCommandSlots(), size_t{(words[75] & 0x1Fu) + 1u});
+	}
+
+	// Word 217 (nominal media rotation rate) is 1 for non-rotating media.
+	queueDepth = _numSlots;
+	rotational = words[217] != 1;
+
+	printf("block/ahci: Port %u: model '%s', %lu sectors, %s, queue depth %lu\n",
+			_index, model, _numSectors, _useNcq ? "NCQ" : "no NCQ", _numSlots);
+	co_return true;
+}
+
+async::result<void> Port::readSectors(uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	co_await _transfer(CommandType::read, sector, buffer, num_sectors);
+}
+
+async::result<void> Port::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _transfer(CommandType::write, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+void Port::handleIrq() {
+	auto is = _space.load(port_regs::is);
+	_space.store(port_regs::is, is);
+
+	// Queued commands are complete once their SACT bit is cleared,
+	// non-queued commands once their CI bit is cleared.
+	// On errors, the bits of the affected commands stay set.
+	auto outstanding = _space.load(port_regs::ci) | _space.load(port_regs::sact);
+	auto completed = _issuedSlots & ~outstanding;
+
+	// Update the state before completing the commands; this allows the
+	// completion handlers to submit new commands.
+	Command *commands[maxCommandSlots];
+	size_t num_completed = 0;
+	for(size_t i = 0; i < maxCommandSlots; i++) {
+		if(!(completed & (1u << i)))
+			continue;
+		assert(_slots[i]);
+		commands[num_completed++] = _slots[i];
+		_slots[i] = nullptr;
+	}
+	_issuedSlots &= ~completed;
+	if(!_issuedSlots)
+		_nonQueuedIssued = false;
+
+	if(is & port_is::errors) {
+		std::cout << "\e[31m" "block/ahci: Error on port " << _index
+				<< ", IS: " << std::hex << is
+				<< ", TFD: " << _space.load(port_regs::tfd)
+				<< ", SERR: " << _space.load(port_regs::serr) << std::dec
+				<< "\e[39m" << std::endl;
+		_recover();
+	}
+
+	if(logCommands && num_completed)
+		std::cout << "block/ahci: Completed " << num_completed << " commands" << std::endl;
+
+	for(size_t i = 0; i < num_completed; i++)
+		commands[i]->promise.set_value();
+	_submitPending();
+}
+
+void Port::_recover() {
+	// Clearing ST resets CI and SACT; this aborts all issued commands (AHCI 1.3.1, 6.2.2).
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) & ~port_cmd::st);
+	if(!waitFor([&] { return !(_space.load(port_regs::cmd) & port_cmd::cr); }))
+		std::cout << "\e[31m" "block/ahci: Port " << _index << " does not stop"
+				"\e[39m" << std::endl;
+
+	_space.store(port_regs::serr, 0xFFFFFFFF);
+	_space.store(port_regs::is, 0xFFFFFFFF);
+
+	// TODO: Issue a COMRESET if the device does not become idle.
+	if(!waitFor([&] {
+		return !(_space.load(port_regs::tfd) & (port_tfd::bsy | port_tfd::drq));
+	}))
+		std::cout << "\e[31m" "block/ahci: Device on port " << _index << " stays busy"
+				"\e[39m" << std::endl;
+	_space.store(port_regs::cmd, _space.load(port_regs::cmd) | port_cmd::st);
+
+	// Indexed by slot (i.e., by NCQ tag).
+	std::array<Command *, maxCommandSlots> aborted{};
+	bool queued_error = false;
+	for(size_t i = 0; i < maxCommandSlots; i++) {
+		if(!(_issuedSlots & (1u << i)))
+			continue;
+		assert(_slots[i]);
+		if(_isQueued(_slots[i]))
+			queued_error = true;
+		aborted[i] = _slots[i];
+		_slots[i] = nullptr;
+	}
+	_issuedSlots = 0;
+	_nonQueuedIssued = false;
+
+	if(queued_error) {
+		_recoverNcq(aborted);
+		return;
+	}
+
+	// Non-queued commands are issued one at a time; hence, the aborted command failed.
+	for(auto command : aborted) {
+		if(!command)
+			continue;
+		if(command->type == CommandType::readLog) {
+			command->failed = true;
+			command->promise.set_value();
+		}else{
+			_reissue(command, true);
+		}
+	}
+}
+
+void Port::_reissue(Command *command, bool failed) {
+	if(failed && ++command->retries > maxRetries) {
+		// BlockDevice has no way to report errors to the caller.
+		std::cout << "\e[31m" "block/ahci: I/O error on port " << _index
+				<< " at sector " << command->sector
+				<< " (" << command->numSectors << " sectors)" "\e[39m" << std::endl;
+		assert(!"AHCI I/O error");
+	}
+	_pendingQueue.push_front(command);
+}
+
+async::detached Port::_recoverNcq(std::array<Command *, maxCommandSlots> aborted) {
+	arch::dma_buffer log{_controller->dmaPool(), 512};
+
+	Command command;
+	command.type = CommandType::readLog;
+	command.sector = logNcqCommandError;
+	command.buffer = log.data();
+	command.numSectors = 1;
+	_pendingQueue.push_front(&command);
+	_submitPending();
+
+	co_await command.promise.async_get();
+
+	// Byte 0 stores the tag of the failed command (bit 7 is set if the error
+	// was not caused by a queued command), bytes 2 and 3 its status and error.
+	auto data = reinterpret_cast<uint8_t *>(log.data());
+	int failed_tag = -1;
+	if(command.failed) {
+		std::cout << "\e[31m" "block/ahci: Could not read NCQ error log of port " << _index
+				<< "\e[39m" << std::endl;
+	}else if(!(data[0] & 0x80)) {
+		failed_tag = data[0] & 0x1F;
+		std::cout << "block/ahci: NCQ error on port " << _index
+				<< ", tag: " << failed_tag << std::hex
+				<< ", status: " << static_cast<unsigned int>(data[2])
+				<< ", error: " << static_cast<unsigned int>(data[3]) << std::dec << std::endl;
+	}
+
+	// If the log does not name a command, all aborted commands count as failed.
+	// Iterate backwards such that the commands keep their order in _pendingQueue.
+	for(size_t i = maxCommandSlots; i-- > 0; ) {
+		if(!aborted[i])
+			continue;
+		_reissue(aborted[i], failed_tag < 0 || static_cast<size_t>(failed_tag) == i);
+	}
+	_submitPending();
+}
+
+async::result<void> Port::_transfer(CommandType type, uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	// Natural alignment makes sure a sector does not cross a page boundary.
+	assert(!(reinterpret_cast<uintptr_t>(buffer) % 512));
+
+	// Each chunk must fit into the PRDT (even if no pages are physically contiguous).
+	// READ DMA (i.e., without LBA48) encodes 256 sectors as zero; we avoid that case.
+	size_t max_sectors = (numPrdtEntries - 1) * (0x1000 / 512);
+	if(!_supportsLba48)
+		max_sectors = std::min(max_sectors, size_t{255});
+
+	// Enqueue all chunks before submitting them; they are processed concurrently.
+	std::vector<std::unique_ptr<Command>> commands;
+	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
+		auto command = std::make_unique<Command>();
+		command->type = type;
+		command->sector = sector + progress;
+		command->buffer = reinterpret_cast<char *>(buffer) + progress * 512;
+		command->numSectors = std::min(num_sectors - progress, max_sectors);
+		_pendingQueue.push_back(command.get());
+		commands.push_back(std::move(command));
+	}
+	_submitPending();
+
+	// Failed commands are retried in _recover(); they never complete unsuccessfully.
+	for(auto &command : commands)
+		co_await command->promise.async_get();
+}
+
+void Port::_submitPending() {
+	// Issue all commands with a single write to SACT and CI.
+	uint32_t issue = 0;
+	uint32_t queued = 0;
+	while(!_pendingQueue.empty()) {
+		auto command = _pendingQueue.front();
+
+		// Non-queued commands must be issued one at a time.
+		bool is_queued = _isQueued(command);
+		if((!is_queued || _nonQueuedIssued) && (_issuedSlots | issue))
+			break;
+
+		uint32_t free_slots = ~(_issuedSlots | issue);
+		if(_numSlots < 32)
+			free_slots &= (1u << _numSlots) - 1;
+		if(!free_slots)
+			break;
+		auto slot = __builtin_ctz(free_slots);
+
+		_pendingQueue.pop_front();
+		assert(!_slots[slot]);
+		_slots[slot] = command;
+		_setupCommand(slot, command);
+		issue |= 1u << slot;
+		if(!is_queued) {
+			_nonQueuedIssued = true;
+			break;
+		}
+		queued |= 1u << slot;
+	}
+
+	if(!issue)
+		return;
+	if(logCommands)
+		std::cout << "block/ahci: Issuing slots " << std::hex << issue << std::dec << std::endl;
+
+	_issuedSlots |= issue;
+	asm volatile ("" : : : "memory");
+	if(queued)
+		_space.store(port_regs::sact, queued);
+	_space.store(port_regs::ci, issue);
+}
+
+void Port::_setupCommand(size_t slot, Command *command) {
+	auto table = _commandTables[slot].data();
+	memset(table->commandFis, 0, sizeof(table->commandFis));
+
+	auto fis = reinterpret_cast<FisRegH2D *>(table->commandFis);
+	fis->type = fisTypeRegH2D;
+	fis->flags = 0x80;
+
+	bool write = false;
+	if(command->type == CommandType::identify) {
+		fis->command = kCommandIdentify;
+	}else if(command->type == CommandType::readLog) {
+		fis->command = kCommandReadLogExt;
+		fis->lba0 = command->sector;
+		fis->countLow = command->numSectors;
+	}else{
+		write = (command->type == CommandType::write);
+		auto count = command->numSectors;
+		if(_useNcq) {
+			// For FPDMA QUEUED commands, the sector count is stored in the features
+			// registers while the count register stores the tag.
+			fis->command = write ? kCommandWriteFpdmaQueued : kCommandReadFpdmaQueued;
+			fis->featuresLow = count & 0xFF;
+			fis->featuresHigh = (count >> 8) & 0xFF;
+			fis->countLow = slot << 3;
+		}else{
+			if(_supportsLba48) {
+				fis->command = write ? kCommandWriteDmaExt : kCommandReadDmaExt;
+			}else{
+				assert(!(command->sector >> 28));
+				fis->command = write ? kCommandWriteDma : kCommandReadDma;
+			}
+			fis->countLow = count & 0xFF;
+			fis->countHigh = (count >> 8) & 0xFF;
+		}
+		fis->device = deviceLba;
+		fis->lba0 = command->sector & 0xFF;
+		fis->lba1 = (command->sector >> 8) & 0xFF;
+		fis->lba2 = (command->sector >> 16) & 0xFF;
+		fis->lba3 = (command->sector >> 24) & 0xFF;
+		fis->lba4 = (command->sector >> 32) & 0xFF;
+		fis->lba5 = (command->sector >> 40) & 0xFF;
+	}
+
+	auto num_prdts = _setupPrdt(table, command->buffer, command->numSectors * 512);
+
+	auto header = &_commandList->slots[slot];
+	header->flags = (sizeof(FisRegH2D) / 4)
+			| (write ? command_header::write : 0)
+			| (num_prdts << command_header::prdtlShift);
+	header->prdByteCount = 0;
+}
+
+size_t Port::_setupPrdt(CommandTable *table, void *buffer, size_t size) {
+	constexpr size_t page_size = 0x1000;
+	size_t n = 0;
+	size_t offset = 0;
+	uintptr_t last_end = 0;
+	while(offset < size) {
+		auto address = reinterpret_cast<uintptr_t>(buffer) + offset;
+		auto chunk = std::min(size - offset, page_size - (address & (page_size - 1)));
+		auto physical = physicalOf(reinterpret_cast<void *>(address));
+		// TODO: Use a bounce buffer instead.
+		assert(_controller->supports64Bit() || !((physical + chunk - 1) >> 32));
+
+		// Merge physically contiguous pages.
+		if(n && last_end == physical) {
+			auto &entry = table->prdts[n - 1];
+			auto entry_size = (entry.flags & 0x3FFFFF) + 1;
+			if(entry_size + chunk <= maxPrdtEntrySize) {
+				entry.flags = entry_size + chunk - 1;
+				offset += chunk;
+				last_end = physical + chunk;
+				continue;
+			}
+		}
+
+		assert(n < numPrdtEntries);
+		auto &entry = table->prdts[n++];
+		entry.dba = physical;
+		entry.dbaUpper = physical >> 32;
+		entry.reserved = 0;
+		entry.flags = chunk - 1;
+		offset += chunk;
+		last_end = physical + chunk;
+	}
+	return n;
+}
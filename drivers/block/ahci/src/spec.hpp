@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <arch/register.hpp>
+
+// --------------------------------------------------------
+// HBA registers
+// --------------------------------------------------------
+
+namespace regs {
+	inline constexpr arch::scalar_register<uint32_t> cap{0x00};
+	inline constexpr arch::scalar_register<uint32_t> ghc{0x04};
+	inline constexpr arch::scalar_register<uint32_t> is{0x08};
+	inline constexpr arch::scalar_register<uint32_t> pi{0x0C};
+	inline constexpr arch::scalar_register<uint32_t> vs{0x10};
+}
+
+namespace cap {
+	inline constexpr uint32_t numPortsMask = 0x1F;
+	inline constexpr uint32_t numSlotsShift = 8;
+	inline constexpr uint32_t numSlotsMask = 0x1F;
+	inline constexpr uint32_t sncq = 1u << 30; // Supports NCQ.
+	inline constexpr uint32_t s64a = 1u << 31; // Supports 64-bit addressing.
+}
+
+namespace ghc {
+	inline constexpr uint32_t hr = 1u << 0; // HBA reset.
+	inline constexpr uint32_t ie = 1u << 1; // Interrupt enable.
+	inline constexpr uint32_t ae = 1u << 31; // AHCI enable.
+}
+
+// Registers of each port; port i is located at offset 0x100 + i * 0x80.
+namespace port_regs {
+	inline constexpr arch::scalar_register<uint32_t> clb{0x00};
+	inline constexpr arch::scalar_register<uint32_t> clbu{0x04};
+	inline constexpr arch::scalar_register<uint32_t> fb{0x08};
+	inline constexpr arch::scalar_register<uint32_t> fbu{0x0C};
+	inline constexpr arch::scalar_register<uint32_t> is{0x10};
+	inline constexpr arch::scalar_register<uint32_t> ie{0x14};
+	inline constexpr arch::scalar_register<uint32_t> cmd{0x18};
+	inline constexpr arch::scalar_register<uint32_t> tfd{0x20};
+	inline constexpr arch::scalar_register<uint32_t> sig{0x24};
+	inline constexpr arch::scalar_register<uint32_t> ssts{0x28};
+	inline constexpr arch::scalar_register<uint32_t> sctl{0x2C};
+	inline constexpr arch::scalar_register<uint32_t> serr{0x30};
+	inline constexpr arch::scalar_register<uint32_t> sact{0x34};
+	inline constexpr arch::scalar_register<uint32_t> ci{0x38};
+}
+
+namespace port_is {
+	inline constexpr uint32_t dhrs = 1u << 0; // Device-to-host register FIS.
+	inline constexpr uint32_t pss = 1u << 1; // PIO setup FIS.
+	inline constexpr uint32_t dss = 1u << 2; // DMA setup FIS.
+	inline constexpr uint32_t sdbs = 1u << 3; // Set device bits FIS.
+	inline constexpr uint32_t dps = 1u << 5; // Descriptor processed.
+	inline constexpr uint32_t ifs = 1u << 27; // Interface fatal error.
+	inline constexpr uint32_t hbds = 1u << 28; // Host bus data error.
+	inline constexpr uint32_t hbfs = 1u << 29; // Host bus fatal error.
+	inline constexpr uint32_t tfes = 1u << 30; // Task file error.
+
+	inline constexpr uint32_t errors = ifs | hbds | hbfs | tfes;
+}
+
+namespace port_cmd {
+	inline constexpr uint32_t st = 1u << 0; // Start.
+	inline constexpr uint32_t fre = 1u << 4; // FIS receive enable.
+	inline constexpr uint32_t fr = 1u << 14; // FIS receive running.
+	inline constexpr uint32_t cr = 1u << 15; // Command list running.
+}
+
+namespace port_tfd {
+	inline constexpr uint32_t err = 1u << 0;
+	inline constexpr uint32_t drq = 1u << 3;
+	inline constexpr uint32_t bsy = 1u << 7;
+}
+
+// Values of port_regs::ssts.
+namespace port_ssts {
+	inline constexpr uint32_t detMask = 0xF;
+	inline constexpr uint32_t detPresent = 3; // Device present and PHY communication established.
+	inline constexpr uint32_t ipmShift = 8;
+	inline constexpr uint32_t ipmMask = 0xF;
+	inline constexpr uint32_t ipmActive = 1;
+}
+
+// Values of port_regs::sig.
+namespace port_sig {
+	inline constexpr uint32_t ata = 0x00000101;
+	inline constexpr uint32_t atapi = 0xEB140101;
+}
+
+// --------------------------------------------------------
+// In-memory structures
+// --------------------------------------------------------
+
+inline constexpr size_t maxCommandSlots = 32;
+
+struct CommandHeader {
+	// Bits 0-4: FIS length in dwords, bit 6: write, bits 16-31: PRDT length.
+	uint32_t flags;
+	uint32_t prdByteCount;
+	uint32_t ctba;
+	uint32_t ctbaUpper;
+	uint32_t reserved[4];
+};
+static_assert(sizeof(CommandHeader) == 32);
+
+namespace command_header {
+	inline constexpr uint32_t write = 1u << 6;
+	inline constexpr uint32_t prdtlShift = 16;
+}
+
+// The command list must be 1 KiB aligned.
+struct alignas(1024) CommandList {
+	CommandHeader slots[maxCommandSlots];
+};
+static_assert(sizeof(CommandList) == 1024);
+
+// The received FIS area must be 256 byte aligned.
+struct alignas(256) ReceivedFis {
+	uint8_t raw[256];
+};
+static_assert(sizeof(ReceivedFis) == 256);
+
+struct PrdtEntry {
+	uint32_t dba;
+	uint32_t dbaUpper;
+	uint32_t reserved;
+	// Bits 0-21: byte count minus one, bit 31: interrupt on completion.
+	uint32_t flags;
+};
+static_assert(sizeof(PrdtEntry) == 16);
+
+// Largest byte count of a single PRDT entry.
+inline constexpr size_t maxPrdtEntrySize = 0x400000;
+
+// Host-to-device register FIS.
+struct FisRegH2D {
+	uint8_t type; // Always 0x27.
+	uint8_t flags; // Bit 7: command (as opposed to control).
+	uint8_t command;
+	uint8_t featuresLow;
+	uint8_t lba0;
+	uint8_t lba1;
+	uint8_t lba2;
+	uint8_t device;
+	uint8_t lba3;
+	uint8_t lba4;
+	uint8_t lba5;
+	uint8_t featuresHigh;
+	uint8_t countLow;
+	uint8_t countHigh;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved[4];
+};
+static_assert(sizeof(FisRegH2D) == 20);
+
+inline constexpr uint8_t fisTypeRegH2D = 0x27;
+
+// The size of the command table is chosen such that it fills exactly one page.
+inline constexpr size_t numPrdtEntries = 248;
+
+// Command tables must be 128 byte aligned.
+struct alignas(128) CommandTable {
+	uint8_t commandFis[64];
+	uint8_t atapiCommand[16];
+	uint8_t reserved[48];
+	PrdtEntry prdts[numPrdtEntries];
+};
+static_assert(sizeof(CommandTable) == 4096);
+
+// --------------------------------------------------------
+// ATA commands
+// --------------------------------------------------------
+
+enum {
+	kCommandReadDmaExt = 0x25,
+	kCommandWriteDmaExt = 0x35,
+	kCommandReadDma = 0xC8,
+	kCommandWriteDma = 0xCA,
+	kCommandReadFpdmaQueued = 0x60,
+	kCommandWriteFpdmaQueued = 0x61,
+	kCommandIdentify = 0xEC,
+	kCommandReadLogExt = 0x2F
+};
+
+// Log address of the NCQ command error log.
+inline constexpr uint8_t logNcqCommandError = 0x10;
+
+inline constexpr uint8_t deviceLba = 0x40;
@@ -1,11 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
+#include <optional>
 #include <queue>
 
 #include <async/result.hpp>
 #include <async/doorbell.hpp>
+#include <arch/dma_pool.hpp>
 #include <arch/io_space.hpp>
 #include <arch/register.hpp>
 #include <helix/ipc.hpp>
@@ -17,6 +20,9 @@
 namespace {
 	constexpr bool logIrqs = false;
 	constexpr bool logRequests = false;
+
+	// Set to false to force PIO transfers even if bus master DMA is available.
+	constexpr bool enableDma = true;
 }
 
 // --------------------------------------------------------
@@ -39,6 +45,21 @@ namespace alt_regs {
 	inline constexpr arch::scalar_register<uint8_t> inStatus{0};
 }
 
+// Registers of the PCI IDE bus master interface (for the primary channel).
+namespace bm_regs {
+	inline constexpr arch::scalar_register<uint8_t> command{0};
+	inline constexpr arch::scalar_register<uint8_t> status{2};
+	inline constexpr arch::scalar_register<uint32_t> prdTable{4};
+}
+
+// Physical region descriptor, i.e., an element of the bus master's scatter-gather table.
+struct PrdEntry {
+	uint32_t address;
+	uint16_t size; // 0 means 64 KiB.
+	uint16_t flags;
+};
+static_assert(sizeof(PrdEntry) == 8);
+
 class Controller : public blockfs::BlockDevice {
 	enum class IoResult {
 		none,
@@ -55,6 +76,9 @@ public:
 public:
 	async::detached run();
 
+	// Enables bus master DMA; base is the I/O port of the bus master registers.
+	void setupBusMaster(uint16_t base);
+
 private:
 	async::detached _doRequestLoop();
 	async::result<IoResult> _pollForBsy();
@@ -73,6 +97,10 @@ private:
 		kCommandReadSectorsExt = 0x24,
 		kCommandWriteSectors = 0x30,
 		kCommandWriteSectorsExt = 0x34,
+		kCommandReadDma = 0xC8,
+		kCommandReadDmaExt = 0x25,
+		kCommandWriteDma = 0xCA,
+		kCommandWriteDmaExt = 0x35,
 		kCommandIdentify = 0xEC,
 	};
 
@@ -84,9 +112,26 @@ private:
 		kStatusBsy = 0x80,
 
 		kDeviceSlave = 0x10,
-		kDeviceLba = 0x40
+		kDeviceLba = 0x40,
+
+		kBmCommandStart = 0x01,
+		kBmCommandRead = 0x08, // Device-to-memory transfer.
+		kBmStatusActive = 0x01,
+		kBmStatusError = 0x02,
+		kBmStatusIrq = 0x04,
+
+		kPrdEndOfTable = 0x8000
 	};
 
+	// Maximal number of sectors per command. Requests are split into chunks of this size.
+	// LBA28 commands encode 256 sectors as zero; we avoid that case.
+	static constexpr size_t maxPioSectors = 255;
+	static constexpr size_t maxLba28DmaSectors = 255;
+	static constexpr size_t maxLba48DmaSectors = 2048;
+
+	// Enough to cover maxLba48DmaSectors sectors of a misaligned buffer.
+	static constexpr size_t numPrdEntries = 512;
+
 	struct Request {
 		bool isWrite;
 		uint64_t sector;
@@ -95,6 +140,19 @@ private:
 		async::promise<void> promise;
 	};
 
+	// Transfer a single chunk of a request.
+	async::result<void> _performPio(bool is_write, uint64_t sector,
+			void *buffer, size_t num_sectors);
+	// Transfers the buffer that was passed to _setupPrdTable().
+	async::result<void> _performDma(bool is_write, uint64_t sector, size_t num_sectors);
+
+	// Writes the LBA and sector count registers.
+	void _setupAddress(uint64_t sector, size_t num_sectors);
+
+	// Fills the PRD table. Returns false if the buffer cannot be reached by the
+	// bus master (i.e., if it is not in 32-bit physical memory).
+	bool _setupPrdTable(void *buffer, size_t size);
+
 	async::result<void> _performRequest(Request *request);
 
 	async::result<bool> _detectDevice();
@@ -107,6 +165,13 @@ private:
 	arch::io_space _altSpace;
 
 	bool _supportsLBA48;
+	bool _supportsDma = false;
+
+	bool _haveBusMaster = false;
+	arch::io_space _busMasterSpace;
+	arch::contiguous_pool _dmaPool;
+	arch::dma_array<PrdEntry> _prdTable;
+	uintptr_t _prdTablePhysical = 0;
 
 	uint64_t _irqSequence;
 };
@@ -120,6 +185,20 @@ Controller::Controller(uint16_t mainOffset, uint16_t altOffset,
 	HEL_CHECK(helEnableIo(altBar.getHandle()));
 }
 
+void Controller::setupBusMaster(uint16_t base) {
+	_busMasterSpace = arch::io_space{base};
+
+	// The pool returns naturally aligned chunks, hence the table does not cross
+	// a 64 KiB boundary. Also, it is allocated in 32-bit physical memory.
+	_prdTable = arch::dma_array<PrdEntry>{&_dmaPool, numPrdEntries};
+	HEL_CHECK(helPointerPhysical(_prdTable.data(), &_prdTablePhysical));
+	assert(!(_prdTablePhysical >> 32));
+
+	_busMasterSpace.store(bm_regs::command, 0);
+	_busMasterSpace.store(bm_regs::status, kBmStatusError | kBmStatusIrq);
+	_haveBusMaster = true;
+}
+
 async::detached Controller::run() {
 	// Initialize the _irqSequence. For now, assume that this is 0.
 	// TODO: if the driver restarts, we would need to get the current IRQ sequence from the kernel.
@@ -260,8 +339,14 @@ async::result<bool> Controller::_detectDevice() {
 
 	_supportsLBA48 = (ident_data[167] & (1 << 2))
 			&& (ident_data[173] & (1 << 2));
+	// Word 49, bit 8.
+	_supportsDma = ident_data[99] & 1;
+	// Word 217 (nominal media rotation rate) is 1 for non-rotating media.
+	rotational = (ident_data[434] | (ident_data[435] << 8)) != 1;
 
-	printf("block/ata: detected device, model: '%s', %s 48-bit LBA\n", model, _supportsLBA48 ? "supports" : "doesn't support");
+	printf("block/ata: detected device, model: '%s', %s 48-bit LBA, %s DMA\n", model,
+			_supportsLBA48 ? "supports" : "doesn't support",
+			_supportsDma ? "supports" : "doesn't support");
 
 	co_return true;
 }
@@ -272,39 +357,142 @@ async::result<void> Controller::_performRequest(Request *request) {
 				<< " sectors from " << request->sector << std::endl;
 
 	assert(!(request->sector & ~((size_t(1) << 48) - 1)));
-	assert(request->numSectors <= 255);
 
+	bool use_dma = enableDma && _haveBusMaster && _supportsDma;
+	size_t max_sectors = maxPioSectors;
+	if(use_dma)
+		max_sectors = _supportsLBA48 ? maxLba48DmaSectors : maxLba28DmaSectors;
+
+	for(size_t progress = 0; progress < request->numSectors; progress += max_sectors) {
+		auto chunk = std::min(request->numSectors - progress, max_sectors);
+		auto buffer = reinterpret_cast<char *>(request->buffer) + progress * 512;
+		if(use_dma && _setupPrdTable(buffer, chunk * 512)) {
+			co_await _performDma(request->isWrite, request->sector + progress, chunk);
+		}else{
+			co_await _performPio(request->isWrite, request->sector + progress, buffer, chunk);
+		}
+	}
+
+	if(logRequests)
+		std::cout << "block/ata: Reading/writing from " << request->sector
+				<< " complete" << std::endl;
+}
+
+void Controller::_setupAddress(uint64_t sector, size_t num_sectors) {
 	// TODO: Make sure RDY is set here.
 
 	_ioSpace.store(regs::outDevice, kDeviceLba);
 	// TODO: There should be a 400ns delay after drive selection.
 
 	if (_supportsLBA48) {
-		_ioSpace.store(regs::outSectorCount, (request->numSectors >> 8) & 0xFF);
-		_ioSpace.store(regs::outLba1, (request->sector >> 24) & 0xFF);
-		_ioSpace.store(regs::outLba2, (request->sector >> 32) & 0xFF);
-		_ioSpace.store(regs::outLba3, (request->sector >> 40) & 0xFF);
+		_ioSpace.store(regs::outSectorCount, (num_sectors >> 8) & 0xFF);
+		_ioSpace.store(regs::outLba1, (sector >> 24) & 0xFF);
+		_ioSpace.store(regs::outLba2, (sector >> 32) & 0xFF);
+		_ioSpace.store(regs::outLba3, (sector >> 40) & 0xFF);
 	}
 
-	_ioSpace.store(regs::outSectorCount, request->numSectors & 0xFF);
-	_ioSpace.store(regs::outLba1, request->sector & 0xFF);
-	_ioSpace.store(regs::outLba2, (request->sector >> 8) & 0xFF);
-	_ioSpace.store(regs::outLba3, (request->sector >> 16) & 0xFF);
+	_ioSpace.store(regs::outSectorCount, num_sectors & 0xFF);
+	_ioSpace.store(regs::outLba1, sector & 0xFF);
+	_ioSpace.store(regs::outLba2, (sector >> 8) & 0xFF);
+	_ioSpace.store(regs::outLba3, (sector >> 16) & 0xFF);
+}
 
-	if(!request->isWrite) {
+bool Controller::_setupPrdTable(void *buffer, size_t size) {
+	constexpr size_t page_size = 0x1000;
+	assert(!(reinterpret_cast<uintptr_t>(buffer) & 1));
+	assert(!(size & 1));
+
+	size_t n = 0;
+	size_t offset = 0;
+	while(offset < size) {
+		auto address = reinterpret_cast<uintptr_t>(buffer) + offset;
+		auto chunk = std::min(size - offset, page_size - (address & (page_size - 1)));
+
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical(reinterpret_cast<void *>(address), &physical));
+		if((physical + chunk - 1) >> 32)
+			return false;
+
+		// Merge physically contiguous pages. Entries must not cross a 64 KiB boundary.
+		if(n) {
+			auto &last = _prdTable[n - 1];
+			size_t last_size = last.size ? last.size : 0x10000;
+			if(last.address + last_size == physical
+					&& (last.address >> 16) == ((physical + chunk - 1) >> 16)) {
+				last.size = (last_size + chunk) & 0xFFFF;
+				offset += chunk;
+				continue;
+			}
+		}
+
+		assert(n < numPrdEntries);
+		_prdTable[n].address = physical;
+		_prdTable[n].size = chunk;
+		_prdTable[n].flags = 0;
+		n++;
+		offset += chunk;
+	}
+
+	assert(n);
+	_prdTable[n - 1].flags = kPrdEndOfTable;
+	return true;
+}
+
+async::result<void> Controller::_performDma(bool is_write, uint64_t sector,
+		size_t num_sectors) {
+	_busMasterSpace.store(bm_regs::prdTable, _prdTablePhysical);
+	_busMasterSpace.store(bm_regs::command, is_write ? 0 : kBmCommandRead);
+	_busMasterSpace.store(bm_regs::status, kBmStatusError | kBmStatusIrq);
+
+	_setupAddress(sector, num_sectors);
+
+	if(!is_write) {
+		if (_supportsLBA48)
+			_ioSpace.store(regs::outCommand, kCommandReadDmaExt);
+		else
+			_ioSpace.store(regs::outCommand, kCommandReadDma);
+	}else{
+		if (_supportsLBA48)
+			_ioSpace.store(regs::outCommand, kCommandWriteDmaExt);
+		else
+			_ioSpace.store(regs::outCommand, kCommandWriteDma);
+	}
+
+	_busMasterSpace.store(bm_regs::command,
+			kBmCommandStart | (is_write ? 0 : kBmCommandRead));
+
+	// The device raises a single IRQ once the whole transfer is complete.
+	auto ioRes = co_await _waitForBsyIrq();
+	assert(ioRes == IoResult::noData);
+
+	_busMasterSpace.store(bm_regs::command, 0);
+	auto bm_status = _busMasterSpace.load(bm_regs::status);
+	_busMasterSpace.store(bm_regs::status, kBmStatusError | kBmStatusIrq);
+	// TODO: Report those errors to the caller.
+	assert(!(bm_status & kBmStatusError));
+	assert(!(bm_status & kBmStatusActive)); // PRD table larger than the transfer?
+}
+
+async::result<void> Controller::_performPio(bool is_write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	assert(num_sectors <= maxPioSectors);
+
+	_setupAddress(sector, num_sectors);
+
+	if(!is_write) {
 		if (_supportsLBA48)
 			_ioSpace.store(regs::outCommand, kCommandReadSectorsExt);
 		else
 			_ioSpace.store(regs::outCommand, kCommandReadSectors);
 
 		// Receive the result for each sector.
-		for(size_t k = 0; k < request->numSectors; k++) {
+		for(size_t k = 0; k < num_sectors; k++) {
 			auto ioRes = co_await _waitForBsyIrq();
 			assert(ioRes == IoResult::withData);
 
 			// Read the data.
 			// TODO: Do we have to be careful with endianess here?
-			auto chunk = reinterpret_cast<uint8_t *>(request->buffer) + k * 512;
+			auto chunk = reinterpret_cast<uint8_t *>(buffer) + k * 512;
 			// TODO: The following is a hack. Lock the page into memory instead!
 			*static_cast<volatile uint8_t *>(chunk); // Fault in the page.
 			_ioSpace.load_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), 256);
@@ -320,31 +508,32 @@ async::result<void> Controller::_performRequest(Request *request) {
 		assert(ioRes == IoResult::withData);
 
 		// Receive the result for each sector.
-		for(size_t k = 0; k < request->numSectors; k++) {
+		for(size_t k = 0; k < num_sectors; k++) {
 			// Read the data.
 			// TODO: Do we have to be careful with endianess here?
-			auto chunk = reinterpret_cast<uint8_t *>(request->buffer) + k * 512;
+			auto chunk = reinterpret_cast<uint8_t *>(buffer) + k * 512;
 			// TODO: The following is a hack. Lock the page into memory instead!
 			*static_cast<volatile uint8_t *>(chunk); // Fault in the page.
 			_ioSpace.store_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), 256);
 
 			// Wait for the device to process the sector.
 			auto ioRes = co_await _waitForBsyIrq();
-			if(k + 1 < request->numSectors) {
+			if(k + 1 < num_sectors) {
 				assert(ioRes == IoResult::withData);
 			}else{
 				assert(ioRes == IoResult::noData);
 			}
 		}
 	}
-
-	if(logRequests)
-		std::cout << "block/ata: Reading/writing from " << request->sector
-				<< " complete" << std::endl;
 }
 
 std::vector<std::shared_ptr<Controller>> globalControllers;
 
+// The legacy ATA device (i.e., the primary channel) and the PCI IDE function that provides
+// its bus master registers are discovered independently; whichever comes second connects them.
+std::shared_ptr<Controller> primaryController;
+std::optional<uint16_t> primaryBusMasterBase;
+
 // ------------------------------------------------------------------------
 // Freestanding discovery functions.
 // ------------------------------------------------------------------------
@@ -362,10 +551,39 @@ async::detached bindController(mbus::Entity entity) {
 			info.barInfo[0].address, info.barInfo[1].address,
 			std::move(mainBar), std::move(altBar),
 			std::move(irq));
+	if(primaryBusMasterBase)
+		controller->setupBusMaster(*primaryBusMasterBase);
+	primaryController = controller;
 	controller->run();
 	globalControllers.push_back(std::move(controller));
 }
 
+async::detached bindBusMaster(mbus::Entity entity) {
+	protocols::hw::Device device(co_await entity.bind());
+	auto info = co_await device.getPciInfo();
+
+	// Bit 0 of the programming interface is set if the primary channel is in native mode;
+	// in that case, it is not the channel at the legacy ports. Bit 7 indicates bus master support.
+	auto interface = co_await device.loadPciSpace(0x09, 1);
+	if((interface & 1) || !(interface & 0x80)
+			|| info.barInfo[4].ioType != protocols::hw::IoType::kIoTypePort) {
+		printf("block/ata: IDE controller does not support bus master DMA\n");
+		co_return;
+	}
+
+	auto bar = co_await device.accessBar(4);
+	HEL_CHECK(helEnableIo(bar.getHandle()));
+
+	// Enable bus mastering in the PCI command register.
+	auto command = co_await device.loadPciSpace(0x04, 2);
+	co_await device.storePciSpace(0x04, 2, command | 0x04);
+
+	printf("block/ata: Using bus master DMA\n");
+	primaryBusMasterBase = info.barInfo[4].address;
+	if(primaryController)
+		primaryController->setupBusMaster(*primaryBusMasterBase);
+}
+
 async::detached observeControllers() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -382,6 +600,23 @@ async::detached observeControllers() {
 	co_await root.linkObserver(std::move(filter), std::move(handler));
 }
 
+async::detached observeBusMasters() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("pci-class", "01"),
+		mbus::EqualsFilter("pci-subclass", "01")
+	});
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([] (mbus::Entity entity, mbus::Properties) {
+		printf("block/ata: detected PCI IDE controller\n");
+		bindBusMaster(std::move(entity));
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+}
+
 // --------------------------------------------------------
 // main() function
 // --------------------------------------------------------
@@ -392,6 +627,7 @@ int main() {
 	{
 		async::queue_scope scope{helix::globalQueue()};
 		observeControllers();
+		observeBusMasters();
 	}
 
 	helix::globalQueue()->run();
@@ -0,0 +1,403 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "nvme.hpp"
+
+namespace {
+	// Upper bound on the number of I/O queue pairs. Commands are distributed
+	// round-robin among the queues.
+	constexpr unsigned int maxIoQueues = 4;
+	constexpr size_t maxIoQueueDepth = 256;
+	constexpr size_t adminQueueDepth = 32;
+
+	// Limits the size of a single command such that a single PRP list suffices.
+	constexpr size_t maxTransferLimit = 1024 * 1024;
+
+	// Set to true to let the controller coalesce I/O completion IRQs.
+	// An IRQ is raised once the threshold or the time limit (in 100 us units) is reached.
+	constexpr bool coalesceIrqs = false;
+	constexpr unsigned int coalescingThreshold = 8;
+	constexpr unsigned int coalescingTime = 1;
+
+	async::result<void> sleepFor(uint64_t nanos) {
+		uint64_t tick;
+		HEL_CHECK(helGetClock(&tick));
+
+		helix::AwaitClock await;
+		auto &&submit = helix::submitAwaitClock(&await, tick + nanos,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+	}
+
+	// Polls cond() every millisecond; returns false after the timeout.
+	template<typename F>
+	async::result<bool> waitFor(F cond, uint64_t timeout) {
+		uint64_t start;
+		HEL_CHECK(helGetClock(&start));
+		while(!cond()) {
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			if(now - start > timeout)
+				co_return false;
+			co_await sleepFor(1'000'000);
+		}
+		co_return true;
+	}
+
+	template<typename T>
+	T loadField(void *data, size_t offset) {
+		T value;
+		memcpy(&value, reinterpret_cast<char *>(data) + offset, sizeof(T));
+		return value;
+	}
+}
+
+Controller::Controller(protocols::hw::Device hw_device, helix::Mapping mapping,
+		helix::UniqueDescriptor mmio, helix::UniqueIrq irq, unsigned int num_msis)
+: _hwDevice{std::move(hw_device)}, _mapping{std::move(mapping)},
+		_mmio{std::move(mmio)}, _irq{std::move(irq)}, _numMsis{num_msis},
+		_space{_mapping.get()} { }
+
+async::detached Controller::run() {
+	// Enable bus mastering in the PCI command register.
+	auto command = co_await _hwDevice.loadPciSpace(0x04, 2);
+	co_await _hwDevice.storePciSpace(0x04, 2, command | 0x04);
+
+	if(!(co_await _reset()))
+		co_return;
+
+	// Admin commands complete via IRQs; hence, we need IRQs at this point.
+	// With MSI-X, vector 0 is used for the admin queue and vector i for I/O queue i.
+	if(_numMsis >= 2) {
+		_handleMsi(0, _adminQueue.get());
+	}else{
+		co_await _hwDevice.enableBusIrq();
+		_handleIrqs();
+	}
+
+	arch::dma_buffer identify{&_dmaPool, pageSize};
+	Command identify_cmd;
+	identify_cmd.entry.cdw0 = kAdminIdentify;
+	identify_cmd.entry.cdw10 = kIdentifyController;
+	identify_cmd.buffer = identify.data();
+	identify_cmd.size = pageSize;
+	co_await submitAdmin(&identify_cmd);
+	if(identify_cmd.status) {
+		printf("block/nvme: Identify controller failed with status %x\n",
+				identify_cmd.status);
+		co_return;
+	}
+
+	char model[41];
+	memcpy(model, reinterpret_cast<char *>(identify.data()) + identify_controller::model, 40);
+	model[40] = 0;
+	for(int i = 39; i >= 0 && model[i] == ' '; i--)
+		model[i] = 0;
+
+	// MDTS is given in units of the minimal page size; zero means that there is no limit.
+	_maxTransferSize = maxTransferLimit;
+	auto mdts = loadField<uint8_t>(identify.data(), identify_controller::mdts);
+	if(mdts) {
+		auto min_page_shift = 12 + ((_cap >> cap::mpsminShift) & cap::mpsminMask);
+		if(mdts + min_page_shift < 32)
+			_maxTransferSize = std::min(_maxTransferSize, size_t{1} << (mdts + min_page_shift));
+	}
+	_numNamespaces = loadField<uint32_t>(identify.data(), identify_controller::nn);
+
+	auto version = _space.load(regs::vs);
+	printf("block/nvme: NVMe %u.%u controller '%s', %u namespaces, max. transfer size %lu\n",
+			version >> 16, (version >> 8) & 0xFF, model, _numNamespaces, _maxTransferSize);
+
+	co_await _setupIoQueues();
+	if(_ioQueues.empty())
+		co_return;
+	co_await _scanNamespaces();
+
+	// TODO: Support more than one device.
+	if(!_namespaces.empty())
+		blockfs::runDevice(_namespaces.front().get());
+}
+
+Queue *Controller::pickIoQueue() {
+	assert(!_ioQueues.empty());
+	auto queue = _ioQueues[_nextIoQueue].get();
+	_nextIoQueue = (_nextIoQueue + 1) % _ioQueues.size();
+	return queue;
+}
+
+async::result<void> Controller::submitAdmin(Command *command) {
+	_adminQueue->submit(command);
+	co_await command->promise.async_get();
+}
+
+async::result<bool> Controller::_reset() {
+	_cap = _space.load(regs::cap);
+	_doorbellStride = size_t{4} << ((_cap >> cap::dstrdShift) & cap::dstrdMask);
+	auto timeout = ((_cap >> cap::toShift) & cap::toMask) * 500'000'000;
+
+	// The controller must be disabled before the admin queue can be configured.
+	if(_space.load(regs::cc) & cc::en)
+		_space.store(regs::cc, _space.load(regs::cc) & ~cc::en);
+	if(!(co_await waitFor([&] { return !(_space.load(regs::csts) & csts::rdy); }, timeout))) {
+		printf("block/nvme: Controller does not become disabled\n");
+		co_return false;
+	}
+
+	_adminQueue = std::make_unique<Queue>(this, 0, adminQueueDepth);
+	_space.store(regs::aqa, ((adminQueueDepth - 1) << 16) | (adminQueueDepth - 1));
+	_space.store(regs::asq, _adminQueue->sqPhysical());
+	_space.store(regs::acq, _adminQueue->cqPhysical());
+
+	// Use 4 KiB pages, the NVM command set and round-robin arbitration.
+	_space.store(regs::cc, cc::iosqes | cc::iocqes | cc::en);
+	if(!(co_await waitFor([&] { return _space.load(regs::csts) & (csts::rdy | csts::cfs); },
+			timeout))) {
+		printf("block/nvme: Controller does not become ready\n");
+		co_return false;
+	}
+	if(_space.load(regs::csts) & csts::cfs) {
+		printf("block/nvme: Controller reports a fatal error\n");
+		co_return false;
+	}
+	co_return true;
+}
+
+async::result<void> Controller::_setupIoQueues() {
+	unsigned int wanted = maxIoQueues;
+	if(_numMsis >= 2)
+		wanted = std::min(wanted, _numMsis - 1);
+
+	// The number of queues is requested in 0's based form.
+	Command num_queues;
+	num_queues.entry.cdw0 = kAdminSetFeatures;
+	num_queues.entry.cdw10 = kFeatureNumQueues;
+	num_queues.entry.cdw11 = (wanted - 1) | ((wanted - 1) << 16);
+	co_await submitAdmin(&num_queues);
+	if(num_queues.status) {
+		printf("block/nvme: Setting the number of queues failed with status %x\n",
+				num_queues.status);
+		co_return;
+	}
+	auto allocated = std::min((num_queues.result & 0xFFFF) + 1,
+			(num_queues.result >> 16) + 1);
+	auto count = std::min(wanted, allocated);
+
+	if(coalesceIrqs) {
+		Command coalescing;
+		coalescing.entry.cdw0 = kAdminSetFeatures;
+		coalescing.entry.cdw10 = kFeatureInterruptCoalescing;
+		coalescing.entry.cdw11 = (coalescingThreshold - 1) | (coalescingTime << 8);
+		co_await submitAdmin(&coalescing);
+		if(coalescing.status)
+			printf("block/nvme: Interrupt coalescing is not supported\n");
+	}
+
+	auto depth = std::min(maxIoQueueDepth, (_cap & cap::mqesMask) + 1);
+	for(unsigned int qid = 1; qid <= count; qid++) {
+		auto queue = std::make_unique<Queue>(this, qid, depth);
+		unsigned int vector = (_numMsis >= 2) ? qid : 0;
+
+		// The CQ must exist before the SQ that refers to it.
+		Command create_cq;
+		create_cq.entry.cdw0 = kAdminCreateCq;
+		create_cq.entry.prp1 = queue->cqPhysical();
+		create_cq.entry.cdw10 = qid | ((depth - 1) << 16);
+		create_cq.entry.cdw11 = create_queue::physicallyContiguous
+				| create_queue::interruptsEnabled | (vector << 16);
+		co_await submitAdmin(&create_cq);
+		if(create_cq.status) {
+			printf("block/nvme: Creating CQ %u failed with status %x\n", qid, create_cq.status);
+			break;
+		}
+
+		Command create_sq;
+		create_sq.entry.cdw0 = kAdminCreateSq;
+		create_sq.entry.prp1 = queue->sqPhysical();
+		create_sq.entry.cdw10 = qid | ((depth - 1) << 16);
+		create_sq.entry.cdw11 = create_queue::physicallyContiguous | (qid << 16);
+		co_await submitAdmin(&create_sq);
+		if(create_sq.status) {
+			printf("block/nvme: Creating SQ %u failed with status %x\n", qid, create_sq.status);
+			break;
+		}
+
+		if(_numMsis >= 2)
+			_handleMsi(vector, queue.get());
+		_ioQueues.push_back(std::move(queue));
+	}
+
+	printf("block/nvme: Using %lu I/O queues of depth %lu, %s\n",
+			_ioQueues.size(), depth, (_numMsis >= 2) ? "MSI-X" : "legacy IRQ");
+}
+
+async::result<void> Controller::_scanNamespaces() {
+	arch::dma_buffer list{&_dmaPool, pageSize};
+	arch::dma_buffer identify{&_dmaPool, pageSize};
+
+	// The active namespace list is only available since NVMe 1.1.
+	std::vector<uint32_t> nsids;
+	if(_space.load(regs::vs) >= 0x10100) {
+		Command list_cmd;
+		list_cmd.entry.cdw0 = kAdminIdentify;
+		list_cmd.entry.cdw10 = kIdentifyActiveNamespaces;
+		list_cmd.buffer = list.data();
+		list_cmd.size = pageSize;
+		co_await submitAdmin(&list_cmd);
+		if(list_cmd.status) {
+			printf("block/nvme: Identify active namespaces failed with status %x\n",
+					list_cmd.status);
+			co_return;
+		}
+
+		auto entries = reinterpret_cast<uint32_t *>(list.data());
+		for(size_t i = 0; i < pageSize / sizeof(uint32_t) && entries[i]; i++)
+			nsids.push_back(entries[i]);
+	}else{
+		for(uint32_t nsid = 1; nsid <= _numNamespaces; nsid++)
+			nsids.push_back(nsid);
+	}
+
+	for(auto nsid : nsids) {
+		Command identify_cmd;
+		identify_cmd.entry.cdw0 = kAdminIdentify;
+		identify_cmd.entry.nsid = nsid;
+		identify_cmd.entry.cdw10 = kIdentifyNamespace;
+		identify_cmd.buffer = identify.data();
+		identify_cmd.size = pageSize;
+		co_await submitAdmin(&identify_cmd);
+		if(identify_cmd.status) {
+			printf("block/nvme: Identify namespace %u failed with status %x\n",
+					nsid, identify_cmd.status);
+			continue;
+		}
+
+		// Inactive namespaces report a size of zero.
+		auto num_lbas = loadField<uint64_t>(identify.data(), identify_namespace::nsze);
+		if(!num_lbas)
+			continue;
+
+		auto format = loadField<uint8_t>(identify.data(), identify_namespace::flbas) & 0xF;
+		auto lbaf = loadField<uint32_t>(identify.data(),
+				identify_namespace::lbaf + 4 * format);
+		size_t lba_shift = (lbaf >> identify_namespace::lbadsShift) & 0xFF;
+		if(lba_shift < 9 || lba_shift > 12) {
+			printf("block/nvme: Ignoring namespace %u with unsupported LBA size 2^%lu\n",
+					nsid, lba_shift);
+			continue;
+		}
+
+		printf("block/nvme: Namespace %u: %lu blocks of %lu bytes\n",
+				nsid, num_lbas, size_t{1} << lba_shift);
+		auto ns = std::make_unique<Namespace>(this, nsid, lba_shift, num_lbas);
+		ns->queueDepth = _ioQueues.size() * (_ioQueues.front()->depth() - 1);
+		_namespaces.push_back(std::move(ns));
+	}
+}
+
+async::detached Controller::_handleIrqs() {
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(_irq, &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		// All queues share the legacy IRQ. It is deasserted once all CQ heads are updated.
+		bool any = _adminQueue->processCompletions();
+		for(auto &queue : _ioQueues)
+			any |= queue->processCompletions();
+
+		if(!any) {
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, sequence));
+			continue;
+		}
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+	}
+}
+
+async::detached Controller::_handleMsi(unsigned int index, Queue *queue) {
+	auto irq = co_await _hwDevice.accessMsi(index);
+	// Completions are processed by this thread; avoid waking it up from another CPU.
+	HEL_CHECK(helSetIrqAffinity(irq.getHandle(), kHelIrqAffinityThisCpu, 0));
+	HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckKick, 0));
+
+	// Commands might have completed before the MSI was set up.
+	queue->processCompletions();
+
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(irq, &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		// MSIs are never shared. Acknowledge before processing the CQ
+		// such that completions that race with processCompletions() raise a new IRQ.
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
+		queue->processCompletions();
+	}
+}
+
+// --------------------------------------------------------
+// Namespace
+// --------------------------------------------------------
+
+Namespace::Namespace(Controller *controller, unsigned int nsid,
+		size_t lba_shift, uint64_t num_lbas)
+: BlockDevice{size_t{1} << lba_shift}, _controller{controller}, _nsid{nsid},
+		_lbaShift{lba_shift}, _numLbas{num_lbas} { }
+
+async::result<void> Namespace::readSectors(uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	co_await _transfer(kIoRead, sector, buffer, num_sectors);
+}
+
+async::result<void> Namespace::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _transfer(kIoWrite, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<void> Namespace::_transfer(uint8_t opcode, uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	assert(sector + num_sectors <= _numLbas);
+	auto max_sectors = _controller->maxTransferSize() >> _lbaShift;
+
+	// Submit all chunks before waiting for them; they are spread over all I/O queues.
+	std::vector<std::unique_ptr<Command>> commands;
+	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
+		auto count = std::min(num_sectors - progress, max_sectors);
+		auto lba = sector + progress;
+
+		auto command = std::make_unique<Command>();
+		command->entry.cdw0 = opcode;
+		command->entry.nsid = _nsid;
+		command->entry.cdw10 = lba;
+		command->entry.cdw11 = lba >> 32;
+		command->entry.cdw12 = count - 1; // 0's based.
+		command->buffer = reinterpret_cast<char *>(buffer) + (progress << _lbaShift);
+		command->size = count << _lbaShift;
+		_controller->pickIoQueue()->submit(command.get());
+		commands.push_back(std::move(command));
+	}
+
+	for(auto &command : commands) {
+		co_await command->promise.async_get();
+		if(command->status) {
+			// TODO: Report errors to the caller.
+			printf("\e[31m" "block/nvme: I/O command failed with status %x" "\e[39m\n",
+					command->status);
+			assert(!"NVMe I/O error");
+		}
+	}
+}
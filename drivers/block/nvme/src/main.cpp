@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <stdio.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <async/result.hpp>
+#include <helix/ipc.hpp>
+#include <protocols/hw/client.hpp>
+#include <protocols/mbus/client.hpp>
+
+#include "nvme.hpp"
+
+std::vector<std::unique_ptr<Controller>> globalControllers;
+
+// --------------------------------------------------------
+// Freestanding PCI discovery functions.
+// --------------------------------------------------------
+
+async::detached bindController(mbus::Entity entity) {
+	protocols::hw::Device device(co_await entity.bind());
+	auto info = co_await device.getPciInfo();
+
+	// The controller registers are always in BAR 0.
+	assert(info.barInfo[0].ioType == protocols::hw::IoType::kIoTypeMemory);
+	auto bar = co_await device.accessBar(0);
+	auto irq = co_await device.accessIrq();
+
+	helix::Mapping mapping{bar, info.barInfo[0].offset, info.barInfo[0].length};
+
+	auto controller = std::make_unique<Controller>(std::move(device), std::move(mapping),
+			std::move(bar), std::move(irq), info.numMsis);
+	controller->run();
+	globalControllers.push_back(std::move(controller));
+}
+
+async::detached observeControllers() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("pci-class", "01"),
+		mbus::EqualsFilter("pci-subclass", "08"),
+		mbus::EqualsFilter("pci-interface", "02")
+	});
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([] (mbus::Entity entity, mbus::Properties) {
+		printf("block/nvme: Detected controller\n");
+		bindController(std::move(entity));
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+}
+
+// --------------------------------------------------------
+// main() function
+// --------------------------------------------------------
+
+int main() {
+	printf("block/nvme: Starting driver\n");
+
+	{
+		async::queue_scope scope{helix::globalQueue()};
+		observeControllers();
+	}
+
+	helix::globalQueue()->run();
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <string.h>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
+#include <arch/dma_structs.hpp>
+#include <arch/mem_space.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/hw/client.hpp>
+
+#include "spec.hpp"
+
+struct Controller;
+
+// --------------------------------------------------------
+// Command
+// --------------------------------------------------------
+
+struct Command {
+	Command() {
+		memset(&entry, 0, sizeof(SubmissionEntry));
+	}
+
+	// The command identifier and the PRPs are filled in by the queue.
+	SubmissionEntry entry;
+
+	// Data buffer of the command. Must be aligned to 4 bytes.
+	void *buffer = nullptr;
+	size_t size = 0;
+
+	// Filled in on completion.
+	uint32_t result = 0;
+	uint16_t status = 0;
+	async::promise<void> promise;
+};
+
+// --------------------------------------------------------
+// Queue
+// --------------------------------------------------------
+
+// A pair of a submission queue and a completion queue.
+struct Queue {
+	Queue(Controller *controller, unsigned int id, size_t depth);
+
+	unsigned int id() {
+		return _id;
+	}
+
+	size_t depth() {
+		return _depth;
+	}
+
+	uintptr_t sqPhysical();
+	uintptr_t cqPhysical();
+
+	// Enqueues a command and rings the SQ doorbell if a slot is free.
+	void submit(Command *command);
+
+	// Reaps all new entries of the CQ. Returns false if there were none.
+	bool processCompletions();
+
+private:
+	void _submitPending();
+	void _setupPrps(size_t cid, Command *command);
+
+	// Reaps completions while commands are outstanding (if completions are polled).
+	async::detached _poll();
+
+	Controller *_controller;
+	unsigned int _id;
+	size_t _depth;
+
+	arch::dma_array<SubmissionEntry> _sq;
+	arch::dma_array<CompletionEntry> _cq;
+	size_t _sqTail = 0;
+	size_t _cqHead = 0;
+	uint16_t _cqPhase = 1;
+
+	std::queue<Command *> _pendingQueue;
+
+	// Commands that occupy each command identifier.
+	std::vector<Command *> _slots;
+	std::vector<size_t> _freeSlots;
+
+	// PRP lists of each command identifier. Allocated on first use.
+	std::vector<arch::dma_object<PrpList>> _prpLists;
+
+	bool _polling = false;
+};
+
+// --------------------------------------------------------
+// Namespace
+// --------------------------------------------------------
+
+struct Namespace : blockfs::BlockDevice {
+	Namespace(Controller *controller, unsigned int nsid, size_t lba_shift, uint64_t num_lbas);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+private:
+	// Splits a transfer into commands and submits all of them at once.
+	async::result<void> _transfer(uint8_t opcode, uint64_t sector,
+			void *buffer, size_t num_sectors);
+
+	Controller *_controller;
+	unsigned int _nsid;
+	size_t _lbaShift;
+	uint64_t _numLbas;
+};
+
+// --------------------------------------------------------
+// Controller
+// --------------------------------------------------------
+
+struct Controller {
+	Controller(protocols::hw::Device hw_device, helix::Mapping mapping,
+			helix::UniqueDescriptor mmio, helix::UniqueIrq irq, unsigned int num_msis);
+
+	async::detached run();
+
+	arch::dma_pool *dmaPool() {
+		return &_dmaPool;
+	}
+
+	// Maximal size of a single data transfer.
+	size_t maxTransferSize() {
+		return _maxTransferSize;
+	}
+
+	arch::mem_space sqDoorbell(unsigned int qid) {
+		return _space.subspace(doorbellOffset + (2 * qid) * _doorbellStride);
+	}
+
+	arch::mem_space cqDoorbell(unsigned int qid) {
+		return _space.subspace(doorbellOffset + (2 * qid + 1) * _doorbellStride);
+	}
+
+	// Returns the I/O queue that the next command should be submitted to.
+	Queue *pickIoQueue();
+
+	// Submits an admin command and waits until it completes.
+	async::result<void> submitAdmin(Command *command);
+
+private:
+	async::result<bool> _reset();
+	async::result<void> _setupIoQueues();
+	async::result<void> _scanNamespaces();
+
+	async::detached _handleIrqs();
+	async::detached _handleMsi(unsigned int index, Queue *queue);
+
+	protocols::hw::Device _hwDevice;
+	helix::Mapping _mapping;
+	helix::UniqueDescriptor _mmio;
+	helix::UniqueIrq _irq;
+	unsigned int _numMsis;
+	arch::mem_space _space;
+	arch::contiguous_pool _dmaPool;
+
+	uint64_t _cap = 0;
+	size_t _doorbellStride = 4;
+	size_t _maxTransferSize = 0;
+	uint32_t _numNamespaces = 0;
+
+	std::unique_ptr<Queue> _adminQueue;
+	std::vector<std::unique_ptr<Queue>> _ioQueues;
+	size_t _nextIoQueue = 0;
+
+	std::vector<std::unique_ptr<Namespace>> _namespaces;
+};
@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "nvme.hpp"
+
+namespace {
+	constexpr bool logCommands = false;
+
+	// Set to true to reap completions by polling instead of waiting for IRQs.
+	// Polling trades CPU time for latency; it only runs while commands are outstanding.
+	constexpr bool pollCompletions = false;
+	constexpr uint64_t pollInterval = 20'000; // In nanoseconds.
+
+	inline constexpr arch::scalar_register<uint32_t> doorbell{0};
+
+	uintptr_t physicalOf(void *pointer) {
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical(pointer, &physical));
+		return physical;
+	}
+
+	// The queues must be page aligned (and physically contiguous). The DMA pool only
+	// aligns allocations to their size rounded up to a power of two; hence, pad the rings.
+	template<typename T>
+	size_t ringEntries(size_t depth) {
+		size_t bytes = pageSize;
+		while(bytes < depth * sizeof(T))
+			bytes <<= 1;
+		return bytes / sizeof(T);
+	}
+
+	async::result<void> sleepFor(uint64_t nanos) {
+		uint64_t tick;
+		HEL_CHECK(helGetClock(&tick));
+
+		helix::AwaitClock await;
+		auto &&submit = helix::submitAwaitClock(&await, tick + nanos,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+	}
+}
+
+Queue::Queue(Controller *controller, unsigned int id, size_t depth)
+: _controller{controller}, _id{id}, _depth{depth},
+		_sq{controller->dmaPool(), ringEntries<SubmissionEntry>(depth)},
+		_cq{controller->dmaPool(), ringEntries<CompletionEntry>(depth)} {
+	memset(_sq.data(), 0, _sq.size() * sizeof(SubmissionEntry));
+	memset(_cq.data(), 0, _cq.size() * sizeof(CompletionEntry));
+
+	// A full SQ cannot be distinguished from an empty one; hence, one entry stays unused.
+	_slots.resize(depth - 1, nullptr);
+	_prpLists.resize(depth - 1);
+	for(size_t i = 0; i < depth - 1; i++)
+		_freeSlots.push_back(depth - 2 - i);
+}
+
+uintptr_t Queue::sqPhysical() {
+	auto physical = physicalOf(_sq.data());
+	assert(!(physical & (pageSize - 1)));
+	return physical;
+}
+
+uintptr_t Queue::cqPhysical() {
+	auto physical = physicalOf(_cq.data());
+	assert(!(physical & (pageSize - 1)));
+	return physical;
+}
+
+void Queue::submit(Command *command) {
+	_pendingQueue.push(command);
+	_submitPending();
+
+	if(pollCompletions && _id && !_polling) {
+		_polling = true;
+		_poll();
+	}
+}
+
+bool Queue::processCompletions() {
+	// Update the state before completing the commands; this allows the
+	// completion handlers to submit new commands.
+	std::vector<Command *> completed;
+	while(true) {
+		auto &entry = _cq[_cqHead];
+		auto status = __atomic_load_n(&entry.status, __ATOMIC_ACQUIRE);
+		if((status & 1) != _cqPhase)
+			break;
+
+		assert(entry.cid < _slots.size());
+		auto command = _slots[entry.cid];
+		assert(command);
+		command->result = entry.result;
+		command->status = status >> 1;
+		completed.push_back(command);
+		_slots[entry.cid] = nullptr;
+		_freeSlots.push_back(entry.cid);
+
+		if(++_cqHead == _depth) {
+			_cqHead = 0;
+			_cqPhase ^= 1;
+		}
+	}
+
+	if(completed.empty())
+		return false;
+	if(logCommands)
+		std::cout << "block/nvme: Queue " << _id << " completed "
+				<< completed.size() << " commands" << std::endl;
+
+	// Release all CQ entries with a single doorbell write.
+	_controller->cqDoorbell(_id).store(doorbell, _cqHead);
+
+	for(auto command : completed)
+		command->promise.set_value();
+	_submitPending();
+	return true;
+}
+
+void Queue::_submitPending() {
+	// Write all commands to the SQ before ringing the doorbell once.
+	size_t count = 0;
+	while(!_pendingQueue.empty() && !_freeSlots.empty()) {
+		auto cid = _freeSlots.back();
+		_freeSlots.pop_back();
+
+		auto command = _pendingQueue.front();
+		_pendingQueue.pop();
+		assert(!_slots[cid]);
+		_slots[cid] = command;
+
+		command->entry.cdw0 = (command->entry.cdw0 & 0xFFFF) | (cid << 16);
+		_setupPrps(cid, command);
+		_sq[_sqTail] = command->entry;
+		if(++_sqTail == _depth)
+			_sqTail = 0;
+		count++;
+	}
+
+	if(!count)
+		return;
+	if(logCommands)
+		std::cout << "block/nvme: Queue " << _id << " submits "
+				<< count << " commands" << std::endl;
+
+	asm volatile ("" : : : "memory");
+	_controller->sqDoorbell(_id).store(doorbell, _sqTail);
+}
+
+void Queue::_setupPrps(size_t cid, Command *command) {
+	if(!command->size)
+		return;
+
+	// PRP1 may point into the middle of a page; all further PRPs point to full pages.
+	auto address = reinterpret_cast<uintptr_t>(command->buffer);
+	assert(!(address & 3));
+	command->entry.prp1 = physicalOf(command->buffer);
+
+	auto first = std::min(command->size, pageSize - (address & (pageSize - 1)));
+	if(first == command->size) {
+		command->entry.prp2 = 0;
+		return;
+	}
+
+	auto remaining = command->size - first;
+	auto next = address + first;
+	if(remaining <= pageSize) {
+		command->entry.prp2 = physicalOf(reinterpret_cast<void *>(next));
+		return;
+	}
+
+	// Transfers are limited such that a single PRP list suffices.
+	auto num_pages = (remaining + pageSize - 1) / pageSize;
+	assert(num_pages <= pageSize / sizeof(uint64_t));
+	if(!_prpLists[cid].data())
+		_prpLists[cid] = arch::dma_object<PrpList>{_controller->dmaPool()};
+	auto list = _prpLists[cid].data();
+	for(size_t i = 0; i < num_pages; i++)
+		list->entries[i] = physicalOf(reinterpret_cast<void *>(next + i * pageSize));
+	command->entry.prp2 = physicalOf(list);
+}
+
+async::detached Queue::_poll() {
+	while(_slots.size() != _freeSlots.size() || !_pendingQueue.empty()) {
+		co_await sleepFor(pollInterval);
+		processCompletions();
+	}
+	_polling = false;
+}
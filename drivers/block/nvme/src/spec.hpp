@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <arch/register.hpp>
+
+// --------------------------------------------------------
+// Controller registers
+// --------------------------------------------------------
+
+namespace regs {
+	inline constexpr arch::scalar_register<uint64_t> cap{0x00};
+	inline constexpr arch::scalar_register<uint32_t> vs{0x08};
+	inline constexpr arch::scalar_register<uint32_t> intms{0x0C};
+	inline constexpr arch::scalar_register<uint32_t> intmc{0x10};
+	inline constexpr arch::scalar_register<uint32_t> cc{0x14};
+	inline constexpr arch::scalar_register<uint32_t> csts{0x1C};
+	inline constexpr arch::scalar_register<uint32_t> aqa{0x24};
+	inline constexpr arch::scalar_register<uint64_t> asq{0x28};
+	inline constexpr arch::scalar_register<uint64_t> acq{0x30};
+}
+
+// Doorbell registers start at this offset; their stride is given by CAP.DSTRD.
+inline constexpr size_t doorbellOffset = 0x1000;
+
+namespace cap {
+	inline constexpr uint64_t mqesMask = 0xFFFF; // Maximal queue entries minus one.
+	inline constexpr unsigned int toShift = 24; // Timeout in 500 ms units.
+	inline constexpr uint64_t toMask = 0xFF;
+	inline constexpr unsigned int dstrdShift = 32;
+	inline constexpr uint64_t dstrdMask = 0xF;
+	inline constexpr unsigned int mpsminShift = 48;
+	inline constexpr uint64_t mpsminMask = 0xF;
+}
+
+namespace cc {
+	inline constexpr uint32_t en = 1u << 0;
+	// Sizes of queue entries as powers of two.
+	inline constexpr uint32_t iosqes = 6u << 16;
+	inline constexpr uint32_t iocqes = 4u << 20;
+}
+
+namespace csts {
+	inline constexpr uint32_t rdy = 1u << 0;
+	inline constexpr uint32_t cfs = 1u << 1; // Controller fatal status.
+}
+
+// --------------------------------------------------------
+// Queue entries
+// --------------------------------------------------------
+
+struct SubmissionEntry {
+	// Bits 0-7: opcode, bits 16-31: command identifier.
+	uint32_t cdw0;
+	uint32_t nsid;
+	uint32_t cdw2;
+	uint32_t cdw3;
+	uint64_t metadata;
+	uint64_t prp1;
+	uint64_t prp2;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12;
+	uint32_t cdw13;
+	uint32_t cdw14;
+	uint32_t cdw15;
+};
+static_assert(sizeof(SubmissionEntry) == 64);
+
+struct CompletionEntry {
+	uint32_t result;
+	uint32_t reserved;
+	uint16_t sqHead;
+	uint16_t sqId;
+	uint16_t cid;
+	// Bit 0: phase tag, bits 1-15: status field.
+	uint16_t status;
+};
+static_assert(sizeof(CompletionEntry) == 16);
+
+// All structures in this driver use 4 KiB pages (i.e., CC.MPS = 0).
+inline constexpr size_t pageSize = 0x1000;
+
+// A page of PRP entries.
+struct alignas(pageSize) PrpList {
+	uint64_t entries[pageSize / sizeof(uint64_t)];
+};
+static_assert(sizeof(PrpList) == pageSize);
+
+// --------------------------------------------------------
+// Commands
+// --------------------------------------------------------
+
+enum AdminOpcode : uint8_t {
+	kAdminDeleteSq = 0x00,
+	kAdminCreateSq = 0x01,
+	kAdminDeleteCq = 0x04,
+	kAdminCreateCq = 0x05,
+	kAdminIdentify = 0x06,
+	kAdminSetFeatures = 0x09
+};
+
+enum IoOpcode : uint8_t {
+	kIoWrite = 0x01,
+	kIoRead = 0x02
+};
+
+// Values of the CNS field of the identify command.
+enum {
+	kIdentifyNamespace = 0x00,
+	kIdentifyController = 0x01,
+	kIdentifyActiveNamespaces = 0x02
+};
+
+// Feature identifiers of the set features command.
+enum {
+	kFeatureNumQueues = 0x07,
+	kFeatureInterruptCoalescing = 0x08
+};
+
+// Flags in CDW11 of the create I/O CQ/SQ commands.
+namespace create_queue {
+	inline constexpr uint32_t physicallyContiguous = 1u << 0;
+	inline constexpr uint32_t interruptsEnabled = 1u << 1; // Only for CQs.
+}
+
+// Layout of the identify controller data structure (only the fields we need).
+namespace identify_controller {
+	inline constexpr size_t serial = 4; // 20 bytes.
+	inline constexpr size_t model = 24; // 40 bytes.
+	inline constexpr size_t mdts = 77; // Maximal data transfer size (as power of two pages).
+	inline constexpr size_t nn = 516; // Number of namespaces (32-bit).
+}
+
+// Layout of the identify namespace data structure (only the fields we need).
+namespace identify_namespace {
+	inline constexpr size_t nsze = 0; // Size in logical blocks (64-bit).
+	inline constexpr size_t flbas = 26; // Bits 0-3: index of the LBA format.
+	inline constexpr size_t lbaf = 128; // Array of 32-bit LBA formats.
+	inline constexpr unsigned int lbadsShift = 16; // LBA data size (as power of two).
+}
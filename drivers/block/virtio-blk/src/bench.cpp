@@ -0,0 +1,99 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "block.hpp"
+
+// fio-like random read benchmark. For each combination of queue depth and block size,
+// a number of workers (equal to the queue depth) issue random reads for a fixed time.
+
+namespace block {
+namespace virtio {
+
+namespace {
+
+constexpr size_t queueDepths[] = {1, 4, 16, 64};
+constexpr size_t blockSizes[] = {4096, 65536, 1024 * 1024};
+
+// Duration of each run in nanoseconds.
+constexpr uint64_t runTime = 2'000'000'000;
+
+// Reads are restricted to the first 1 GiB of the disk.
+constexpr uint64_t maxRange = uint64_t(1) << 30;
+
+struct Job {
+	Device *device;
+	size_t blockSize;
+	uint64_t deadline;
+
+	size_t numActive;
+	async::promise<void> done;
+
+	uint64_t numReads = 0;
+};
+
+uint64_t currentTime() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+// Simple xorshift generator; each worker has its own state.
+uint64_t nextRandom(uint64_t &state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+async::detached runWorker(Job *job, uint64_t seed) {
+	auto buffer = aligned_alloc(4096, job->blockSize);
+	assert(buffer);
+
+	auto block_sectors = job->blockSize / 512;
+	auto num_blocks = std::min(job->device->numSectors() * 512, maxRange) / job->blockSize;
+	assert(num_blocks);
+
+	uint64_t state = seed;
+	while(currentTime() < job->deadline) {
+		auto block = nextRandom(state) % num_blocks;
+		co_await job->device->readSectors(block * block_sectors, buffer, block_sectors);
+		job->numReads++;
+	}
+
+	free(buffer);
+	if(!--job->numActive)
+		job->done.set_value();
+}
+
+} // anonymous namespace
+
+async::detached runBenchmark(Device *device) {
+	std::cout << "virtio: Running read benchmark" << std::endl;
+
+	for(auto block_size : blockSizes) {
+		for(auto queue_depth : queueDepths) {
+			Job job{device, block_size, 0, queue_depth, {}};
+			auto start = currentTime();
+			job.deadline = start + runTime;
+			for(size_t i = 0; i < queue_depth; i++)
+				runWorker(&job, 0x9E3779B97F4A7C15 * (i + 1));
+			co_await job.done.async_get();
+			auto elapsed = currentTime() - start;
+
+			auto iops = job.numReads * 1'000'000'000 / elapsed;
+			auto kib_per_sec = iops * block_size / 1024;
+			std::cout << "virtio: bs=" << block_size / 1024 << "K qd=" << queue_depth
+					<< ": " << iops << " IOPS, " << kib_per_sec / 1024 << " MiB/s" << std::endl;
+		}
+	}
+
+	blockfs::runDevice(device);
+}
+
+} } // namespace block::virtio
@@ -1,5 +1,6 @@
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
 #include "block.hpp"
@@ -9,6 +10,12 @@ namespace virtio {
 
 static bool logInitiateRetire = false;
 
+bool enableBenchmark = false;
+bool forceSplitRings = false;
+
+// Maximal number of virtqs that we use if the device supports VIRTIO_BLK_F_MQ.
+static constexpr unsigned int maxQueues = 4;
+
 // --------------------------------------------------------
 // UserRequest
 // --------------------------------------------------------
@@ -16,138 +23,233 @@ static bool logInitiateRetire = false;
 UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t num_sectors_)
 : write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
 
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+RequestQueue::RequestQueue(virtio_core::Queue *virtq_)
+: virtq{virtq_} {
+	virtRequestBuffer = (VirtRequest *)malloc(virtq->numDescriptors() * sizeof(VirtRequest));
+	statusBuffer = (uint8_t *)malloc(virtq->numDescriptors());
+
+	// natural alignment makes sure that request headers do not cross page boundaries
+	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
+}
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 Device::Device(std::unique_ptr<virtio_core::Transport> transport)
-: blockfs::BlockDevice{512}, _transport{std::move(transport)},
-		_requestQueue{nullptr} { }
+: blockfs::BlockDevice{512}, _transport{std::move(transport)} { }
+
+async::detached Device::runDevice() {
+	// As this driver is single-threaded, additional virtqs do not save locking; however,
+	// they increase the number of requests in flight and allow the device to process
+	// the virtqs in parallel (e.g., on multiple QEMU iothreads).
+	unsigned int num_queues = 1;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		auto max_queues = _transport->space().load(spec::regs::numQueues);
+		num_queues = std::clamp(static_cast<unsigned int>(max_queues), 1u, maxQueues);
+	}
+
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SEG_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SEG_MAX);
+		_maxSegments = _transport->space().load(spec::regs::segMax);
+		std::cout << "virtio: Device supports " << _maxSegments
+				<< " segments per request" << std::endl;
+	}
 
-void Device::runDevice() {
+	if(forceSplitRings)
+		_transport->disablePackedRings();
 	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
+	co_await _transport->claimQueues(num_queues);
+	for(unsigned int i = 0; i < num_queues; i++)
+		_requestQueues.push_back(std::make_unique<RequestQueue>(_transport->setupQueue(i)));
+	std::cout << "virtio: Using " << num_queues << " request queue(s)" << std::endl;
 
-	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
+	// Each request occupies at least one descriptor.
+	queueDepth = 0;
+	for(auto &queue : _requestQueues)
+		queueDepth += queue->virtq->numDescriptors();
+
+	_numSectors = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
 			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
-	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
+	std::cout << "virtio: Disk size: " << _numSectors << " sectors" << std::endl;
 
 	_transport->runDevice();
 
-	// perform device specific setup
-	virtRequestBuffer = (VirtRequest *)malloc(_requestQueue->numDescriptors() * sizeof(VirtRequest));
-	statusBuffer = (uint8_t *)malloc(_requestQueue->numDescriptors());
-
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
-	
-	// setup an interrupt for the device
-	_processRequests();
+	for(auto &queue : _requestQueues)
+		_processRequests(queue.get());
 
-	blockfs::runDevice(this);
+	if(enableBenchmark) {
+		runBenchmark(this);
+	}else{
+		blockfs::runDevice(this);
+	}
 }
 
 async::result<void> Device::readSectors(uint64_t sector,
 		void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
 //	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
-
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.ring();
-		co_await request->promise.async_get();
-		delete request;
-	}
+	co_await _transfer(false, sector, buffer, num_sectors);
 }
 
 async::result<void> Device::writeSectors(uint64_t sector,
 		const void *buffer, size_t num_sectors) {
+//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
+	co_await _transfer(true, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<void> Device::_transfer(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
 	// Natural alignment makes sure a sector does not cross a page boundary.
 	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
 
 	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
+	// Indirect chains only occupy a single descriptor of the virtq; their length
+	// is limited by the queue size (and includes the header and status descriptors).
+	// In both cases, the number of data segments must not exceed the device's seg_max.
+	auto virtq = _requestQueues.front()->virtq;
+	size_t max_sectors;
+	if(virtq->supportsIndirect()) {
+		// Each page is a segment. Unaligned buffers need one more segment.
+		auto max_segments = virtq->numDescriptors() - 2;
+		if(_maxSegments)
+			max_segments = std::min(max_segments, _maxSegments);
+		if(max_segments > 1) {
+			max_sectors = (max_segments - 1) * (0x1000 / 512);
+		}else{
+			// Sectors never cross page boundaries.
+			max_sectors = 1;
+		}
+	}else{
+		// Each sector is a segment.
+		max_sectors = virtq->numDescriptors() / 4;
+		if(_maxSegments)
+			max_sectors = std::min(max_sectors, _maxSegments);
+	}
 	assert(max_sectors >= 1);
 
+	// Enqueue all chunks before waking up the submission loops. This allows them
+	// to submit the chunks as a single batch; the chunks are then processed concurrently.
+	std::vector<std::unique_ptr<UserRequest>> requests;
 	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
+		auto request = std::make_unique<UserRequest>(write, sector + progress,
 				(char *)buffer + 512 * progress,
 				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.ring();
-		co_await request->promise.async_get();
-		delete request;
+		auto queue = _requestQueues[_nextQueue++ % _requestQueues.size()].get();
+		queue->pendingQueue.push(request.get());
+		requests.push_back(std::move(request));
 	}
+	for(auto &queue : _requestQueues)
+		if(!queue->pendingQueue.empty())
+			queue->pendingDoorbell.ring();
+
+	for(auto &request : requests)
+		co_await request->promise.async_get();
 }
 
-async::detached Device::_processRequests() {
+async::detached Device::_processRequests(RequestQueue *queue) {
+	auto virtq = queue->virtq;
+	std::vector<virtio_core::Handle> handles;
 	while(true) {
-		if(_pendingQueue.empty()) {
-			co_await _pendingDoorbell.async_wait();
+		if(queue->pendingQueue.empty()) {
+			co_await queue->pendingDoorbell.async_wait();
 			continue;
 		}
 
-		auto request = _pendingQueue.front();
-		_pendingQueue.pop();
-		assert(request->numSectors);
+		// Submit all pending requests as a single batch; the device is only notified once.
+		size_t num_staged = 0;
+		while(!queue->pendingQueue.empty()) {
+			auto request = queue->pendingQueue.front();
+			assert(request->numSectors);
 
-		// Setup the descriptor for the request header.
-		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
+			// Descriptors are only freed once the device completes published requests.
+			// Hence, we must not wait for descriptors while requests are still staged.
+			auto num_descriptors = virtq->supportsIndirect() ? 1 : request->numSectors + 2;
+			if(num_staged && virtq->numFreeDescriptors() < num_descriptors)
+				break;
+			queue->pendingQueue.pop();
 
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
-			header->type = VIRTIO_BLK_T_OUT;
-		}else{
-			header->type = VIRTIO_BLK_T_IN;
-		}
-		header->reserved = 0;
-		header->sector = request->sector;
-
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
-		
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
+			handles.resize(num_descriptors);
+			co_await virtq->obtainDescriptors(handles.data(), num_descriptors);
+
+			// Setup the descriptor for the request header.
+			virtio_core::Chain chain;
+			if(virtq->supportsIndirect()) {
+				// Header, one descriptor per page and status.
+				auto misalign = reinterpret_cast<uintptr_t>(request->buffer) & 0xFFF;
+				auto num_pages = (misalign + request->numSectors * 512 + 0xFFF) >> 12;
+				chain.setupIndirect(handles[0], num_pages + 2);
+				chain.appendIndirect();
+			}else{
+				chain.append(handles[0]);
+			}
+
+			VirtRequest *header = &queue->virtRequestBuffer[chain.front().tableIndex()];
 			if(request->write) {
-				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+				header->type = VIRTIO_BLK_T_OUT;
 			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+				header->type = VIRTIO_BLK_T_IN;
 			}
-		}
+			header->reserved = 0;
+			header->sector = request->sector;
 
-		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
-					<< " data descriptors" << std::endl;
+			chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+					header, sizeof(VirtRequest)});
 
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
+			// Setup descriptors for the transfered data.
+			if(chain.isIndirect()) {
+				arch::dma_buffer_view view{nullptr, request->buffer, request->numSectors * 512};
+				if(request->write) {
+					co_await virtio_core::scatterGather(virtio_core::hostToDevice,
+							chain, virtq, view);
+				}else{
+					co_await virtio_core::scatterGather(virtio_core::deviceToHost,
+							chain, virtq, view);
+				}
+			}else{
+				for(size_t i = 0; i < request->numSectors; i++) {
+					chain.append(handles[1 + i]);
+					if(request->write) {
+						chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+								(char *)request->buffer + 512 * i, 512});
+					}else{
+						chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+								(char *)request->buffer + 512 * i, 512});
+					}
+				}
+			}
 
-		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
-				[] (virtio_core::Request *base_request) {
-			auto request = static_cast<UserRequest *>(base_request);
 			if(logInitiateRetire)
-				std::cout << "Retiring " << request->numSectors
+				std::cout << "Submitting " << request->numSectors
 						<< " data descriptors" << std::endl;
-			request->promise.set_value();
-		});
-		_requestQueue->notify();
+
+			// Setup a descriptor for the status byte.
+			if(chain.isIndirect()) {
+				chain.appendIndirect();
+			}else{
+				chain.append(handles[num_descriptors - 1]);
+			}
+			chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+					&queue->statusBuffer[chain.front().tableIndex()], 1});
+
+			virtq->stageDescriptor(chain.front(), request,
+					[] (virtio_core::Request *base_request) {
+				auto request = static_cast<UserRequest *>(base_request);
+				if(logInitiateRetire)
+					std::cout << "Retiring " << request->numSectors
+							<< " data descriptors" << std::endl;
+				request->promise.set_value();
+			});
+			num_staged++;
+		}
+
+		// Submit the requests to the device.
+		virtq->publishDescriptors();
+		virtq->notify();
 	}
 }
 
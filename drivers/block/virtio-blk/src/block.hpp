@@ -23,10 +23,18 @@ enum {
 	VIRTIO_BLK_T_OUT = 1
 };
 
+// Device feature bits.
+enum {
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_MQ = 12
+};
+
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint32_t> segMax{12};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
 }
 
 struct Device;
@@ -46,6 +54,26 @@ struct UserRequest : virtio_core::Request {
 	async::promise<void> promise;
 };
 
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+// State of a single virtq. Each virtq has its own submission loop.
+struct RequestQueue {
+	RequestQueue(virtio_core::Queue *virtq);
+
+	virtio_core::Queue *virtq;
+
+	// Stores UserRequest objects that have not been submitted yet.
+	std::queue<UserRequest *> pendingQueue;
+	async::doorbell pendingDoorbell;
+
+	// these two buffer store virtio-block request header and status bytes
+	// they are indexed by the index of the request's first descriptor
+	VirtRequest *virtRequestBuffer;
+	uint8_t *statusBuffer;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
@@ -53,7 +81,7 @@ struct UserRequest : virtio_core::Request {
 struct Device : blockfs::BlockDevice {
 	Device(std::unique_ptr<virtio_core::Transport> transport);
 
-	void runDevice();
+	async::detached runDevice();
 
 	async::result<void> readSectors(uint64_t sector,
 			void *buffer, size_t num_sectors) override;
@@ -61,24 +89,42 @@ struct Device : blockfs::BlockDevice {
 	async::result<void> writeSectors(uint64_t sector,
 			const void *buffer, size_t num_sectors) override;
 
+	// Size of the disk in sectors.
+	uint64_t numSectors() {
+		return _numSectors;
+	}
+
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
+	// Splits a transfer into chunks and submits all of them at once.
+	async::result<void> _transfer(bool write, uint64_t sector,
+			void *buffer, size_t num_sectors);
+
+	// Submits requests from the queue's pendingQueue to the device.
+	async::detached _processRequests(RequestQueue *queue);
 	
 	std::unique_ptr<virtio_core::Transport> _transport;
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	// One entry per virtq. Without VIRTIO_BLK_F_MQ, there is only a single virtq.
+	std::vector<std::unique_ptr<RequestQueue>> _requestQueues;
 
-	// Stores UserRequest objects that have not been submitted yet.
-	std::queue<UserRequest *> _pendingQueue;
-	async::doorbell _pendingDoorbell;
+	// Chunks are distributed to the virtqs in a round-robin fashion.
+	size_t _nextQueue = 0;
 
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
+	uint64_t _numSectors = 0;
+
+	// Maximal number of data segments per request (zero if the device reports no limit).
+	size_t _maxSegments = 0;
 };
 
+// Run the benchmark in bench.cpp instead of serving the file system
+// (set by "virtio-blk.bench" on the kernel command line).
+extern bool enableBenchmark;
+// Do not use packed virtqs even if the device supports them; together with the
+// benchmark, this compares split and packed virtqs ("virtio-blk.split-rings").
+extern bool forceSplitRings;
+
+// Runs an fio-like read benchmark against the device, then starts blockfs.
+async::detached runBenchmark(Device *device);
+
 } } // namespace block::virtio
 
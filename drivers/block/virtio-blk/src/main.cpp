@@ -7,14 +7,17 @@
 #include <iostream>
 #include <memory>
 #include <queue>
+#include <sstream>
 #include <vector>
 
+#include <async/jump.hpp>
 #include <async/result.hpp>
 #include <hel.h>
 #include <hel-syscalls.h>
 #include <helix/ipc.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/hw/client.hpp>
+#include <kerncfg.pb.h>
 
 #include "block.hpp"
 
@@ -41,7 +44,63 @@ async::detached bindDevice(mbus::Entity entity) {
 */
 }
 
+async::jump foundKerncfg;
+helix::UniqueLane kerncfgLane;
+
+async::result<std::string> getKernelCommandLine() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("class", "kerncfg")
+	});
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([] (mbus::Entity entity, mbus::Properties) -> async::detached {
+		kerncfgLane = helix::UniqueLane(co_await entity.bind());
+		foundKerncfg.trigger();
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+	co_await foundKerncfg.async_wait();
+
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+	helix::RecvInline recv_cmdline;
+
+	managarm::kerncfg::CntRequest req;
+	req.set_req_type(managarm::kerncfg::CntReqType::GET_CMDLINE);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp, kHelItemChain),
+			helix::action(&recv_cmdline));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(recv_cmdline.error());
+
+	managarm::kerncfg::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	co_return std::string{(const char *)recv_cmdline.data(), recv_cmdline.length()};
+}
+
 async::detached observeDevices() {
+	// The benchmark options are only read once; they apply to all devices.
+	std::istringstream cmdline{co_await getKernelCommandLine()};
+	std::string option;
+	while(cmdline >> option) {
+		if(option == "virtio-blk.bench") {
+			block::virtio::enableBenchmark = true;
+		}else if(option == "virtio-blk.split-rings") {
+			block::virtio::forceSplitRings = true;
+		}
+	}
+
 	auto root = co_await mbus::Instance::global().getRoot();
 
 	auto filter = mbus::Conjunction({
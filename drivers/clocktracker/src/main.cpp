@@ -131,11 +131,18 @@ async::detached initializeDriver() {
 	memset(page, 0, page_size);
 
 	// Read the RTC to initialize the realtime clock.
-	auto result = co_await getRtcTime(); // TODO: Use the seqlock.
+	auto result = co_await getRtcTime();
 	std::cout << "drivers/clocktracker: Initializing time to "
 			<< std::get<1>(result) << std::endl;
-	accessPage()->refClock = std::get<0>(result);
-	accessPage()->baseRealtime = std::get<1>(result);
+
+	// Readers compute the realtime clock from the page and helGetClock()
+	// without any syscall; they retry while the seqlock is odd.
+	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->seqlock, seqlock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&page->refClock, std::get<0>(result), __ATOMIC_RELAXED);
+	__atomic_store_n(&page->baseRealtime, std::get<1>(result), __ATOMIC_RELAXED);
+	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
 
 	// Create an mbus object for the device.
 	auto root = co_await mbus::Instance::global().getRoot();
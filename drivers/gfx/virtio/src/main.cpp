@@ -70,7 +70,7 @@ GfxDevice::GfxDevice(std::unique_ptr<virtio_core::Transport> transport)
 
 async::detached GfxDevice::initialize() { 
 	_transport->finalizeFeatures();
-	_transport->claimQueues(2);
+	co_await _transport->claimQueues(2);
 
 	_controlQ = _transport->setupQueue(0);
 	_cursorQ = _transport->setupQueue(1);
@@ -0,0 +1,205 @@
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+
+#include "cache.hpp"
+
+namespace {
+
+constexpr uint64_t fnvOffsetBasis = 0xcbf29ce484222325;
+
+// 64-bit FNV-1a. Used to derive file names (keys are always compared in full)
+// and as checksum of on-disk entries.
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+	auto bytes = reinterpret_cast<const unsigned char *>(data);
+	for(size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+uint64_t checksumOf(const std::string &key, const std::vector<uint8_t> &elf) {
+	return hashBytes(hashBytes(fnvOffsetBasis, key.data(), key.size()),
+			elf.data(), elf.size());
+}
+
+// Files that other users can modify must not be uploaded as kernel code.
+bool isTrusted(const struct stat &st) {
+	return st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+bool readAll(int fd, void *data, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		auto chunk = read(fd, reinterpret_cast<char *>(data) + progress, size - progress);
+		if(chunk < 0 && errno == EINTR)
+			continue;
+		if(chunk <= 0)
+			return false;
+		progress += chunk;
+	}
+	return true;
+}
+
+bool writeAll(int fd, const void *data, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		auto chunk = write(fd, reinterpret_cast<const char *>(data) + progress,
+				size - progress);
+		if(chunk < 0 && errno == EINTR)
+			continue;
+		if(chunk <= 0)
+			return false;
+		progress += chunk;
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+std::string KernletCache::makeKey(const uint8_t *code, size_t size,
+		const std::vector<BindType> &bind_types) {
+	std::string key;
+	key.append(reinterpret_cast<const char *>(&compilerVersion), sizeof(uint32_t));
+	key.push_back(static_cast<char>(bind_types.size()));
+	for(auto bt : bind_types)
+		key.push_back(static_cast<char>(bt));
+	key.append(reinterpret_cast<const char *>(code), size);
+	return key;
+}
+
+void KernletCache::setDirectory(std::string path) {
+	struct stat st;
+	if(stat(path.c_str(), &st)) {
+		std::cout << "\e[31m" "kernletcc: Could not access cache directory " << path
+				<< ": " << strerror(errno) << "\e[39m" << std::endl;
+		return;
+	}
+	if(!S_ISDIR(st.st_mode) || !isTrusted(st)) {
+		std::cout << "\e[31m" "kernletcc: Refusing to use cache directory " << path
+				<< " that is writable by other users" "\e[39m" << std::endl;
+		return;
+	}
+	_directory = std::move(path);
+}
+
+CacheEntry *KernletCache::lookup(const std::string &key) {
+	auto it = _entries.find(key);
+	if(it != _entries.end()) {
+		_memoryHits++;
+		return &it->second;
+	}
+
+	std::vector<uint8_t> elf;
+	if(!_directory.empty() && _load(key, elf)) {
+		_diskHits++;
+		auto res = _entries.insert({key, CacheEntry{std::move(elf), {}}});
+		assert(res.second);
+		return &res.first->second;
+	}
+
+	_misses++;
+	return nullptr;
+}
+
+CacheEntry *KernletCache::insert(const std::string &key, std::vector<uint8_t> elf) {
+	if(!_directory.empty())
+		_store(key, elf);
+
+	auto res = _entries.insert({key, CacheEntry{std::move(elf), {}}});
+	assert(res.second);
+	return &res.first->second;
+}
+
+void KernletCache::dumpStats() {
+	std::cout << "kernletcc: Cache has " << _entries.size() << " entries, "
+			<< _memoryHits << " memory hits, " << _diskHits << " disk hits, "
+			<< _misses << " misses" << std::endl;
+}
+
+std::string KernletCache::_pathOf(const std::string &key) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016" PRIx64 ".kernlet",
+			hashBytes(fnvOffsetBasis, key.data(), key.size()));
+	return _directory + "/" + name;
+}
+
+// On-disk format: 64-bit key length, key, 64-bit checksum of key and ELF, ELF object.
+bool KernletCache::_load(const std::string &key, std::vector<uint8_t> &elf) {
+	auto path = _pathOf(key);
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if(fd < 0)
+		return false;
+
+	bool success = false;
+	struct stat st;
+	uint64_t key_length;
+	uint64_t checksum;
+	std::string stored_key;
+	if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+		goto out;
+	if(!isTrusted(st)) {
+		std::cout << "\e[31m" "kernletcc: Ignoring " << path
+				<< " that is writable by other users" "\e[39m" << std::endl;
+		goto out;
+	}
+	if(!readAll(fd, &key_length, sizeof(uint64_t)))
+		goto out;
+	// Hash collisions (or entries of other compiler versions) are treated as misses.
+	if(key_length != key.size() || static_cast<uint64_t>(st.st_size)
+			< 2 * sizeof(uint64_t) + key_length)
+		goto out;
+	stored_key.resize(key_length);
+	if(!readAll(fd, stored_key.data(), key_length) || stored_key != key)
+		goto out;
+	if(!readAll(fd, &checksum, sizeof(uint64_t)))
+		goto out;
+
+	elf.resize(st.st_size - 2 * sizeof(uint64_t) - key_length);
+	if(!readAll(fd, elf.data(), elf.size()))
+		goto out;
+	if(checksum != checksumOf(key, elf)) {
+		std::cout << "\e[31m" "kernletcc: Ignoring corrupted cache entry " << path
+				<< "\e[39m" << std::endl;
+		goto out;
+	}
+	success = true;
+
+out:
+	close(fd);
+	return success;
+}
+
+void KernletCache::_store(const std::string &key, const std::vector<uint8_t> &elf) {
+	// Write to a temporary file first such that readers never see partial entries.
+	auto path = _pathOf(key);
+	auto temp_path = path + ".tmp";
+	int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		std::cout << "\e[31m" "kernletcc: Could not create " << temp_path
+				<< ": " << strerror(errno) << "\e[39m" << std::endl;
+		return;
+	}
+
+	uint64_t key_length = key.size();
+	uint64_t checksum = checksumOf(key, elf);
+	bool success = writeAll(fd, &key_length, sizeof(uint64_t))
+			&& writeAll(fd, key.data(), key.size())
+			&& writeAll(fd, &checksum, sizeof(uint64_t))
+			&& writeAll(fd, elf.data(), elf.size());
+	close(fd);
+
+	if(!success || rename(temp_path.c_str(), path.c_str())) {
+		std::cout << "\e[31m" "kernletcc: Could not write " << path
+				<< ": " << strerror(errno) << "\e[39m" << std::endl;
+		unlink(temp_path.c_str());
+	}
+}
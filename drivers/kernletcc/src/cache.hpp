@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <helix/ipc.hpp>
+#include <protocols/kernlet/compiler.hpp>
+
+// Bump this whenever compileFafnir() changes the generated code.
+// Entries of other compiler versions are never returned from the cache.
+constexpr uint32_t compilerVersion = 1;
+
+struct CacheEntry {
+	std::vector<uint8_t> elf;
+
+	// Kernlet object that was uploaded to the kernel (may be empty).
+	helix::UniqueDescriptor object;
+};
+
+// Content-addressed cache of compiled kernlets. Keys consist of the compiler version,
+// the bind types and the fafnir bytecode. The cache lives in memory; optionally,
+// entries are also persisted to a directory such that they survive restarts.
+// Cached objects are uploaded as kernel code: the directory must only be writable
+// by the user that runs kernletcc (i.e., root). The checksum that is stored with each
+// object only protects against corrupted files, not against malicious ones.
+struct KernletCache {
+	static std::string makeKey(const uint8_t *code, size_t size,
+			const std::vector<BindType> &bind_types);
+
+	// Enables the on-disk cache. Directories that are writable by other users are refused.
+	void setDirectory(std::string path);
+
+	// Returns nullptr if the key is neither in memory nor on disk.
+	CacheEntry *lookup(const std::string &key);
+
+	CacheEntry *insert(const std::string &key, std::vector<uint8_t> elf);
+
+	uint64_t numHits() {
+		return _memoryHits + _diskHits;
+	}
+
+	uint64_t numMisses() {
+		return _misses;
+	}
+
+	void dumpStats();
+
+private:
+	std::string _pathOf(const std::string &key);
+	bool _load(const std::string &key, std::vector<uint8_t> &elf);
+	void _store(const std::string &key, const std::vector<uint8_t> &elf);
+
+	std::unordered_map<std::string, CacheEntry> _entries;
+	std::string _directory;
+
+	uint64_t _memoryHits = 0;
+	uint64_t _diskHits = 0;
+	uint64_t _misses = 0;
+};
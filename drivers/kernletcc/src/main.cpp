@@ -7,9 +7,13 @@
 #include <helix/memory.hpp>
 #include <protocols/mbus/client.hpp>
 #include <kernlet.pb.h>
+#include "cache.hpp"
 #include "common.hpp"
 
 static bool dumpHex = false;
+constexpr bool logCacheStats = false;
+
+KernletCache globalCache;
 
 // ----------------------------------------------------------------------------
 // kernletctl handling.
@@ -127,21 +131,35 @@ async::detached serveCompiler(helix::UniqueLane lane) {
 				bind_types.push_back(bt);
 			}
 
-			auto elf = compileFafnir(reinterpret_cast<const uint8_t *>(recv_code.data()),
-					recv_code.length(), bind_types);
-
-			if(dumpHex) {
-				for(size_t i = 0; i < elf.size(); i++) {
-					printf("%02x", elf[i]);
-					if((i % 32) == 31)
-						putchar('\n');
-					else if((i % 8) == 7)
-						putchar(' ');
+			auto code = reinterpret_cast<const uint8_t *>(recv_code.data());
+			auto key = KernletCache::makeKey(code, recv_code.length(), bind_types);
+			auto entry = globalCache.lookup(key);
+			if(!entry) {
+				auto elf = compileFafnir(code, recv_code.length(), bind_types);
+
+				if(dumpHex) {
+					for(size_t i = 0; i < elf.size(); i++) {
+						printf("%02x", elf[i]);
+						if((i % 32) == 31)
+							putchar('\n');
+						else if((i % 8) == 7)
+							putchar(' ');
+					}
+					putchar('\n');
 				}
-				putchar('\n');
-			}
 
-			auto object = co_await upload(elf.data(), elf.size(), bind_types);
+				entry = globalCache.insert(key, std::move(elf));
+			}
+			if(logCacheStats)
+				globalCache.dumpStats();
+
+			// Kernlet objects can be bound multiple times; hence, we only upload once.
+			if(!entry->object) {
+				auto object = co_await upload(entry->elf.data(), entry->elf.size(), bind_types);
+				// Another request might have uploaded the same kernlet concurrently.
+				if(!entry->object)
+					entry->object = std::move(object);
+			}
 
 			managarm::kernlet::SvrResponse resp;
 			resp.set_error(managarm::kernlet::Error::SUCCESS);
@@ -149,7 +167,7 @@ async::detached serveCompiler(helix::UniqueLane lane) {
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&push_kernlet, object));
+					helix::action(&push_kernlet, entry->object));
 			co_await transmit.async_wait();
 			if(send_resp.error() == kHelErrEndOfLane) {
 				std::cout << "\e[31m" "kernletcc: Client unexpectedly closed its connection"
@@ -196,6 +214,13 @@ async::detached asyncMain(const char **args) {
 
 int main(int argc, const char **argv) {
 	std::cout << "kernletcc: Starting up" << std::endl;
+
+	// By default, compiled kernlets are only cached in memory.
+	for(int i = 1; i < argc; i++) {
+		std::string arg{argv[i]};
+		if(arg.compare(0, 12, "--cache-dir=") == 0)
+			globalCache.setDirectory(arg.substr(12));
+	}
 	{
 		async::queue_scope scope{helix::globalQueue()};
 		asyncMain(argv);
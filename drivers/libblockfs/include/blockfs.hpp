@@ -20,6 +20,12 @@ struct BlockDevice {
 	}
 
 	const size_t sectorSize;
+
+	// Maximal number of requests that the block layer submits to the device concurrently.
+	size_t queueDepth = 1;
+
+	// If true, the block layer sorts requests by sector to reduce seeks.
+	bool rotational = false;
 };
 
 async::detached runDevice(BlockDevice *device);
@@ -19,6 +19,47 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Readahead windows start at this size and double on each sequential access.
+	constexpr size_t initialReadahead = 128 * 1024;
+	constexpr size_t maxReadahead = 4 * 1024 * 1024;
+
+	// At most maxCachedWindows * pageCacheWindowSize bytes of page cache
+	// are locked by cached windows.
+	constexpr size_t maxCachedWindows = 32;
+
+	// Print the readahead statistics after every logReadaheadInterval windows.
+	constexpr bool logReadahead = false;
+	constexpr uint64_t logReadaheadInterval = 64;
+
+	// Returns the number of blocks covered by an extent (written or not).
+	size_t extentLength(const Extent &extent) {
+		if(extent.len > EXT4_EXT_INIT_MAX_LEN)
+			return extent.len - EXT4_EXT_INIT_MAX_LEN;
+		return extent.len;
+	}
+
+	// Extents and index entries have the same size and both start with the first logical
+	// block that they cover. This allows us to treat them uniformly when splitting nodes.
+	static_assert(sizeof(Extent) == sizeof(ExtentIndex), "Bad extent entry sizes");
+
+	uint32_t firstExtentKey(ExtentHeader *header) {
+		assert(header->entries);
+		return reinterpret_cast<Extent *>(header + 1)->block;
+	}
+
+	// Inserts an entry into a node that is not full; entries are sorted by their first block.
+	void insertExtentEntry(ExtentHeader *header, const void *entry) {
+		assert(header->entries < header->max);
+		auto entries = reinterpret_cast<Extent *>(header + 1);
+		auto key = reinterpret_cast<const Extent *>(entry)->block;
+		size_t k = 0;
+		while(k < header->entries && entries[k].block < key)
+			k++;
+		memmove(&entries[k + 1], &entries[k], (header->entries - k) * sizeof(Extent));
+		memcpy(&entries[k], entry, sizeof(Extent));
+		header->entries++;
+	}
 }
 
 // --------------------------------------------------------
@@ -34,26 +75,19 @@ Inode::findEntry(std::string name) {
 
 	co_await readyJump.async_wait();
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
-
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapDontRequireBacking};
-
-	// Read the directory structure.
+	// Read the directory structure. Entries never cross block boundaries;
+	// hence, they never cross windows of the page cache.
+	std::shared_ptr<CachedWindow> window;
 	uintptr_t offset = 0;
 	while(offset < fileSize()) {
 		assert(!(offset & 3));
 		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(file_map.get()) + offset);
+		if(!window || offset >= window->offset + window->size) {
+			auto window_offset = offset & ~(pageCacheWindowSize - 1);
+			window = co_await fs.accessPageCache(shared_from_this(), window_offset,
+					std::min(uint64_t{pageCacheWindowSize}, fileSize() - window_offset));
+		}
+		auto disk_entry = reinterpret_cast<const DiskDirEntry *>(window->at(offset));
 
 		if(disk_entry->inode
 				&& name.length() == disk_entry->nameLength
@@ -87,6 +121,9 @@ Inode::link(std::string name, int64_t ino) {
 	assert(!name.empty() && name != "." && name != "..");
 	assert(ino);
 
+	if(!fs.checkWritable("link"))
+		co_return std::experimental::nullopt;
+
 	co_await readyJump.async_wait();
 
 	helix::LockMemoryView lock_memory;
@@ -160,6 +197,9 @@ Inode::link(std::string name, int64_t ino) {
 async::result<void> Inode::unlink(std::string name) {
 	assert(!name.empty() && name != "." && name != "..");
 
+	if(!fs.checkWritable("unlink"))
+		co_return;
+
 	co_await readyJump.async_wait();
 
 	helix::LockMemoryView lock_memory;
@@ -210,7 +250,7 @@ FileSystem::FileSystem(BlockDevice *device)
 : device(device) {
 }
 
-async::result<void> FileSystem::init() {
+async::result<bool> FileSystem::init() {
 	std::vector<uint8_t> buffer(1024);
 	co_await device->readSectors(2, buffer.data(), 2);
 
@@ -242,7 +282,34 @@ async::result<void> FileSystem::init() {
 		std::cout << "ext2fs:     Inodes per group: " << inodesPerGroup << std::endl;
 	}
 
-	auto bgdt_size = (numBlockGroups * sizeof(DiskGroupDesc) + 511) & ~size_t(511);
+	constexpr uint32_t supportedIncompat = EXT2_FEATURE_INCOMPAT_FILETYPE
+			| EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT
+			| EXT4_FEATURE_INCOMPAT_FLEX_BG;
+	constexpr uint32_t supportedRoCompat = EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER
+			| EXT2_FEATURE_RO_COMPAT_LARGE_FILE | EXT4_FEATURE_RO_COMPAT_HUGE_FILE
+			| EXT4_FEATURE_RO_COMPAT_DIR_NLINK | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE;
+	if(sb.featureIncompat & ~supportedIncompat) {
+		std::cout << "\e[31m" "ext2fs: Refusing to mount file system with unsupported"
+				" r/w-required features: 0x" << std::hex
+				<< (sb.featureIncompat & ~supportedIncompat) << std::dec
+				<< "\e[39m" << std::endl;
+		co_return false;
+	}
+	if(sb.featureRoCompat & ~supportedRoCompat) {
+		std::cout << "\e[33m" "ext2fs: Mounting read-only due to unsupported"
+				" w-required features: 0x" << std::hex
+				<< (sb.featureRoCompat & ~supportedRoCompat) << std::dec
+				<< "\e[39m" << std::endl;
+		readOnly = true;
+	}
+
+	if((sb.featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) && sb.descSize) {
+		groupDescSize = sb.descSize;
+	}else{
+		groupDescSize = sizeof(DiskGroupDesc);
+	}
+
+	auto bgdt_size = (numBlockGroups * groupDescSize + 511) & ~size_t(511);
 	// TODO: Use std::string instead of malloc().
 	blockGroupDescriptorBuffer = malloc(bgdt_size);
 
@@ -273,7 +340,15 @@ async::result<void> FileSystem::init() {
 
 	manageInodeTable(helix::UniqueDescriptor{inode_table_backing});
 
-	co_return;
+	co_return true;
+}
+
+bool FileSystem::checkWritable(const char *operation) {
+	if(!readOnly)
+		return true;
+	std::cout << "\e[31m" "ext2fs: Ignoring " << operation
+			<< " on read-only file system" "\e[39m" << std::endl;
+	return false;
 }
 
 async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
@@ -285,8 +360,7 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer;
-		auto block = bgdt[bg_idx].blockBitmap;
+		auto block = groupDescriptor(bg_idx)->blockBitmap;
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -323,8 +397,7 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer;
-		auto block = bgdt[bg_idx].inodeBitmap;
+		auto block = groupDescriptor(bg_idx)->inodeBitmap;
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -366,8 +439,7 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 		// TODO: Use shifts instead of division.
 		auto bg_idx = manage.offset() / (inodesPerGroup * inodeSize);
 		auto bg_offset = manage.offset() % (inodesPerGroup * inodeSize);
-		auto bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer;
-		auto block = bgdt[bg_idx].inodeTable;
+		auto block = groupDescriptor(bg_idx)->inodeTable;
 		assert(block);
 
 		if(manage.type() == kHelManageInitialize) {
@@ -409,6 +481,9 @@ auto FileSystem::accessInode(uint32_t number) -> std::shared_ptr<Inode> {
 }
 
 async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
+	if(!checkWritable("inode creation"))
+		co_return nullptr;
+
 	auto ino = co_await allocateInode();
 	assert(ino);
 
@@ -438,12 +513,10 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
 
 async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
-	co_await inode->readyJump.async_wait();
+	if(!checkWritable("write"))
+		co_return;
 
-	// Make sure that data blocks are allocated.
-	auto block_offset = (offset & ~(blockSize - 1)) >> blockShift;
-	auto block_count = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, block_offset, block_count);
+	co_await inode->readyJump.async_wait();
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
@@ -469,6 +542,13 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
+	// Make sure that data blocks are allocated. This must happen after the page cache
+	// is initialized: holes and unwritten extents read as zeros, while newly assigned
+	// blocks (and converted extents) still contain stale data on disk.
+	auto block_offset = (offset & ~(blockSize - 1)) >> blockShift;
+	auto block_count = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
+	co_await assignDataBlocks(inode, block_offset, block_count);
+
 	// Map the page cache into the address space.
 	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
 			static_cast<ptrdiff_t>(map_offset), map_size,
@@ -531,20 +611,41 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 	HEL_CHECK(helCreateManagedMemory(cache_size, kHelAllocBacked,
 			&inode->backingMemory, &inode->frontalMemory));
 
+	// Extent trees do not need the indirection block caches.
+	if(!inode->usesExtents()) {
+		size_t per_indirect = blockSize / 4;
+
+		HelHandle frontalOrder1, frontalOrder2;
+		HelHandle backingOrder1, backingOrder2;
+		HEL_CHECK(helCreateManagedMemory(3 << blockPagesShift,
+				kHelAllocBacked, &backingOrder1, &frontalOrder1));
+		HEL_CHECK(helCreateManagedMemory((2 * per_indirect) << blockPagesShift,
+				kHelAllocBacked, &backingOrder2, &frontalOrder2));
+		inode->indirectOrder1 = helix::UniqueDescriptor{frontalOrder1};
+		inode->indirectOrder2 = helix::UniqueDescriptor{frontalOrder2};
+
+		manageIndirect(inode, 1, helix::UniqueDescriptor{backingOrder1});
+		manageIndirect(inode, 2, helix::UniqueDescriptor{backingOrder2});
+
+		// The order 3 cache can become large; only allocate the part that the file needs.
+		if(disk_inode->data.blocks.tripleIndirect) {
+			size_t d_range = 12 + per_indirect + per_indirect * per_indirect;
+			size_t file_blocks = (inode->fileSize() + (blockSize - 1)) >> blockShift;
+			size_t num_frames = file_blocks > d_range
+					? (file_blocks - d_range + (per_indirect - 1)) / per_indirect : 1;
+
+			HelHandle frontalOrder3, backingOrder3;
+			HEL_CHECK(helCreateManagedMemory(num_frames << blockPagesShift,
+					kHelAllocBacked, &backingOrder3, &frontalOrder3));
+			inode->indirectOrder3 = helix::UniqueDescriptor{frontalOrder3};
+
+			manageIndirect(inode, 3, helix::UniqueDescriptor{backingOrder3});
+		}
+	}
+
 	inode->isReady = true;
 	inode->readyJump.trigger();
 
-	HelHandle frontalOrder1, frontalOrder2;
-	HelHandle backingOrder1, backingOrder2;
-	HEL_CHECK(helCreateManagedMemory(3 << blockPagesShift,
-			kHelAllocBacked, &backingOrder1, &frontalOrder1));
-	HEL_CHECK(helCreateManagedMemory((blockSize / 4) << blockPagesShift,
-			kHelAllocBacked, &backingOrder2, &frontalOrder2));
-	inode->indirectOrder1 = helix::UniqueDescriptor{frontalOrder1};
-	inode->indirectOrder2 = helix::UniqueDescriptor{frontalOrder2};
-
-	manageIndirect(inode, 1, helix::UniqueDescriptor{backingOrder1});
-	manageIndirect(inode, 2, helix::UniqueDescriptor{backingOrder2});
 	manageFileData(inode);
 }
 
@@ -558,19 +659,9 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 		assert(manage.offset() + manage.length() <= ((inode->fileSize() + 0xFFF) & ~size_t(0xFFF)));
 
 		if(manage.type() == kHelManageInitialize) {
-			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
-					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtWrite};
-
-			assert(!(manage.offset() % inode->fs.blockSize));
-			size_t backed_size = std::min(manage.length(), inode->fileSize() - manage.offset());
-			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
-
-			assert(num_blocks * inode->fs.blockSize <= manage.length());
-			co_await inode->fs.readDataBlocks(inode, manage.offset() / inode->fs.blockSize,
-					num_blocks, file_map.get());
-
-			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageInitialize,
-					manage.offset(), manage.length()));
+			// Process initialization requests concurrently such that demand requests
+			// do not wait for readahead windows (and vice versa).
+			initializeFileData(inode, manage.offset(), manage.length());
 		}else{
 			assert(manage.type() == kHelManageWriteback);
 
@@ -581,9 +672,11 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 			size_t backed_size = std::min(manage.length(), inode->fileSize() - manage.offset());
 			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
 
+			// Pages can still be dirtied through writable mappings; keep them in memory only.
 			assert(num_blocks * inode->fs.blockSize <= manage.length());
-			co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
-					num_blocks, file_map.get());
+			if(inode->fs.checkWritable("writeback"))
+				co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
+						num_blocks, file_map.get());
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageWriteback,
 					manage.offset(), manage.length()));
@@ -591,6 +684,73 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 	}
 }
 
+async::detached FileSystem::initializeFileData(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length) {
+	auto &readahead = inode->readahead;
+	if(offset >= readahead.windowStart && offset < readahead.windowEnd) {
+		readaheadStats.readaheadPages += length >> pageShift;
+	}else{
+		readaheadStats.demandPages += length >> pageShift;
+		// Start the readahead before the demand read such that the device sees both.
+		updateReadahead(inode.get(), offset, length);
+	}
+
+	helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
+			static_cast<ptrdiff_t>(offset), length, kHelMapProtWrite};
+
+	assert(!(offset % blockSize));
+	size_t backed_size = std::min(length, inode->fileSize() - offset);
+	size_t num_blocks = (backed_size + (blockSize - 1)) / blockSize;
+
+	// readDataBlocks() fuses consecutive blocks; thus, readahead windows
+	// become large device reads.
+	assert(num_blocks * blockSize <= length);
+	co_await readDataBlocks(inode, offset / blockSize, num_blocks, file_map.get());
+
+	HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageInitialize,
+			offset, length));
+}
+
+void FileSystem::updateReadahead(Inode *inode, uint64_t offset, size_t length) {
+	auto &readahead = inode->readahead;
+	auto end = offset + length;
+	if(offset != readahead.nextOffset) {
+		// Random access; disable readahead until the access becomes sequential again.
+		readahead.windowSize = 0;
+		readahead.nextOffset = end;
+		return;
+	}
+
+	// The kernel only asks for missing pages. As readahead windows are read in full,
+	// the next sequential request starts right after the window.
+	readahead.windowSize = readahead.windowSize
+			? std::min(2 * readahead.windowSize, maxReadahead) : initialReadahead;
+
+	auto cache_size = (inode->fileSize() + (pageSize - 1)) & ~(pageSize - 1);
+	if(end >= cache_size) {
+		readahead.nextOffset = end;
+		return;
+	}
+	auto size = std::min(uint64_t{readahead.windowSize}, cache_size - end);
+
+	readahead.windowStart = end;
+	readahead.windowEnd = end + size;
+	readahead.nextOffset = end + size;
+	HEL_CHECK(helLoadahead(inode->frontalMemory, end, size));
+
+	readaheadStats.numWindows++;
+	if(logReadahead && !(readaheadStats.numWindows % logReadaheadInterval))
+		dumpReadaheadStats();
+}
+
+void FileSystem::dumpReadaheadStats() {
+	auto total = readaheadStats.demandPages + readaheadStats.readaheadPages;
+	std::cout << "ext2fs: " << readaheadStats.numWindows << " readahead windows, "
+			<< readaheadStats.readaheadPages << " of " << total
+			<< " pages were read ahead (hit rate: "
+			<< (total ? readaheadStats.readaheadPages * 100 / total : 0) << "%)" << std::endl;
+}
+
 async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 		int order, helix::UniqueDescriptor memory) {
 	while(true) {
@@ -616,21 +776,26 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 				abort();
 			}
 		}else{
-			assert(order == 2);
-
-			auto indirect_frame = element >> (blockShift - 2);
+			assert(order == 2 || order == 3);
+
+			// Order 2 blocks are referenced by order 1 blocks (starting at the double
+			// indirect block). Order 3 blocks are referenced by the second half of
+			// the order 2 blocks (i.e., by those that belong to the triple indirect block).
+			auto &parent = (order == 2) ? inode->indirectOrder1 : inode->indirectOrder2;
+			auto parent_frame = ((order == 2) ? 1 : (blockSize / 4))
+					+ (element >> (blockShift - 2));
 			auto indirect_index = element & ((1 << (blockShift - 2)) - 1);
 
 			helix::LockMemoryView lock_indirect;
-			auto &&submit_indirect = helix::submitLockMemoryView(inode->indirectOrder1,
+			auto &&submit_indirect = helix::submitLockMemoryView(parent,
 					&lock_indirect,
-					(1 + indirect_frame) << blockPagesShift, 1 << blockPagesShift,
+					parent_frame << blockPagesShift, 1 << blockPagesShift,
 					helix::Dispatcher::global());
 			co_await submit_indirect.async_wait();
 			HEL_CHECK(lock_indirect.error());
 
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					(1 + indirect_frame) << blockPagesShift, size_t{1} << blockPagesShift,
+			helix::Mapping indirect_map{parent,
+					parent_frame << blockPagesShift, size_t{1} << blockPagesShift,
 					kHelMapProtRead | kHelMapDontRequireBacking};
 			block = reinterpret_cast<uint32_t *>(indirect_map.get())[indirect_index];
 		}
@@ -728,6 +893,11 @@ async::result<uint32_t> FileSystem::allocateInode() {
 
 async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
+	if(inode->usesExtents()) {
+		co_await assignExtentBlocks(inode, block_offset, num_blocks);
+		co_return;
+	}
+
 	size_t per_indirect = blockSize / 4;
 	size_t per_single = per_indirect;
 	size_t per_double = per_indirect * per_indirect;
@@ -805,8 +975,77 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
 }
 
-async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
-		uint64_t offset, size_t num_blocks, void *buffer) {
+async::result<void> FileSystem::assignExtentBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	co_await inode->extentMutex.async_lock();
+	std::unique_lock<async::mutex> lock{inode->extentMutex, std::adopt_lock};
+
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto index = block_offset + prg;
+
+		// Note that the inode might be remapped while we wait; refetch all pointers.
+		auto path = co_await lookupExtentPath(inode, index);
+		auto leaf = accessExtentNode(inode, path.back());
+		auto extents = reinterpret_cast<Extent *>(leaf + 1);
+
+		// Skip blocks that are already covered by an extent; initialize unwritten extents.
+		size_t k = 0;
+		while(k < leaf->entries && extents[k].block <= index)
+			k++;
+		if(k && index < extents[k - 1].block + extentLength(extents[k - 1])) {
+			auto n = std::min(num_blocks - prg,
+					extents[k - 1].block + extentLength(extents[k - 1]) - index);
+			if(extents[k - 1].len > EXT4_EXT_INIT_MAX_LEN)
+				co_await initializeExtent(inode, path, k - 1, index, n);
+			prg += n;
+			continue;
+		}
+
+		auto block = co_await allocateBlock();
+		assert(block && "Out of disk space"); // TODO: Fix this.
+
+		// Try to extend the preceding extent; allocateBlock() usually returns
+		// consecutive blocks for consecutive calls.
+		leaf = accessExtentNode(inode, path.back());
+		extents = reinterpret_cast<Extent *>(leaf + 1);
+		if(k) {
+			auto &prev = extents[k - 1];
+			uint64_t prev_start = prev.startLo | (uint64_t(prev.startHi) << 32);
+			if(prev.len < EXT4_EXT_INIT_MAX_LEN
+					&& prev.block + prev.len == index
+					&& prev_start + prev.len == block) {
+				prev.len++;
+				markExtentNode(inode, path.back());
+				prg++;
+				continue;
+			}
+		}
+
+		co_await insertExtent(inode, Extent{static_cast<uint32_t>(index), 1, 0, block});
+		prg++;
+	}
+
+	co_await flushExtentNodes(inode);
+
+	// Notify the kernel that the inode might have changed.
+	// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
+	auto inode_address = (inode->number - 1) * inodeSize;
+
+	inode->diskMapping = helix::Mapping{inodeTable,
+			inode_address, inodeSize,
+			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+}
+
+async::result<std::pair<uint64_t, size_t>> FileSystem::mapBlocks(Inode *inode,
+		uint64_t index, size_t remaining) {
+	if(inode->usesExtents())
+		co_return co_await mapExtentBlocks(inode, index, remaining);
+	co_return co_await mapIndirectBlocks(inode, index, remaining);
+}
+
+async::result<std::pair<uint64_t, size_t>> FileSystem::mapIndirectBlocks(Inode *inode,
+		uint64_t index, size_t remaining) {
 	// We perform "block-fusion" here i.e. we try to read/write multiple
 	// consecutive blocks in a single read/writeSectors() operation.
 	auto fuse = [] (size_t index, size_t remaining, uint32_t *list, size_t limit) {
@@ -816,7 +1055,24 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 				break;
 			n++;
 		}
-		return std::pair<size_t, size_t>{list[index], n};
+		return std::pair<uint64_t, size_t>{list[index], n};
+	};
+
+	// Fuses blocks from the given frame of an indirection block cache.
+	auto fuseIndirect = [&] (helix::UniqueDescriptor &memory, uint64_t frame,
+			size_t indirect_index) -> async::result<std::pair<uint64_t, size_t>> {
+		helix::LockMemoryView lock_indirect;
+		auto &&submit = helix::submitLockMemoryView(memory, &lock_indirect,
+				frame << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_indirect.error());
+
+		helix::Mapping indirect_map{memory,
+				static_cast<ptrdiff_t>(frame << blockPagesShift), size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+		co_return fuse(indirect_index, remaining,
+				reinterpret_cast<uint32_t *>(indirect_map.get()), blockSize / 4);
 	};
 
 	size_t per_indirect = blockSize / 4;
@@ -828,152 +1084,292 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	size_t s_range = i_range + per_single; // Plus the first single indirect block.
 	size_t d_range = s_range + per_double; // Plus the first double indirect block.
 
-	co_await inode->readyJump.async_wait();
-	// TODO: Assert that we do not read past the EOF.
+	if(index >= d_range) { // Use the triple indirect block.
+		co_return co_await fuseIndirect(inode->indirectOrder3,
+				(index - d_range) >> (blockShift - 2),
+				(index - d_range) & ((1 << (blockShift - 2)) - 1));
+	}else if(index >= s_range) { // Use the double indirect block.
+		co_return co_await fuseIndirect(inode->indirectOrder2,
+				(index - s_range) >> (blockShift - 2),
+				(index - s_range) & ((1 << (blockShift - 2)) - 1));
+	}else if(index >= i_range) { // Use the single indirect block.
+		co_return co_await fuseIndirect(inode->indirectOrder1, 0, index - i_range);
+	}else{
+		auto disk_inode = inode->diskInode();
+		co_return fuse(index, remaining, disk_inode->data.blocks.direct, 12);
+	}
+}
 
-	size_t progress = 0;
-	while(progress < num_blocks) {
-		// Block number and block count of the readSectors() command that we will issue here.
-		std::pair<size_t, size_t> issue;
+async::result<std::pair<uint64_t, size_t>> FileSystem::mapExtentBlocks(Inode *inode,
+		uint64_t index, size_t remaining) {
+	co_await inode->extentMutex.async_lock();
+	std::unique_lock<async::mutex> lock{inode->extentMutex, std::adopt_lock};
 
-		auto index = offset + progress;
-//		std::cout << "Reading " << index << "-th block from inode " << inode->number
-//				<< " (" << progress << "/" << num_blocks << " in request)" << std::endl;
+	auto path = co_await lookupExtentPath(inode, index);
 
-		assert(index < d_range);
-		if(index >= d_range) {
-			assert(!"Fix triple indirect blocks");
-		}else if(index >= s_range) { // Use the double indirect block.
-			// TODO: Use shift/and instead of div/mod.
-			int64_t indirect_frame = (index - s_range) >> (blockShift - 2);
-			int64_t indirect_index = (index - s_range) & ((1 << (blockShift - 2)) - 1);
+	// Find the first block that is not covered by the leaf.
+	uint64_t limit = UINT64_MAX;
+	for(size_t i = 0; i + 1 < path.size(); i++) {
+		auto header = accessExtentNode(inode, path[i]);
+		auto indices = reinterpret_cast<ExtentIndex *>(header + 1);
+		if(path[i].entry + 1 < header->entries)
+			limit = indices[path[i].entry + 1].block;
+	}
 
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder2, &lock_indirect,
-					indirect_frame << blockPagesShift, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+	auto header = accessExtentNode(inode, path.back());
+	auto extents = reinterpret_cast<Extent *>(header + 1);
+	for(size_t k = 0; k < header->entries; k++) {
+		auto &extent = extents[k];
+		if(extent.block > index) {
+			// The block is part of a hole that ends at this extent.
+			limit = extent.block;
+			break;
+		}
 
-			helix::Mapping indirect_map{inode->indirectOrder2,
-					indirect_frame << blockPagesShift, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
+		size_t length = extentLength(extent);
+		if(index >= extent.block + length)
+			continue;
 
-			issue = fuse(indirect_index, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else if(index >= i_range) { // Use the single indirect block.
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
-					&lock_indirect, 0, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+		size_t n = std::min(remaining, extent.block + length - index);
+		if(extent.len > EXT4_EXT_INIT_MAX_LEN)
+			co_return std::pair<uint64_t, size_t>{0, n};
+		uint64_t start = extent.startLo | (uint64_t(extent.startHi) << 32);
+		co_return std::pair<uint64_t, size_t>{start + (index - extent.block), n};
+	}
 
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					0, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
-			issue = fuse(index - i_range, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else{
-			auto disk_inode = inode->diskInode();
+	co_return std::pair<uint64_t, size_t>{0, std::min(uint64_t{remaining}, limit - index)};
+}
+
+async::result<std::vector<ExtentPathNode>> FileSystem::lookupExtentPath(Inode *inode,
+		uint64_t index) {
+	std::vector<ExtentPathNode> path;
+	path.push_back(ExtentPathNode{0, nullptr, 0});
+	while(true) {
+		auto header = accessExtentNode(inode, path.back());
+		assert(header->magic == EXT4_EXT_MAGIC);
+		assert(header->entries <= header->max);
+
+		if(!header->depth)
+			co_return path;
+
+		// Follow the last child that starts at or before the block.
+		auto indices = reinterpret_cast<ExtentIndex *>(header + 1);
+		assert(header->entries);
+		size_t k = 0;
+		while(k + 1 < header->entries && indices[k + 1].block <= index)
+			k++;
+		path.back().entry = k;
+
+		uint64_t child = indices[k].leafLo | (uint64_t(indices[k].leafHi) << 32);
+		auto buffer = co_await readExtentNode(inode, child);
+		path.push_back(ExtentPathNode{child, std::move(buffer), 0});
+	}
+}
+
+async::result<std::shared_ptr<std::vector<uint8_t>>> FileSystem::readExtentNode(Inode *inode,
+		uint64_t block) {
+	auto it = inode->extentNodes.find(block);
+	if(it != inode->extentNodes.end())
+		co_return it->second;
 
-			issue = fuse(index, num_blocks - progress,
-					disk_inode->data.blocks.direct, 12);
+	auto buffer = std::make_shared<std::vector<uint8_t>>(blockSize);
+	co_await device->readSectors(block * sectorsPerBlock, buffer->data(), sectorsPerBlock);
+	inode->extentNodes[block] = buffer;
+	co_return buffer;
+}
+
+ExtentHeader *FileSystem::accessExtentNode(Inode *inode, ExtentPathNode &node) {
+	// Do not keep pointers to the root across suspension points; the inode is remapped
+	// whenever it is modified.
+	if(!node.block)
+		return reinterpret_cast<ExtentHeader *>(inode->diskInode()->data.embedded);
+	return reinterpret_cast<ExtentHeader *>(node.buffer->data());
+}
+
+void FileSystem::markExtentNode(Inode *inode, ExtentPathNode &node) {
+	// The root is written back together with the inode.
+	if(node.block)
+		inode->dirtyExtentNodes.insert(node.block);
+}
+
+async::result<void> FileSystem::insertExtent(Inode *inode, Extent extent) {
+	while(true) {
+		auto path = co_await lookupExtentPath(inode, extent.block);
+		auto leaf = accessExtentNode(inode, path.back());
+		if(leaf->entries < leaf->max) {
+			insertExtentEntry(leaf, &extent);
+			markExtentNode(inode, path.back());
+
+			// Index entries must start at the first block of their child.
+			for(size_t i = path.size() - 1; i > 0; i--) {
+				auto parent = accessExtentNode(inode, path[i - 1]);
+				auto &entry = reinterpret_cast<ExtentIndex *>(parent + 1)[path[i - 1].entry];
+				auto key = firstExtentKey(accessExtentNode(inode, path[i]));
+				if(entry.block == key)
+					break;
+				entry.block = key;
+				markExtentNode(inode, path[i - 1]);
+			}
+			co_return;
 		}
 
-//		std::cout << "Issuing read of " << issue.second
-//				<< " blocks, starting at " << issue.first << std::endl;
+		// Make room in the leaf and look up the path again.
+		co_await splitExtentNode(inode, path, path.size() - 1);
+	}
+}
+
+// Makes room for at least one entry in the node at the given level of the path.
+// The path is invalidated; callers have to look it up again.
+async::result<void> FileSystem::splitExtentNode(Inode *inode,
+		std::vector<ExtentPathNode> &path, size_t level) {
+	size_t max_entries = (blockSize - sizeof(ExtentHeader)) / sizeof(Extent);
+
+	if(!level) {
+		// The root is full: move all of its entries into a new node
+		// that becomes the only child of the root.
+		auto block = co_await allocateBlock();
+		assert(block && "Out of disk space"); // TODO: Fix this.
+
+		auto buffer = std::make_shared<std::vector<uint8_t>>(blockSize);
+		auto root = accessExtentNode(inode, path[0]);
+		auto child = reinterpret_cast<ExtentHeader *>(buffer->data());
+		child->magic = EXT4_EXT_MAGIC;
+		child->entries = root->entries;
+		child->max = max_entries;
+		child->depth = root->depth;
+		memcpy(child + 1, root + 1, root->entries * sizeof(Extent));
+		inode->extentNodes[block] = buffer;
+		inode->dirtyExtentNodes.insert(block);
+
+		ExtentIndex index{firstExtentKey(child), block, 0, 0};
+		root->depth++;
+		root->entries = 0;
+		insertExtentEntry(root, &index);
+		co_return;
+	}
 
-		assert(issue.first);
-		co_await device->readSectors(issue.first * sectorsPerBlock,
-				(uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
-		progress += issue.second;
+	// Splitting the node adds an entry to its parent.
+	auto parent = accessExtentNode(inode, path[level - 1]);
+	if(parent->entries == parent->max) {
+		co_await splitExtentNode(inode, path, level - 1);
+		co_return;
 	}
+
+	auto block = co_await allocateBlock();
+	assert(block && "Out of disk space"); // TODO: Fix this.
+
+	// Move the upper half of the entries to a new sibling.
+	auto node = accessExtentNode(inode, path[level]);
+	auto buffer = std::make_shared<std::vector<uint8_t>>(blockSize);
+	auto sibling = reinterpret_cast<ExtentHeader *>(buffer->data());
+	size_t keep = node->entries / 2;
+	sibling->magic = EXT4_EXT_MAGIC;
+	sibling->entries = node->entries - keep;
+	sibling->max = max_entries;
+	sibling->depth = node->depth;
+	memcpy(sibling + 1, reinterpret_cast<Extent *>(node + 1) + keep,
+			sibling->entries * sizeof(Extent));
+	node->entries = keep;
+	inode->extentNodes[block] = buffer;
+	inode->dirtyExtentNodes.insert(block);
+	markExtentNode(inode, path[level]);
+
+	// Refetch the parent as the root might have been remapped.
+	ExtentIndex index{firstExtentKey(sibling), block, 0, 0};
+	insertExtentEntry(accessExtentNode(inode, path[level - 1]), &index);
+	markExtentNode(inode, path[level - 1]);
 }
 
-// TODO: There is a lot of overlap between this method and readDataBlocks.
-//       Refactor common code into a another method.
-async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
-		uint64_t offset, size_t num_blocks, const void *buffer) {
-	// We perform "block-fusion" here i.e. we try to read/write multiple
-	// consecutive blocks in a single read/writeSectors() operation.
-	auto fuse = [] (size_t index, size_t remaining, uint32_t *list, size_t limit) {
-		size_t n = 1;
-		while(n < remaining && index + n < limit) {
-			if(list[index + n] != list[index] + n)
-				break;
-			n++;
-		}
-		return std::pair<size_t, size_t>{list[index], n};
+// Converts part of an unwritten extent (entry k of the leaf of the path) to a written extent.
+async::result<void> FileSystem::initializeExtent(Inode *inode,
+		std::vector<ExtentPathNode> &path, size_t k, uint64_t index, size_t count) {
+	auto leaf = accessExtentNode(inode, path.back());
+	auto &extent = reinterpret_cast<Extent *>(leaf + 1)[k];
+	assert(extent.len > EXT4_EXT_INIT_MAX_LEN);
+
+	// The extent is split into up to three parts. The parts before and after
+	// the given range stay unwritten.
+	uint32_t first = extent.block;
+	uint64_t start = extent.startLo | (uint64_t(extent.startHi) << 32);
+	size_t head = index - first;
+	size_t tail = extent.len - EXT4_EXT_INIT_MAX_LEN - head - count;
+
+	auto makeExtent = [] (uint64_t block, size_t length, uint64_t start) {
+		return Extent{static_cast<uint32_t>(block), static_cast<uint16_t>(length),
+				static_cast<uint16_t>(start >> 32), static_cast<uint32_t>(start)};
 	};
 
-	size_t per_indirect = blockSize / 4;
-	size_t per_single = per_indirect;
-	size_t per_double = per_indirect * per_indirect;
+	auto written = makeExtent(index, count, start + head);
+	if(head) {
+		extent.len = EXT4_EXT_INIT_MAX_LEN + head;
+	}else{
+		extent = written;
+	}
+	markExtentNode(inode, path.back());
 
-	// Number of blocks that can be accessed by:
-	size_t i_range = 12; // Direct blocks only.
-	size_t s_range = i_range + per_single; // Plus the first single indirect block.
-	size_t d_range = s_range + per_double; // Plus the first double indirect block.
+	if(head)
+		co_await insertExtent(inode, written);
+	if(tail)
+		co_await insertExtent(inode, makeExtent(index + count,
+				EXT4_EXT_INIT_MAX_LEN + tail, start + head + count));
+}
+
+async::result<void> FileSystem::flushExtentNodes(Inode *inode) {
+	auto dirty = std::move(inode->dirtyExtentNodes);
+	inode->dirtyExtentNodes.clear();
+	for(auto block : dirty) {
+		auto buffer = inode->extentNodes.at(block);
+		co_await device->writeSectors(block * sectorsPerBlock, buffer->data(), sectorsPerBlock);
+	}
+}
 
+async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t num_blocks, void *buffer) {
 	co_await inode->readyJump.async_wait();
-	// TODO: Assert that we do not write past the EOF.
+	// TODO: Assert that we do not read past the EOF.
 
 	size_t progress = 0;
 	while(progress < num_blocks) {
-		// Block number and block count of the writeSectors() command that we will issue here.
-		std::pair<size_t, size_t> issue;
-
-		auto index = offset + progress;
-//		std::cout << "Write " << index << "-th block to inode " << inode->number
-//				<< " (" << progress << "/" << num_blocks << " in request)" << std::endl;
-
-		assert(index < d_range);
-		if(index >= d_range) {
-			assert(!"Fix triple indirect blocks");
-		}else if(index >= s_range) { // Use the double indirect block.
-			// TODO: Use shift/and instead of div/mod.
-			int64_t indirect_frame = (index - s_range) >> (blockShift - 2);
-			int64_t indirect_index = (index - s_range) & ((1 << (blockShift - 2)) - 1);
-
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder2, &lock_indirect,
-					indirect_frame << blockPagesShift, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+		// Block number and block count of the readSectors() command that we will issue here.
+		auto issue = co_await mapBlocks(inode.get(), offset + progress, num_blocks - progress);
+		assert(issue.second);
 
-			helix::Mapping indirect_map{inode->indirectOrder2,
-					indirect_frame << blockPagesShift, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
+		if(!issue.first) {
+			// Holes and uninitialized extents read as zeros.
+			memset((uint8_t *)buffer + progress * blockSize, 0, issue.second * blockSize);
+		}else{
+			co_await device->readSectors(issue.first * sectorsPerBlock,
+					(uint8_t *)buffer + progress * blockSize,
+					issue.second * sectorsPerBlock);
+		}
+		progress += issue.second;
+	}
+}
 
-			issue = fuse(indirect_index, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else if(index >= i_range) { // Use the triple indirect block.
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
-					&lock_indirect, 0, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t num_blocks, const void *buffer) {
+	co_await inode->readyJump.async_wait();
+	// TODO: Assert that we do not write past the EOF.
 
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					0, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
-			issue = fuse(index - i_range, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else{
-			auto disk_inode = inode->diskInode();
+	size_t progress = 0;
+	while(progress < num_blocks) {
+		// Block number and block count of the writeSectors() command that we will issue here.
+		auto issue = co_await mapBlocks(inode.get(), offset + progress, num_blocks - progress);
+		assert(issue.second);
 
-			issue = fuse(index, num_blocks - progress,
-					disk_inode->data.blocks.direct, 12);
+		if(!issue.first) {
+			// Pages of holes and unwritten extents can be dirtied through writable mappings.
+			if(inode->usesExtents()) {
+				co_await assignExtentBlocks(inode.get(), offset + progress, issue.second);
+				continue;
+			}
+			std::cout << "\e[31m" "ext2fs: Dropping write to unallocated block "
+					<< (offset + progress) << " of inode " << inode->number
+					<< "\e[39m" << std::endl;
+			progress += issue.second;
+			continue;
 		}
 
-//		std::cout << "Issuing write of " << issue.second
-//				<< " blocks, starting at " << issue.first << std::endl;
-
-		assert(issue.first);
 		co_await device->writeSectors(issue.first * sectorsPerBlock,
 				(const uint8_t *)buffer + progress * blockSize,
 				issue.second * sectorsPerBlock);
@@ -981,8 +1377,71 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	}
 }
 
+async::result<std::shared_ptr<CachedWindow>>
+FileSystem::accessPageCache(std::shared_ptr<Inode> inode, uint64_t offset, size_t length) {
+	auto window_offset = offset & ~(pageCacheWindowSize - 1);
+	assert(offset + length <= window_offset + pageCacheWindowSize);
+
+	// Windows only lock the pages that were accessed so far (see below).
+	auto lock_start = offset & ~(pageSize - 1);
+	auto lock_end = (offset + length + (pageSize - 1)) & ~(pageSize - 1);
+
+	for(auto it = cachedWindows.begin(); it != cachedWindows.end(); ++it) {
+		auto window = *it;
+		if(window->inode != inode.get()
+				|| (window->offset & ~(pageCacheWindowSize - 1)) != window_offset)
+			continue;
+		// Windows of destroyed inodes are replaced. Windows that do not cover
+		// the range are widened (i.e., replaced by a larger window).
+		if(window->owner.expired()) {
+			cachedWindows.erase(it);
+			break;
+		}
+		if(offset < window->offset || offset + length > window->offset + window->size) {
+			lock_start = std::min(lock_start, window->offset);
+			lock_end = std::max(lock_end, window->offset + window->size);
+			cachedWindows.erase(it);
+			break;
+		}
+		cachedWindows.splice(cachedWindows.begin(), cachedWindows, it);
+		co_return window;
+	}
+
+	// Locking initializes all pages of the window. For sequential accesses, lock the
+	// whole window; otherwise, small random reads would cause much more I/O than needed.
+	auto cache_size = (inode->fileSize() + (pageSize - 1)) & ~(pageSize - 1);
+	if(inode->readahead.windowSize) {
+		lock_start = window_offset;
+		lock_end = window_offset + pageCacheWindowSize;
+	}
+	lock_end = std::min(lock_end, cache_size);
+	assert(offset + length <= lock_end);
+	auto window_size = lock_end - lock_start;
+
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
+			&lock_memory, lock_start, window_size, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+
+	// Map the page cache into the address space.
+	helix::Mapping window_map{helix::BorrowedDescriptor{inode->frontalMemory},
+			static_cast<ptrdiff_t>(lock_start), window_size,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+
+	// Evicted windows stay mapped until all references are dropped.
+	auto window = std::make_shared<CachedWindow>(CachedWindow{inode.get(), inode,
+			lock_start, window_size, lock_memory.descriptor(), std::move(window_map)});
+	cachedWindows.push_front(window);
+	if(cachedWindows.size() > maxCachedWindows)
+		cachedWindows.pop_back();
+	co_return window;
+}
 
 async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
+	if(!checkWritable("truncate"))
+		co_return;
+
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
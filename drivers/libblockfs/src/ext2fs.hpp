@@ -2,14 +2,17 @@
 #include <string.h>
 #include <time.h>
 #include <experimental/optional>
+#include <list>
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <protocols/fs/file-locks.hpp>
 
 #include <async/jump.hpp>
 #include <async/doorbell.hpp>
+#include <async/mutex.hpp>
 #include <hel.h>
 
 #include <blockfs.hpp>
@@ -39,6 +42,40 @@ union FileData {
 };
 static_assert(sizeof(FileData) == 60, "Bad FileData struct size");
 
+// ext4 extent trees. The root node is stored in FileData; all other nodes occupy
+// a full block. Each node consists of a header followed by entries.
+struct ExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth; // Zero for leaf nodes.
+	uint32_t generation;
+};
+static_assert(sizeof(ExtentHeader) == 12, "Bad ExtentHeader struct size");
+
+// Entry of an index node.
+struct ExtentIndex {
+	uint32_t block; // First logical block covered by the child.
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(ExtentIndex) == 12, "Bad ExtentIndex struct size");
+
+// Entry of a leaf node.
+struct Extent {
+	uint32_t block; // First logical block covered by the extent.
+	uint16_t len; // Values above EXT4_EXT_INIT_MAX_LEN denote uninitialized extents.
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(Extent) == 12, "Bad Extent struct size");
+
+enum {
+	EXT4_EXT_MAGIC = 0xF30A,
+	EXT4_EXT_INIT_MAX_LEN = 32768
+};
+
 struct DiskSuperblock {
 	uint32_t inodesCount;
 	uint32_t blocksCount;
@@ -88,7 +125,8 @@ struct DiskSuperblock {
 	//-- Directory Indexing Support --
 	uint32_t hashSeed[4];
 	uint8_t defHashVersion;
-	uint8_t padding[3];
+	uint8_t jnlBackupType;
+	uint16_t descSize; // Size of group descriptors (only with EXT4_FEATURE_INCOMPAT_64BIT).
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
@@ -96,6 +134,22 @@ struct DiskSuperblock {
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
+enum {
+	EXT2_FEATURE_INCOMPAT_FILETYPE = 0x2,
+	EXT3_FEATURE_INCOMPAT_RECOVER = 0x4,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40,
+	EXT4_FEATURE_INCOMPAT_64BIT = 0x80,
+	EXT4_FEATURE_INCOMPAT_FLEX_BG = 0x200
+};
+
+enum {
+	EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER = 0x1,
+	EXT2_FEATURE_RO_COMPAT_LARGE_FILE = 0x2,
+	EXT4_FEATURE_RO_COMPAT_HUGE_FILE = 0x8,
+	EXT4_FEATURE_RO_COMPAT_DIR_NLINK = 0x20,
+	EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE = 0x40
+};
+
 struct DiskGroupDesc {
 	uint32_t blockBitmap;
 	uint32_t inodeBitmap;
@@ -106,6 +160,8 @@ struct DiskGroupDesc {
 	uint16_t pad;
 	uint8_t reserved[12];
 };
+// With EXT4_FEATURE_INCOMPAT_64BIT, descriptors are larger (see DiskSuperblock::descSize);
+// we only access the first 32 bytes.
 static_assert(sizeof(DiskGroupDesc) == 32, "Bad DiskGroupDesc struct size");
 
 struct DiskInode {
@@ -124,7 +180,7 @@ struct DiskInode {
 	FileData data;
 	uint32_t generation;
 	uint32_t fileAcl;
-	uint32_t dirAcl;
+	uint32_t dirAcl; // Upper 32 bits of the size for regular files.
 	uint32_t faddr;
 	uint8_t osd2[12];
 };
@@ -134,6 +190,10 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	EXT4_EXTENTS_FL = 0x80000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -179,12 +239,25 @@ struct Inode : std::enable_shared_from_this<Inode> {
 
 	// Returns the size of the file in bytes.
 	uint64_t fileSize() {
-		return diskInode()->size;
+		auto disk_inode = diskInode();
+		if((disk_inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG)
+			return disk_inode->size | (uint64_t(disk_inode->dirAcl) << 32);
+		return disk_inode->size;
 	}
 
 	void setFileSize(uint64_t size) {
-		assert(!(size & ~uint64_t(0xFFFFFFFF)));
-		diskInode()->size = size;
+		auto disk_inode = diskInode();
+		if((disk_inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+			disk_inode->dirAcl = size >> 32;
+		}else{
+			assert(!(size & ~uint64_t(0xFFFFFFFF)));
+		}
+		disk_inode->size = size;
+	}
+
+	// Returns true if the data blocks are mapped by an extent tree.
+	bool usesExtents() {
+		return diskInode()->flags & EXT4_EXTENTS_FL;
 	}
 
 	async::result<std::experimental::optional<DirEntry>> findEntry(std::string name);
@@ -222,6 +295,25 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	// - Indirection level 3/3 for triple indirect blocks.
 	helix::UniqueDescriptor indirectOrder3;
 
+	// Caches non-root nodes of the extent tree (indexed by block number).
+	// Nodes are modified in this cache and written back by FileSystem::flushExtentNodes().
+	std::unordered_map<uint64_t, std::shared_ptr<std::vector<uint8_t>>> extentNodes;
+	std::unordered_set<uint64_t> dirtyExtentNodes;
+	// Protects the extent tree. Lookups take this mutex as nodes might be split
+	// while they wait for the disk.
+	async::mutex extentMutex;
+
+	// Sequential readahead state of the page cache (see FileSystem::manageFileData()).
+	struct {
+		// Offset at which the next sequential initialization request is expected.
+		uint64_t nextOffset = 0;
+		// Size of the current window; zero if the access pattern is not sequential.
+		size_t windowSize = 0;
+		// Range of the current window.
+		uint64_t windowStart = 0;
+		uint64_t windowEnd = 0;
+	} readahead;
+
 	// NOTE: The following fields are only meaningful if the isReady is true
 
 	FileType fileType;
@@ -240,10 +332,52 @@ struct Inode : std::enable_shared_from_this<Inode> {
 // FileSystem
 // --------------------------------------------------------
 
+struct ReadaheadStats {
+	// Pages that were initialized because they were accessed.
+	uint64_t demandPages = 0;
+	// Pages that were initialized by readahead before they were accessed.
+	uint64_t readaheadPages = 0;
+	uint64_t numWindows = 0;
+};
+
+// Maximal size (and alignment) of cached windows of the page cache.
+constexpr size_t pageCacheWindowSize = 256 * 1024;
+
+// A long-lived mapping of a part of an inode's page cache. The pages of the window
+// stay locked (i.e., they are neither evicted nor unmapped) while it is cached.
+struct CachedWindow {
+	Inode *inode;
+	// Detects windows of inodes that were destroyed.
+	std::weak_ptr<Inode> owner;
+	uint64_t offset;
+	size_t size;
+	helix::UniqueDescriptor lock;
+	helix::Mapping mapping;
+
+	// Returns a pointer to the data at the given offset of the file.
+	const char *at(uint64_t file_offset) {
+		assert(file_offset >= offset && file_offset < offset + size);
+		return reinterpret_cast<const char *>(mapping.get()) + (file_offset - offset);
+	}
+};
+
+// Node on the path from the root of an extent tree to a leaf.
+struct ExtentPathNode {
+	// Block that contains the node; zero for the root (which is part of the inode).
+	uint64_t block;
+	std::shared_ptr<std::vector<uint8_t>> buffer;
+	// Entry that the path follows (only for index nodes).
+	size_t entry;
+};
+
 struct FileSystem {
 	FileSystem(BlockDevice *device);
 
-	async::result<void> init();
+	// Returns false if the file system cannot be mounted.
+	async::result<bool> init();
+
+	// Returns false (and complains) if the file system is mounted read-only.
+	bool checkWritable(const char *operation);
 
 	async::detached manageBlockBitmap(helix::UniqueDescriptor memory);
 	async::detached manageInodeBitmap(helix::UniqueDescriptor memory);
@@ -258,6 +392,10 @@ struct FileSystem {
 
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
 	async::detached manageFileData(std::shared_ptr<Inode> inode);
+	async::detached initializeFileData(std::shared_ptr<Inode> inode,
+			uint64_t offset, size_t length);
+	void updateReadahead(Inode *inode, uint64_t offset, size_t length);
+	void dumpReadaheadStats();
 	async::detached manageIndirect(std::shared_ptr<Inode> inode, int order,
 			helix::UniqueDescriptor memory);
 
@@ -266,6 +404,31 @@ struct FileSystem {
 
 	async::result<void> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
+	async::result<void> assignExtentBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+
+	// Maps a run of data blocks to disk blocks. Returns the first disk block
+	// and the length of the run (which does not exceed the given number of blocks).
+	// Holes (and uninitialized extents) are returned as runs that start at block zero.
+	async::result<std::pair<uint64_t, size_t>> mapBlocks(Inode *inode,
+			uint64_t index, size_t remaining);
+	async::result<std::pair<uint64_t, size_t>> mapIndirectBlocks(Inode *inode,
+			uint64_t index, size_t remaining);
+	async::result<std::pair<uint64_t, size_t>> mapExtentBlocks(Inode *inode,
+			uint64_t index, size_t remaining);
+
+	// The following functions expect that the caller holds the inode's extentMutex.
+	async::result<std::vector<ExtentPathNode>> lookupExtentPath(Inode *inode, uint64_t index);
+	async::result<std::shared_ptr<std::vector<uint8_t>>> readExtentNode(Inode *inode,
+			uint64_t block);
+	ExtentHeader *accessExtentNode(Inode *inode, ExtentPathNode &node);
+	void markExtentNode(Inode *inode, ExtentPathNode &node);
+	async::result<void> insertExtent(Inode *inode, Extent extent);
+	async::result<void> splitExtentNode(Inode *inode, std::vector<ExtentPathNode> &path,
+			size_t level);
+	async::result<void> initializeExtent(Inode *inode, std::vector<ExtentPathNode> &path,
+			size_t k, uint64_t index, size_t count);
+	async::result<void> flushExtentNodes(Inode *inode);
 
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
@@ -274,6 +437,12 @@ struct FileSystem {
 
 	async::result<void> truncate(Inode *inode, size_t size);
 
+	// Returns a window of the page cache that covers the given range.
+	// The range must not cross a multiple of the window size (which is a multiple of
+	// the block size). The window stays mapped as long as the caller holds a reference.
+	async::result<std::shared_ptr<CachedWindow>> accessPageCache(std::shared_ptr<Inode> inode,
+			uint64_t offset, size_t length);
+
 	BlockDevice *device;
 	uint16_t inodeSize;
 	uint32_t blockShift;
@@ -283,13 +452,28 @@ struct FileSystem {
 	uint32_t numBlockGroups;
 	uint32_t blocksPerGroup;
 	uint32_t inodesPerGroup;
+	uint32_t groupDescSize;
 	void *blockGroupDescriptorBuffer;
 
+	// Set if the file system uses features that we cannot keep consistent on writes
+	// (e.g., metadata checksums).
+	bool readOnly = false;
+
+	DiskGroupDesc *groupDescriptor(uint32_t bg_idx) {
+		return reinterpret_cast<DiskGroupDesc *>(
+				reinterpret_cast<char *>(blockGroupDescriptorBuffer) + bg_idx * groupDescSize);
+	}
+
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
 	helix::UniqueDescriptor inodeTable;
 
 	std::unordered_map<uint32_t, std::weak_ptr<Inode>> activeInodes;
+
+	ReadaheadStats readaheadStats;
+
+	// Most recently used windows come first.
+	std::list<std::shared_ptr<CachedWindow>> cachedWindows;
 };
 
 // --------------------------------------------------------
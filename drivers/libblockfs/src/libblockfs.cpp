@@ -11,6 +11,7 @@
 #include <blockfs.hpp>
 #include "gpt.hpp"
 #include "ext2fs.hpp"
+#include "request_queue.hpp"
 #include "fs.pb.h"
 
 namespace blockfs {
@@ -51,6 +52,21 @@ async::result<protocols::fs::Error> flock(void *object, int flags) {
 	co_return result;
 }
 
+// Copies from cached mappings of the page cache; if the windows are resident,
+// this does not map or unmap any memory.
+async::result<void> copyFromPageCache(std::shared_ptr<ext2fs::Inode> inode,
+		uint64_t offset, void *buffer, size_t length) {
+	size_t progress = 0;
+	while(progress < length) {
+		auto window_end = ((offset + progress) | (ext2fs::pageCacheWindowSize - 1)) + 1;
+		auto piece = std::min(length - progress, window_end - (offset + progress));
+		auto window = co_await inode->fs.accessPageCache(inode, offset + progress, piece);
+		memcpy(reinterpret_cast<char *>(buffer) + progress, window->at(offset + progress),
+				piece);
+		progress += piece;
+	}
+}
+
 async::result<protocols::fs::ReadResult> read(void *object, const char *,
 		void *buffer, size_t length) {
 	assert(length);
@@ -65,24 +81,39 @@ async::result<protocols::fs::ReadResult> read(void *object, const char *,
 		co_return 0; // TODO: Return an explicit end-of-file error?
 
 	auto chunk_offset = self->offset;
-	auto map_offset = chunk_offset & ~size_t(0xFFF);
-	auto map_size = (((chunk_offset & size_t(0xFFF)) + chunk_size + 0xFFF) & ~size_t(0xFFF));
 	self->offset += chunk_size;
 
-	helix::LockMemoryView lock_memory;
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(self->inode->frontalMemory),
-			&lock_memory, map_offset, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	co_await copyFromPageCache(self->inode, chunk_offset, buffer, chunk_size);
+	co_return chunk_size;
+}
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{self->inode->frontalMemory},
-			static_cast<ptrdiff_t>(map_offset), map_size,
-			kHelMapProtRead | kHelMapDontRequireBacking};
+async::result<protocols::fs::ReadViewResult> readView(void *object, const char *,
+		size_t length) {
+	assert(length);
 
-	memcpy(buffer, reinterpret_cast<char *>(file_map.get()) + (chunk_offset - map_offset),
-			chunk_size);
-	co_return chunk_size;
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.async_wait();
+
+	assert(self->offset <= self->inode->fileSize());
+	auto remaining = self->inode->fileSize() - self->offset;
+	auto chunk_size = std::min(length, remaining);
+	if(!chunk_size)
+		co_return protocols::fs::ReadView{nullptr, 0, nullptr};
+
+	auto chunk_offset = self->offset;
+	self->offset += chunk_size;
+
+	// If the range is inside a single window, the data is sent from the page cache directly.
+	auto window_end = (chunk_offset | (ext2fs::pageCacheWindowSize - 1)) + 1;
+	if(chunk_offset + chunk_size <= window_end) {
+		auto window = co_await self->inode->fs.accessPageCache(self->inode,
+				chunk_offset, chunk_size);
+		co_return protocols::fs::ReadView{window->at(chunk_offset), chunk_size, window};
+	}
+
+	std::shared_ptr<char[]> buffer{new char[chunk_size]};
+	co_await copyFromPageCache(self->inode, chunk_offset, buffer.get(), chunk_size);
+	co_return protocols::fs::ReadView{buffer.get(), chunk_size, buffer};
 }
 
 async::result<void> write(void *object, const char *,
@@ -119,6 +150,7 @@ constexpr protocols::fs::FileOperations fileOperations {
 	.seekRel      = &seekRel,
 	.seekEof      = &seekEof,
 	.read         = &read,
+	.readView     = &readView,
 	.write        = &write,
 	.flock        = &flock,
 	.readEntries  = &readEntries,
@@ -296,6 +328,17 @@ async::detached servePartition(helix::UniqueLane lane) {
 			helix::PushDescriptor push_node;
 
 			auto inode = co_await fs->createRegular();
+			if(!inode) {
+				managarm::fs::SvrResponse resp;
+				resp.set_error(managarm::fs::Errors::ILLEGAL_REQUEST);
+
+				auto ser = resp.SerializeAsString();
+				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+						helix::action(&send_resp, ser.data(), ser.size()));
+				co_await transmit.async_wait();
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
 
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
@@ -321,7 +364,7 @@ async::detached servePartition(helix::UniqueLane lane) {
 }
 
 async::detached runDevice(BlockDevice *device) {
-	table = new gpt::Table(device);
+	table = new gpt::Table(new RequestQueue{device});
 	co_await table->parse();
 
 	for(size_t i = 0; i < table->numPartitions(); ++i) {
@@ -335,7 +378,8 @@ async::detached runDevice(BlockDevice *device) {
 		printf("It's a Windows data partition!\n");
 
 		fs = new ext2fs::FileSystem(&table->getPartition(i));
-		co_await fs->init();
+		if(!(co_await fs->init()))
+			continue;
 		printf("ext2fs is ready!\n");
 
 		// Create an mbus object for the partition.
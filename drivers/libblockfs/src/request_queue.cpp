@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "request_queue.hpp"
+
+namespace blockfs {
+
+namespace {
+	// Print the statistics after every logStatsInterval requests.
+	constexpr bool logStats = false;
+	constexpr uint64_t logStatsInterval = 1024;
+
+	// Upper bound on the size of a merged request.
+	constexpr size_t maxMergeSize = 128 * 1024;
+
+	// Upper bound on the number of in-flight requests, regardless of the device's
+	// queue depth. Virtio-blk and NVMe report depths in the hundreds; if we dispatched
+	// up to that many requests, requests would never be pending and thus never merged
+	// or sorted. This is still enough to saturate the device.
+	constexpr size_t maxInFlight = 16;
+
+	uint64_t currentTime() {
+		uint64_t tick;
+		HEL_CHECK(helGetClock(&tick));
+		return tick;
+	}
+}
+
+RequestQueue::RequestQueue(BlockDevice *device)
+: BlockDevice{device->sectorSize}, _device{device} {
+	queueDepth = device->queueDepth;
+	rotational = device->rotational;
+	assert(queueDepth);
+	_maxInFlight = std::min(queueDepth, maxInFlight);
+}
+
+async::result<void> RequestQueue::readSectors(uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	co_await _submit(false, sector, reinterpret_cast<char *>(buffer), num_sectors);
+}
+
+async::result<void> RequestQueue::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _submit(true, sector,
+			const_cast<char *>(reinterpret_cast<const char *>(buffer)), num_sectors);
+}
+
+void RequestQueue::dumpStats() {
+	std::cout << "libblockfs: " << _stats.numRequests << " requests in "
+			<< _stats.numDispatches << " dispatches, "
+			<< _stats.numMerges << " merges (" << _stats.numBounced << " bounced), peak "
+			<< _stats.peakPending << " pending / " << _stats.peakInFlight << " in flight"
+			<< std::endl;
+
+	std::cout << "libblockfs: Latency histogram (us):";
+	for(size_t i = 0; i < numLatencyBuckets; i++)
+		if(_stats.latencyHistogram[i])
+			std::cout << " " << (uint64_t{1} << i) << ": " << _stats.latencyHistogram[i];
+	std::cout << std::endl;
+}
+
+async::result<void> RequestQueue::_submit(bool write, uint64_t sector, char *buffer,
+		size_t num_sectors) {
+	Request request;
+	request.write = write;
+	request.sector = sector;
+	request.buffer = buffer;
+	request.numSectors = num_sectors;
+	request.submitTime = currentTime();
+
+	_stats.numRequests++;
+	_pending.push_back(&request);
+	_stats.peakPending = std::max(_stats.peakPending, _pending.size());
+	_dispatchPending();
+
+	co_await request.promise.async_get();
+
+	if(logStats && !(_stats.numRequests % logStatsInterval))
+		dumpStats();
+}
+
+void RequestQueue::_dispatchPending() {
+	while(!_pending.empty() && _inFlight < _maxInFlight) {
+		_inFlight++;
+		_stats.peakInFlight = std::max(_stats.peakInFlight, _inFlight);
+		_dispatch(_takeBatch());
+	}
+}
+
+std::vector<RequestQueue::Request *> RequestQueue::_takeBatch() {
+	assert(!_pending.empty());
+
+	// Requests are small in number; linear scans are cheaper than maintaining an index.
+	auto it = _pending.begin();
+	if(rotational) {
+		// Continue with the lowest sector after the head; wrap around if there is none.
+		auto lowest = _pending.begin();
+		auto next = _pending.end();
+		for(auto jt = _pending.begin(); jt != _pending.end(); ++jt) {
+			if((*jt)->sector < (*lowest)->sector)
+				lowest = jt;
+			if((*jt)->sector >= _headSector
+					&& (next == _pending.end() || (*jt)->sector < (*next)->sector))
+				next = jt;
+		}
+		it = (next != _pending.end()) ? next : lowest;
+	}
+
+	std::vector<Request *> batch{*it};
+	_pending.erase(it);
+
+	// Merge requests that extend the batch in either direction.
+	auto max_sectors = std::max(size_t{1}, maxMergeSize / sectorSize);
+	auto start = batch.front()->sector;
+	auto end = start + batch.front()->numSectors;
+	bool merged = true;
+	while(merged) {
+		merged = false;
+		for(auto jt = _pending.begin(); jt != _pending.end(); ++jt) {
+			auto request = *jt;
+			if(request->write != batch.front()->write)
+				continue;
+			if(end - start + request->numSectors > max_sectors)
+				continue;
+
+			if(request->sector == end) {
+				batch.push_back(request);
+				end += request->numSectors;
+			}else if(request->sector + request->numSectors == start) {
+				batch.insert(batch.begin(), request);
+				start = request->sector;
+			}else{
+				continue;
+			}
+			_stats.numMerges++;
+			_pending.erase(jt);
+			merged = true;
+			break;
+		}
+	}
+
+	_headSector = end;
+	return batch;
+}
+
+async::detached RequestQueue::_dispatch(std::vector<Request *> batch) {
+	auto write = batch.front()->write;
+	auto sector = batch.front()->sector;
+	size_t num_sectors = 0;
+	for(auto request : batch)
+		num_sectors += request->numSectors;
+
+	// If the buffers happen to be contiguous, the device can access them directly.
+	bool contiguous = true;
+	for(size_t i = 1; i < batch.size(); i++)
+		if(batch[i]->buffer != batch[i - 1]->buffer + batch[i - 1]->numSectors * sectorSize)
+			contiguous = false;
+
+	_stats.numDispatches++;
+	if(contiguous) {
+		if(write) {
+			co_await _device->writeSectors(sector, batch.front()->buffer, num_sectors);
+		}else{
+			co_await _device->readSectors(sector, batch.front()->buffer, num_sectors);
+		}
+	}else{
+		_stats.numBounced += batch.size();
+
+		// Touch bounce buffers once such that they are backed by physical memory.
+		char *bounce;
+		if(_bounceBuffers.empty()) {
+			bounce = static_cast<char *>(operator new(maxMergeSize, std::align_val_t{0x1000}));
+			memset(bounce, 0, maxMergeSize);
+		}else{
+			bounce = _bounceBuffers.back();
+			_bounceBuffers.pop_back();
+		}
+
+		if(write) {
+			size_t offset = 0;
+			for(auto request : batch) {
+				memcpy(bounce + offset, request->buffer, request->numSectors * sectorSize);
+				offset += request->numSectors * sectorSize;
+			}
+			co_await _device->writeSectors(sector, bounce, num_sectors);
+		}else{
+			co_await _device->readSectors(sector, bounce, num_sectors);
+			size_t offset = 0;
+			for(auto request : batch) {
+				memcpy(request->buffer, bounce + offset, request->numSectors * sectorSize);
+				offset += request->numSectors * sectorSize;
+			}
+		}
+		_bounceBuffers.push_back(bounce);
+	}
+
+	auto now = currentTime();
+	for(auto request : batch) {
+		auto micros = (now - request->submitTime) / 1000;
+		size_t bucket = 0;
+		while(bucket + 1 < numLatencyBuckets && (micros >> (bucket + 1)))
+			bucket++;
+		_stats.latencyHistogram[bucket]++;
+	}
+
+	// Keep the device busy before resuming the requesters.
+	_inFlight--;
+	_dispatchPending();
+	for(auto request : batch)
+		request->promise.set_value();
+}
+
+} // namespace blockfs
@@ -0,0 +1,86 @@
+#ifndef LIBFS_REQUEST_QUEUE_HPP
+#define LIBFS_REQUEST_QUEUE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+
+// Bucket i counts requests that completed within [2^i, 2^(i+1)) microseconds.
+constexpr size_t numLatencyBuckets = 24;
+
+struct RequestQueueStats {
+	uint64_t numRequests = 0;
+	// Number of device operations; this is lower than numRequests if requests were merged.
+	uint64_t numDispatches = 0;
+	uint64_t numMerges = 0;
+	// Merged requests whose buffers were not contiguous and had to be copied.
+	uint64_t numBounced = 0;
+
+	// Highest number of pending and in-flight requests.
+	size_t peakPending = 0;
+	size_t peakInFlight = 0;
+
+	uint64_t latencyHistogram[numLatencyBuckets] = {};
+};
+
+// Block layer between the file system and the device driver. Queues concurrent requests,
+// merges requests for adjacent sectors and dispatches a limited number of
+// requests at a time (see maxInFlight). For rotational devices, requests are dispatched in
+// ascending sector order (C-LOOK); otherwise, they are dispatched in FIFO order.
+struct RequestQueue : BlockDevice {
+	RequestQueue(BlockDevice *device);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	const RequestQueueStats &stats() {
+		return _stats;
+	}
+
+	void dumpStats();
+
+private:
+	struct Request {
+		bool write;
+		uint64_t sector;
+		char *buffer;
+		size_t numSectors;
+		uint64_t submitTime;
+		async::promise<void> promise;
+	};
+
+	async::result<void> _submit(bool write, uint64_t sector, char *buffer,
+			size_t num_sectors);
+
+	// Dispatches pending requests as long as fewer than _maxInFlight are in flight.
+	void _dispatchPending();
+
+	// Removes the next request from _pending and merges adjacent requests into it.
+	std::vector<Request *> _takeBatch();
+
+	async::detached _dispatch(std::vector<Request *> batch);
+
+	BlockDevice *_device;
+	std::vector<Request *> _pending;
+	size_t _inFlight = 0;
+	size_t _maxInFlight;
+
+	// Position of the elevator (i.e., the end of the last dispatched request).
+	uint64_t _headSector = 0;
+
+	// Buffers for merged requests. Allocated on first use and kept afterwards.
+	std::vector<char *> _bounceBuffers;
+
+	RequestQueueStats _stats;
+};
+
+} // namespace blockfs
+
+#endif // LIBFS_REQUEST_QUEUE_HPP
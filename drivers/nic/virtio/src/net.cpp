@@ -27,7 +27,7 @@ Device::Device(std::unique_ptr<virtio_core::Transport> transport)
 : _transport{std::move(transport)},
 		_receiveVq{nullptr}, _transmitVq{nullptr} { }
 
-void Device::runDevice() {
+async::detached Device::runDevice() {
 	uint8_t mac[6];
 	if(_transport->checkDeviceFeature(VIRTIO_NET_F_MAC)) {
 		for (int i = 0; i < 6; i++)
@@ -41,7 +41,7 @@ void Device::runDevice() {
 	}
 
 	_transport->finalizeFeatures();
-	_transport->claimQueues(2);
+	co_await _transport->claimQueues(2);
 	_receiveVq = _transport->setupQueue(0);
 	_transmitVq = _transport->setupQueue(1);
 
@@ -62,12 +62,25 @@ async::result<void> Device::sendPacket(const std::vector<std::byte> &payload) {
 	memset(header.data(), 0, sizeof(VirtHeader));
 	memcpy(packet.data(), payload.data(), payload.size());
 
+	// With indirect descriptors, each packet only occupies a single descriptor of the virtq.
 	virtio_core::Chain chain;
-	chain.append(co_await _transmitVq->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await _transmitVq->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, packet);
+	if(_transmitVq->supportsIndirect()) {
+		chain.setupIndirect(co_await _transmitVq->obtainDescriptor(), 2);
+		chain.appendIndirect();
+		chain.setupBuffer(virtio_core::hostToDevice,
+				header.view_buffer().subview(0, legacyHeaderSize));
+		chain.appendIndirect();
+		chain.setupBuffer(virtio_core::hostToDevice, packet);
+	}else{
+		virtio_core::Handle handles[2];
+		co_await _transmitVq->obtainDescriptors(handles, 2);
+
+		chain.append(handles[0]);
+		chain.setupBuffer(virtio_core::hostToDevice,
+				header.view_buffer().subview(0, legacyHeaderSize));
+		chain.append(handles[1]);
+		chain.setupBuffer(virtio_core::hostToDevice, packet);
+	}
 
 	std::cout << "nic-virtio: Preparing to send" << std::endl;
 	co_await _transmitVq->submitDescriptor(chain.front());
@@ -75,22 +88,50 @@ async::result<void> Device::sendPacket(const std::vector<std::byte> &payload) {
 }
 
 async::detached Device::_processReceive() {
+	// Each receive buffer consists of a header and a packet descriptor.
+	auto max_buffers = _receiveVq->numDescriptors() / 2;
+	size_t num_posted = 0;
 	while(true) {
-		arch::dma_object<VirtHeader> header{&_dmaPool};
-		arch::dma_buffer packet{&_dmaPool, 1514};
+		// Refill the receive virtq. All buffers are published at once
+		// such that the device is only notified once per refill.
+		while(num_posted < max_buffers) {
+			auto request = new ReceiveRequest{this, &_dmaPool};
+
+			virtio_core::Handle handles[2];
+			co_await _receiveVq->obtainDescriptors(handles, 2);
+
+			virtio_core::Chain chain;
+			chain.append(handles[0]);
+			chain.setupBuffer(virtio_core::deviceToHost,
+					request->header.view_buffer().subview(0, legacyHeaderSize));
+			chain.append(handles[1]);
+			chain.setupBuffer(virtio_core::deviceToHost, request->packet);
+
+			_receiveVq->stageDescriptor(chain.front(), request,
+					[] (virtio_core::Request *base_request) {
+				auto request = static_cast<ReceiveRequest *>(base_request);
+				request->device->_receivedQueue.push(request);
+				request->device->_receivedDoorbell.ring();
+			});
+			num_posted++;
+		}
+		_receiveVq->publishDescriptors();
+		_receiveVq->notify();
 
-		virtio_core::Chain chain;
-		chain.append(co_await _receiveVq->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost,
-				header.view_buffer().subview(0, legacyHeaderSize));
-		chain.append(co_await _receiveVq->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, packet);
+		if(_receivedQueue.empty()) {
+			co_await _receivedDoorbell.async_wait();
+			continue;
+		}
 
-		std::cout << "nic-virtio: Preparing to receive" << std::endl;
-		co_await _receiveVq->submitDescriptor(chain.front());
-		std::cout << "nic-virtio: Received packet" << std::endl;
+		while(!_receivedQueue.empty()) {
+			auto request = _receivedQueue.front();
+			_receivedQueue.pop();
+			num_posted--;
 
-		recvEthernetPacket(this, packet);
+			std::cout << "nic-virtio: Received packet" << std::endl;
+			recvEthernetPacket(this, request->packet);
+			delete request;
+		}
 	}
 }
 
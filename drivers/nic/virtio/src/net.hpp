@@ -45,6 +45,22 @@ static constexpr size_t legacyHeaderSize = 10;
 static constexpr size_t multiBuffersHeaderSize = 12;
 static_assert(sizeof(VirtHeader) == multiBuffersHeaderSize);
 
+struct Device;
+
+// --------------------------------------------------------
+// ReceiveRequest
+// --------------------------------------------------------
+
+// Buffer that is posted to the receive virtq.
+struct ReceiveRequest : virtio_core::Request {
+	ReceiveRequest(Device *device_, arch::dma_pool *pool)
+	: device{device_}, header{pool}, packet{pool, 1514} { }
+
+	Device *device;
+	arch::dma_object<VirtHeader> header;
+	arch::dma_buffer packet;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
@@ -52,7 +68,7 @@ static_assert(sizeof(VirtHeader) == multiBuffersHeaderSize);
 struct Device {
 	Device(std::unique_ptr<virtio_core::Transport> transport);
 
-	void runDevice();
+	async::detached runDevice();
 
 	async::result<void> sendPacket(const std::vector<std::byte> &payload);
 
@@ -67,6 +83,10 @@ private:
 	// The receive/transmit queues of this device.
 	virtio_core::Queue *_receiveVq;
 	virtio_core::Queue *_transmitVq;
+
+	// Receive buffers that were filled by the device but not processed yet.
+	std::queue<ReceiveRequest *> _receivedQueue;
+	async::doorbell _receivedDoorbell;
 };
 
 } } // namespace nic::virtio
@@ -571,8 +571,9 @@ async::detached Controller::_refreshFrame() {
 		HEL_CHECK(helGetClock(&tick));
 
 		helix::AwaitClock await_clock;
+		// The frame refresh is not time-critical; let the kernel coalesce it.
 		auto &&submit = helix::submitAwaitClock(&await_clock, tick + 500'000'000,
-				helix::Dispatcher::global());
+				50'000'000, helix::Dispatcher::global());
 		co_await submit.async_wait();
 		HEL_CHECK(await_clock.error());
 	}
@@ -16,6 +16,10 @@ enum {
 };
 
 enum {
+	// Normal features, ECX register
+	kCpuFlagX2Apic = (1 << 21),
+	kCpuFlagTscDeadline = (1 << 24),
+
 	// Normal features, EDX register
 	kCpuFlagPat = (1 << 16),
 
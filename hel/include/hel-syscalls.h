@@ -56,9 +56,9 @@ extern inline __attribute__ (( always_inline )) HelError helCreateQueue(HelQueue
 };
 
 extern inline __attribute__ (( always_inline )) HelError helSetupChunk(HelHandle queue,
-		int index, HelChunk *chunk, uint32_t flags) {
-	return helSyscall4(kHelCallSetupChunk, (HelWord)queue, (HelWord)index,
-			(HelWord)chunk, (HelWord)flags);
+		int index, HelChunk *chunk, size_t size, uint32_t flags) {
+	return helSyscall5(kHelCallSetupChunk, (HelWord)queue, (HelWord)index,
+			(HelWord)chunk, (HelWord)size, (HelWord)flags);
 };
 
 extern inline __attribute__ (( always_inline )) HelError helCancelAsync(HelHandle handle,
@@ -272,7 +272,41 @@ extern inline __attribute__ (( always_inline )) HelError helWriteFsBase(void *po
 	return helSyscall1(kHelCallWriteFsBase, (HelWord)pointer);
 };
 
+//! Computes the value of helGetClock() from the clock page without entering the kernel.
+//! Returns zero if the kernel did not publish TSC parameters.
+extern inline __attribute__ (( always_inline )) int helReadClockPage(uint64_t *counter) {
+	const struct HelClockPage *page = (const struct HelClockPage *)kHelClockPageAddress;
+
+	while(1) {
+		uint64_t seq = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seq & 1)
+			continue; // The kernel is currently updating the page.
+		if(!(__atomic_load_n(&page->flags, __ATOMIC_RELAXED) & kHelClockPageTsc))
+			return 0;
+
+		uint64_t ref_tsc = __atomic_load_n(&page->refTsc, __ATOMIC_RELAXED);
+		uint64_t ref_nanos = __atomic_load_n(&page->refNanos, __ATOMIC_RELAXED);
+		uint64_t multiplier = __atomic_load_n(&page->tscMultiplier, __ATOMIC_RELAXED);
+		uint32_t shift = __atomic_load_n(&page->tscShift, __ATOMIC_RELAXED);
+
+		uint32_t lsw, msw;
+		asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+		uint64_t tsc = ((uint64_t)msw << 32) | lsw;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		*counter = ref_nanos
+				+ (uint64_t)(((unsigned __int128)(tsc - ref_tsc) * multiplier) >> shift);
+		return 1;
+	}
+}
+
 extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *counter) {
+	if(helReadClockPage(counter))
+		return kHelErrNone;
+
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallGetClock, &handle_word);
 	*counter = (uint64_t)handle_word;
@@ -280,10 +314,10 @@ extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *c
 };
 
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uint64_t counter,
-		HelHandle queue, uintptr_t context, uint64_t *async_id) {
+		uint64_t slack, HelHandle queue, uintptr_t context, uint64_t *async_id) {
 	HelWord async_word;
-	HelError error = helSyscall3_1(kHelCallSubmitAwaitClock, (HelWord)counter, (HelWord)queue,
-			(HelWord)context, &async_word);
+	HelError error = helSyscall4_1(kHelCallSubmitAwaitClock, (HelWord)counter, (HelWord)slack,
+			(HelWord)queue, (HelWord)context, &async_word);
 	*async_id = (uint64_t)async_word;
 	return error;
 };
@@ -362,6 +396,17 @@ extern inline __attribute__ (( always_inline )) HelError helAutomateIrq(HelHandl
 			(HelWord)kernlet);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetIrqAffinity(HelHandle handle,
+		uint32_t flags, int cpu) {
+	return helSyscall3(kHelCallSetIrqAffinity, (HelWord)handle, (HelWord)flags,
+			(HelWord)cpu);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryIrqStats(HelHandle handle,
+		HelIrqStats *stats) {
+	return helSyscall2(kHelCallQueryIrqStats, (HelWord)handle, (HelWord)stats);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helAccessIo(uintptr_t *port_array,
 		size_t num_ports, HelHandle *handle) {
 	HelWord out_handle;
@@ -81,6 +81,8 @@ enum {
 	kHelCallAcknowledgeIrq = 81,
 	kHelCallSubmitAwaitEvent = 82,
 	kHelCallAutomateIrq = 94,
+	kHelCallSetIrqAffinity = 15,
+	kHelCallQueryIrqStats = 16,
 
 	kHelCallAccessIo = 11,
 	kHelCallEnableIo = 12,
@@ -305,6 +307,26 @@ struct HelElement {
 	void *context;
 };
 
+//! Address of the clock page. The kernel maps it (read-only) into every address space.
+static const uintptr_t kHelClockPageAddress = 0x7FFFFFFFF000;
+
+//! Set if the TSC parameters of the clock page are valid.
+//! Otherwise, user space has to call helGetClock().
+static const uint32_t kHelClockPageTsc = 1;
+
+//! Allows user space to compute the value of helGetClock() without entering the kernel:
+//! nanos = refNanos + (((rdtsc() - refTsc) * tscMultiplier) >> tscShift),
+//! where the multiplication is done in 128 bits.
+//! Readers must retry if seqlock is odd or changes during the read.
+struct HelClockPage {
+	uint64_t seqlock;
+	uint32_t flags;
+	uint32_t tscShift;
+	uint64_t tscMultiplier;
+	uint64_t refTsc;
+	uint64_t refNanos;
+};
+
 struct HelSimpleResult {
 	HelError error;
 	int reserved;
@@ -365,6 +387,33 @@ enum HelIrqFlags {
 	kHelIrqManualAcknowledge = 2
 };
 
+enum {
+	kHelIrqLatencyBuckets = 16
+};
+
+// Statistics of the IRQ that an IRQ handle is attached to.
+// Latency histograms use buckets of exponentially growing size: bucket 0 counts
+// latencies below 1us, bucket k counts latencies in [2^(k-1), 2^k) us.
+// The last bucket also counts all larger latencies.
+struct HelIrqStats {
+	uint64_t numRaises;
+	// Acks and nacks through helAcknowledgeIrq().
+	uint64_t numAcks;
+	uint64_t numNacks;
+	// Acks and nacks by kernlets (or by in-kernel drivers).
+	uint64_t numSyncAcks;
+	uint64_t numSyncNacks;
+	// Latency from the IRQ until completion of helSubmitAwaitEvent().
+	uint64_t deliveryLatency[kHelIrqLatencyBuckets];
+	// Latency from the IRQ until helAcknowledgeIrq().
+	uint64_t ackLatency[kHelIrqLatencyBuckets];
+};
+
+enum HelIrqAffinityFlags {
+	// Route the IRQ to the CPU of the calling thread.
+	kHelIrqAffinityThisCpu = 1
+};
+
 enum HelAckFlags {
 	kHelAckAcknowledge = 2,
 	kHelAckNack = 3,
@@ -405,7 +454,11 @@ HEL_C_LINKAGE HelError helCloseDescriptor(HelHandle handle);
 //!                Does not include the per-element HelElement header.
 HEL_C_LINKAGE HelError helCreateQueue(HelQueue *head, uint32_t flags,
 		unsigned int size_shift, size_t element_limit, HelHandle *handle);
-HEL_C_LINKAGE HelError helSetupChunk(HelHandle queue, int index, HelChunk *chunk, uint32_t flags);
+//! size:          Size of the chunk's buffer in bytes (excluding the HelChunk header).
+//!                Must be a multiple of 8 and must not exceed kHelProgressMask.
+//!                The queue only accepts elements that fit into its smallest chunk.
+HEL_C_LINKAGE HelError helSetupChunk(HelHandle queue, int index, HelChunk *chunk,
+		size_t size, uint32_t flags);
 HEL_C_LINKAGE HelError helCancelAsync(HelHandle queue, uint64_t async_id);
 
 HEL_C_LINKAGE HelError helAllocateMemory(size_t size, uint32_t flags,
@@ -454,7 +507,7 @@ HEL_C_LINKAGE HelError helLoadRegisters(HelHandle handle, int set, void *image);
 HEL_C_LINKAGE HelError helStoreRegisters(HelHandle handle, int set, const void *image);
 HEL_C_LINKAGE HelError helWriteFsBase(void *pointer);
 HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
-HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter,
+HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter, uint64_t slack,
 		HelHandle queue, uintptr_t context, uint64_t *async_id);
 HEL_C_LINKAGE HelError helCreateVirtualizedCpu(HelHandle handle, HelHandle *out_handle);
 HEL_C_LINKAGE HelError helRunVirtualizedCpu(HelHandle handle, HelVmexitReason *reason);
@@ -475,6 +528,8 @@ HEL_C_LINKAGE HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint6
 HEL_C_LINKAGE HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 		HelHandle queue, uintptr_t context);
 HEL_C_LINKAGE HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet);
+HEL_C_LINKAGE HelError helSetIrqAffinity(HelHandle handle, uint32_t flags, int cpu);
+HEL_C_LINKAGE HelError helQueryIrqStats(HelHandle handle, HelIrqStats *stats);
 
 HEL_C_LINKAGE HelError helAccessIo(uintptr_t *port_array, size_t num_ports,
 		HelHandle *handle);
@@ -245,6 +245,10 @@ private:
 public:
 	static constexpr int sizeShift = 9;
 
+	// Size of each chunk's buffer. Larger chunks mean that the kernel can
+	// deliver more completions before we need to requeue the chunk.
+	static constexpr size_t chunkSize = 0x4000;
+
 	static Dispatcher &global();
 
 	Dispatcher()
@@ -274,37 +278,13 @@ public:
 					std::cerr << "\e[35mhelix: Queue is forced to grow to " << _activeChunks
 							<< " chunks (memory leak?)\e[39m" << std::endl;
 
-				auto chunk = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + 4096));
-				_chunks[_activeChunks] = chunk;
-				HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, 0));
-				
-				// Reset and enqueue the new chunk.
-				chunk->progressFutex = 0;
-
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
-				
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
+				_allocateChunk();
 				continue;
 			}else if (_hadWaiters && _activeChunks < (1 << sizeShift)) {
 //				std::cerr << "\e[35mhelix: Growing queue to " << _activeChunks
 //						<< " chunks to improve throughput\e[39m" << std::endl;
 
-				auto chunk = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + 4096));
-				_chunks[_activeChunks] = chunk;
-				HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, 0));
-				
-				// Reset and enqueue the new chunk.
-				chunk->progressFutex = 0;
-
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
-				
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
+				_allocateChunk();
 				_hadWaiters = false;
 			}
 
@@ -332,6 +312,22 @@ public:
 	}
 
 private:
+	void _allocateChunk() {
+		auto chunk = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + chunkSize));
+		_chunks[_activeChunks] = chunk;
+		HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, chunkSize, 0));
+
+		// Reset and enqueue the new chunk.
+		chunk->progressFutex = 0;
+
+		_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
+		_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
+		_wakeHeadFutex();
+
+		_refCounts[_activeChunks] = 1;
+		_activeChunks++;
+	}
+
 	void _surrender(int cn) {
 		assert(_refCounts[cn] > 0);
 		if(_refCounts[cn]-- > 1)
@@ -702,9 +698,13 @@ private:
 struct Submission : private Context {
 	Submission(AwaitClock *operation,
 			uint64_t counter, Dispatcher &dispatcher)
+	: Submission(operation, counter, 0, dispatcher) { }
+
+	Submission(AwaitClock *operation,
+			uint64_t counter, uint64_t slack, Dispatcher &dispatcher)
 	: _result(operation) {
 		uint64_t async_id;
-		HEL_CHECK(helSubmitAwaitClock(counter, dispatcher.acquire(),
+		HEL_CHECK(helSubmitAwaitClock(counter, slack, dispatcher.acquire(),
 				reinterpret_cast<uintptr_t>(context()), &async_id));
 		operation->setAsyncId(async_id);
 	}
@@ -895,6 +895,12 @@ inline Submission submitAwaitClock(AwaitClock *operation, uint64_t counter,
 	return {operation, counter, dispatcher};
 }
 
+// The kernel may delay completion by up to slack nanoseconds to coalesce timers.
+inline Submission submitAwaitClock(AwaitClock *operation, uint64_t counter,
+		uint64_t slack, Dispatcher &dispatcher) {
+	return {operation, counter, slack, dispatcher};
+}
+
 inline Submission submitProtectMemory(BorrowedDescriptor memory, ProtectMemory *operation,
 		void *pointer, size_t length, uint32_t flags,
 		Dispatcher &dispatcher) {
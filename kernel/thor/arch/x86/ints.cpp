@@ -451,6 +451,9 @@ extern "C" void onPlatformPing(IrqImageAccessor image) {
 
 	acknowledgeIpi();
 
+	// Another CPU might have re-armed the alarm of our timer engine.
+	LocalApicContext::updateLocalTimer();
+
 	handlePreemption(image);
 }
 
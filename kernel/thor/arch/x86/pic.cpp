@@ -4,6 +4,7 @@
 #include <arch/mem_space.hpp>
 #include <arch/io_space.hpp>
 
+#include "generic/clock-page.hpp"
 #include "generic/fiber.hpp"
 #include "generic/kernel.hpp"
 #include "generic/irq.hpp"
@@ -49,8 +50,68 @@ arch::field<uint32_t, uint8_t> apicIcrHighDestField(24, 8);
 arch::field<uint32_t, uint8_t> apicLvtVector(0, 8);
 arch::field<uint32_t, bool> apicLvtMask(16, 1);
 arch::field<uint32_t, uint8_t> apicLvtMode(8, 3);
+arch::field<uint32_t, uint8_t> apicLvtTimerMode(17, 2);
+
+constexpr uint32_t apicTimerModeTscDeadline = 2;
+
+// IA32_APIC_BASE bits.
+constexpr uint64_t apicBaseX2ApicEnable = uint64_t(1) << 10;
+
+constexpr uint32_t kMsrTscDeadline = 0x6E0;
+// In x2APIC mode, the register at MMIO offset n is accessed through MSR x2ApicMsrBase + n / 16.
+constexpr uint32_t x2ApicMsrBase = 0x800;
+// x2APIC replaces the ICR high/low pair by a single 64-bit MSR.
+constexpr uint32_t kMsrX2ApicIcr = 0x830;
+
+bool useX2Apic = false;
+bool useTscDeadline = false;
+
+// Accesses local APIC registers either through MMIO (xAPIC mode) or MSRs (x2APIC mode).
+// Provides the same interface as arch::mem_space.
+struct LocalApicSpace {
+	template<typename RT>
+	void store(RT r, typename RT::rep_type value) const {
+		if(useX2Apic) {
+			frigg::arch_x86::wrmsr(x2ApicMsrBase + (r.offset() >> 4),
+					static_cast<typename RT::bits_type>(value));
+		}else{
+			mmio.store(r, value);
+		}
+	}
+
+	template<typename RT>
+	typename RT::rep_type load(RT r) const {
+		if(useX2Apic) {
+			auto b = static_cast<typename RT::bits_type>(
+					frigg::arch_x86::rdmsr(x2ApicMsrBase + (r.offset() >> 4)));
+			return static_cast<typename RT::rep_type>(b);
+		}else{
+			return mmio.load(r);
+		}
+	}
+
+	arch::mem_space mmio;
+};
+
+LocalApicSpace picBase;
 
-arch::mem_space picBase;
+// Sends an IPI. In xAPIC mode, this waits until the IPI is delivered.
+void sendIcr(uint32_t dest_apic_id, arch::bit_value<uint32_t> low) {
+	if(useX2Apic) {
+		// WRMSR to the ICR is not serializing; make sure that prior stores
+		// (e.g. shootdown requests) are visible to the receiver.
+		asm volatile ("mfence" : : : "memory");
+		frigg::arch_x86::wrmsr(kMsrX2ApicIcr, (static_cast<uint64_t>(dest_apic_id) << 32)
+				| static_cast<uint32_t>(low));
+		return;
+	}
+
+	picBase.store(lApicIcrHigh, apicIcrHighDestField(dest_apic_id));
+	picBase.store(lApicIcrLow, low);
+	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
+		// Wait for IPI delivery.
+	}
+}
 
 enum {
 	kModelLegacy = 1,
@@ -63,39 +124,53 @@ static int picModel = kModelLegacy;
 // Local APIC timer
 // --------------------------------------------------------
 
+extern ClockSource *globalClockSource;
+
 // TODO: APIC variables should be CPU-specific.
 uint32_t apicTicksPerMilli;
-namespace {
-	GlobalApicContext *globalApicContextInstance;
+uint64_t tscTicksPerMilli;
 
+// nanos = (ticks * tscMultiplier) >> tscShift. User space performs the same computation
+// using the clock page; hence, both sides must always agree on these values.
+constexpr uint32_t tscShift = 32;
+uint64_t tscMultiplier;
+
+// Inverse of TimeStampCounter::currentNanos(). Rounds up such that the
+// TSC value is never reached before the deadline.
+uint64_t nanosToTsc(uint64_t nanos) {
+	auto ticks = (static_cast<unsigned __int128>(nanos) << tscShift) / tscMultiplier + 1;
+	if(ticks > UINT64_MAX)
+		return UINT64_MAX;
+	return ticks;
+}
+namespace {
 	LocalApicContext *localApicContext() {
 		return &getCpuData()->apicContext;
 	}
 }
 
-GlobalApicContext *globalApicContext() {
-	return globalApicContextInstance;
-}
-
-void GlobalApicContext::GlobalAlarmSlot::arm(uint64_t nanos) {
-	assert(apicTicksPerMilli > 0);
+void LocalApicContext::AlarmSlot::arm(uint64_t nanos) {
+	assert(tscTicksPerMilli > 0);
 
-	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		auto lock = frigg::guard(&globalApicContext()->_mutex);
-		globalApicContext()->_globalDeadline = nanos;
+	// The engine of another CPU might be progressed on this CPU (e.g. if a timer
+	// is installed there). In that case, the owning CPU has to reprogram its timer.
+	_context->_alarmDeadline.store(nanos, std::memory_order_release);
+	if(_context == localApicContext()) {
+		LocalApicContext::updateLocalTimer();
+	}else{
+		sendPingIpi(_context->_apicId);
 	}
-	LocalApicContext::_updateLocalTimer();
 }
 
 LocalApicContext::LocalApicContext()
-: _preemptionDeadline{0}, _globalDeadline{0} { }
+: _apicId{0}, _preemptionDeadline{0}, _alarmDeadline{0},
+		_alarmInstance{this}, _timerEngine{nullptr} { }
 
 void LocalApicContext::setPreemption(uint64_t nanos) {
-	assert(apicTicksPerMilli > 0);
+	assert(tscTicksPerMilli > 0);
 	
 	localApicContext()->_preemptionDeadline = nanos;
-	LocalApicContext::_updateLocalTimer();
+	LocalApicContext::updateLocalTimer();
 }
 
 void LocalApicContext::handleTimerIrq() {
@@ -107,22 +182,20 @@ void LocalApicContext::handleTimerIrq() {
 	if(self->_preemptionDeadline && now > self->_preemptionDeadline)
 		self->_preemptionDeadline = 0;
 
-	if(self->_globalDeadline && now > self->_globalDeadline) {
-		self->_globalDeadline = 0;
-		globalApicContext()->_globalAlarmInstance.fireAlarm();
-
-		// Update the global deadline to avoid calling fireAlarm() on the next IRQ.
-		{
-			auto irq_lock = frigg::guard(&irqMutex());
-			auto lock = frigg::guard(&globalApicContext()->_mutex);
-			localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
-		}
-	}
+	// Clear the deadline before firing; fireAlarm() re-arms the slot if necessary.
+	auto deadline = self->_alarmDeadline.load(std::memory_order_acquire);
+	if(deadline && now > deadline
+			&& self->_alarmDeadline.compare_exchange_strong(deadline, 0,
+					std::memory_order_acq_rel))
+		self->_alarmInstance.fireAlarm();
 	
-	localApicContext()->_updateLocalTimer();
+	LocalApicContext::updateLocalTimer();
 }
 
-void LocalApicContext::_updateLocalTimer() {
+void LocalApicContext::updateLocalTimer() {
+	if(!tscTicksPerMilli)
+		return;
+
 	uint64_t deadline = 0;
 	auto consider = [&] (uint64_t dc) {
 		if(!dc)
@@ -131,15 +204,14 @@ void LocalApicContext::_updateLocalTimer() {
 			deadline = dc;
 	};
 
-	// Copy the global deadline so we can access it without locking.
-	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		auto lock = frigg::guard(&globalApicContext()->_mutex);
-		localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
-	}
-
 	consider(localApicContext()->_preemptionDeadline);
-	consider(localApicContext()->_globalDeadline);
+	consider(localApicContext()->_alarmDeadline.load(std::memory_order_acquire));
+
+	if(useTscDeadline) {
+		// Writing zero disarms the timer. Deadlines in the past trigger immediately.
+		frigg::arch_x86::wrmsr(kMsrTscDeadline, deadline ? nanosToTsc(deadline) : 0);
+		return;
+	}
 	
 	if(!deadline) {
 		picBase.store(lApicInitCount, 0);
@@ -176,10 +248,30 @@ void disarmPreemption() {
 // Local PIC management
 // --------------------------------------------------------
 
+namespace {
+	void enableX2Apic() {
+		auto msr = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrLocalApicBase);
+		if(!(msr & apicBaseX2ApicEnable))
+			frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrLocalApicBase,
+					msr | apicBaseX2ApicEnable);
+	}
+}
+
 void initLocalApicOnTheSystem() {
 	uint64_t msr = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrLocalApicBase);
 	assert(msr & (1 << 11)); // local APIC is enabled
 
+	auto features = frigg::arch_x86::cpuid(frigg::arch_x86::kCpuIndexFeatures)[2];
+	if(features & frigg::arch_x86::kCpuFlagX2Apic) {
+		frigg::infoLogger() << "thor: Using x2APIC mode" << frigg::endLog;
+		enableX2Apic();
+		useX2Apic = true;
+	}
+	if(features & frigg::arch_x86::kCpuFlagTscDeadline) {
+		frigg::infoLogger() << "thor: Using TSC-deadline timer" << frigg::endLog;
+		useTscDeadline = true;
+	}
+
 	// TODO: We really only need a single page.
 	auto register_ptr = KernelVirtualMemory::global().allocate(0x10000);
 	// TODO: Intel SDM specifies that we should mask out all
@@ -187,7 +279,7 @@ void initLocalApicOnTheSystem() {
 	// For now we just assume that they are zero.
 	KernelPageSpace::global().mapSingle4k(VirtualAddr(register_ptr), msr & ~PhysicalAddr{0xFFF},
 			page_access::write, CachingMode::null);
-	picBase = arch::mem_space(register_ptr);
+	picBase.mmio = arch::mem_space(register_ptr);
 
 	frigg::infoLogger() << "Booting on CPU #" << getLocalApicId() << frigg::endLog;
 }
@@ -202,6 +294,10 @@ void initLocalApicPerCpu() {
 				<< frigg::endLog;
 	};
 
+	// The boot CPU switches to x2APIC mode in initLocalApicOnTheSystem().
+	if(useX2Apic)
+		enableX2Apic();
+
 	// Enable the local APIC.
 	uint32_t spurious_vector = 0x81;
 	picBase.store(lApicSpurious, apicSpuriousVector(spurious_vector)
@@ -211,11 +307,32 @@ void initLocalApicPerCpu() {
 	dumpLocalInt(1);
 	
 	// Setup a timer interrupt for scheduling.
+	// On the boot CPU, this runs before calibrateApicTimer(). In TSC-deadline mode,
+	// the initial count register is ignored, hence, the calibration switches
+	// the boot CPU's timer to TSC-deadline mode itself.
 	uint32_t schedule_vector = 0xFF;
-	picBase.store(lApicLvtTimer, apicLvtVector(schedule_vector));
+	if(useTscDeadline && tscTicksPerMilli) {
+		picBase.store(lApicLvtTimer, apicLvtVector(schedule_vector)
+				| apicLvtTimerMode(apicTimerModeTscDeadline));
+		// Order the LVT write before subsequent writes to the deadline MSR.
+		asm volatile ("mfence" : : : "memory");
+	}else{
+		picBase.store(lApicLvtTimer, apicLvtVector(schedule_vector));
+	}
+
+	// Each CPU runs its own timer engine. The boot CPU initializes its engine
+	// in calibrateApicTimer() as the clock source is not available yet.
+	auto context = localApicContext();
+	context->_apicId = getLocalApicId();
+	if(globalClockSource)
+		context->_timerEngine = frigg::construct<PrecisionTimerEngine>(*kernelAlloc,
+				globalClockSource, &context->_alarmInstance);
 }
 
 uint32_t getLocalApicId() {
+	// The x2APIC ID register contains the full 32-bit ID.
+	if(useX2Apic)
+		return static_cast<uint32_t>(picBase.load(lApicId));
 	return picBase.load(lApicId) & apicId;
 }
 
@@ -230,11 +347,10 @@ uint64_t rdtsc() {
 			| static_cast<uint64_t>(lsw);
 }
 
-uint64_t tscTicksPerMilli;
-
 struct TimeStampCounter : ClockSource {
 	uint64_t currentNanos() override {
-		auto r = rdtsc() * 1'000'000 / tscTicksPerMilli;
+		// Use a 128-bit product; a 64-bit one would overflow after a few hours of uptime.
+		auto r = (static_cast<unsigned __int128>(rdtsc()) * tscMultiplier) >> tscShift;
 //		frigg::infoLogger() << r << frigg::endLog;
 		return r;
 	}
@@ -244,8 +360,6 @@ TimeStampCounter *globalTscInstance;
 
 extern ClockSource *hpetClockSource;
 extern AlarmTracker *hpetAlarmTracker;
-extern ClockSource *globalClockSource;
-extern PrecisionTimerEngine *globalTimerEngine;
 
 void calibrateApicTimer() {
 	const uint64_t millis = 100;
@@ -264,15 +378,23 @@ void calibrateApicTimer() {
 	auto tsc_elapsed = rdtsc() - tsc_start;
 	
 	tscTicksPerMilli = tsc_elapsed / millis;
+	tscMultiplier = (uint64_t{1'000'000} << tscShift) / tscTicksPerMilli;
 	frigg::infoLogger() << "thor: TSC ticks/ms: " << tscTicksPerMilli << frigg::endLog;
+	publishTscClock(0, 0, tscMultiplier, tscShift);
+
+	if(useTscDeadline) {
+		picBase.store(lApicLvtTimer, apicLvtVector(0xFF)
+				| apicLvtTimerMode(apicTimerModeTscDeadline));
+		asm volatile ("mfence" : : : "memory");
+	}
 
 	globalTscInstance = frigg::construct<TimeStampCounter>(*kernelAlloc);
-	globalApicContextInstance = frigg::construct<GlobalApicContext>(*kernelAlloc);
 
 	globalClockSource = globalTscInstance;
 //	globalClockSource = hpetClockSource;
-	globalTimerEngine = frigg::construct<PrecisionTimerEngine>(*kernelAlloc,
-			globalClockSource, globalApicContext()->globalAlarm());
+	auto context = localApicContext();
+	context->_timerEngine = frigg::construct<PrecisionTimerEngine>(*kernelAlloc,
+			globalClockSource, &context->_alarmInstance);
 //			globalClockSource, hpetAlarmTracker);
 }
 
@@ -281,64 +403,44 @@ void acknowledgeIpi() {
 }
 
 void raiseInitAssertIpi(uint32_t dest_apic_id) {
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(dest_apic_id));
 	// DM:init = 5, Level:assert = 1, TM:Level = 1
-	picBase.store(lApicIcrLow, apicIcrLowDelivMode(5)
+	sendIcr(dest_apic_id, apicIcrLowDelivMode(5)
 			| apicIcrLowLevel(true) | apicIcrLowTriggerMode(true));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 void raiseInitDeassertIpi(uint32_t dest_apic_id) {
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(dest_apic_id));
+	// x2APIC does not support the INIT level de-assert IPI (Intel SDM 10.12.9).
+	if(useX2Apic)
+		return;
+
 	// DM:init = 5, TM:Level = 1
-	picBase.store(lApicIcrLow, apicIcrLowDelivMode(5)
+	sendIcr(dest_apic_id, apicIcrLowDelivMode(5)
 			| apicIcrLowTriggerMode(true));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 void raiseStartupIpi(uint32_t dest_apic_id, uint32_t page) {
 	assert((page % 0x1000) == 0);
 	uint32_t vector = page / 0x1000; // determines the startup code page
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(dest_apic_id));
 	// DM:startup = 6
-	picBase.store(lApicIcrLow, apicIcrLowVector(vector)
+	sendIcr(dest_apic_id, apicIcrLowVector(vector)
 			| apicIcrLowDelivMode(6));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 void sendShootdownIpi() {
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(0));
-	picBase.store(lApicIcrLow, apicIcrLowVector(0xF0) | apicIcrLowDelivMode(0)
+	sendIcr(0, apicIcrLowVector(0xF0) | apicIcrLowDelivMode(0)
 			| apicIcrLowLevel(true) | apicIcrLowShorthand(2));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 void sendPingIpi(uint32_t apic) {
 //	frigg::infoLogger() << "thor [CPU" << getLocalApicId() << "]: Sending ping" << frigg::endLog;
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(apic));
-	picBase.store(lApicIcrLow, apicIcrLowVector(0xF1) | apicIcrLowDelivMode(0)
+	sendIcr(apic, apicIcrLowVector(0xF1) | apicIcrLowDelivMode(0)
 			| apicIcrLowLevel(true) | apicIcrLowShorthand(0));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 void sendGlobalNmi() {
 	// Send the NMI to all /other/ CPUs but not to the current one.
-	picBase.store(lApicIcrHigh, apicIcrHighDestField(0));
-	picBase.store(lApicIcrLow, apicIcrLowVector(0) | apicIcrLowDelivMode(4)
+	sendIcr(0, apicIcrLowVector(0) | apicIcrLowDelivMode(4)
 			| apicIcrLowLevel(true) | apicIcrLowShorthand(3));
-	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-		// Wait for IPI delivery.
-	}
 }
 
 // --------------------------------------------------------
@@ -354,9 +456,6 @@ IrqPin *getGlobalSystemIrq(size_t n) {
 // I/O APIC management
 // --------------------------------------------------------
 
-// TODO: Replace this by proper IRQ allocation.
-extern frigg::LazyInitializer<IrqSlot> globalIrqSlots[64];
-
 constexpr arch::scalar_register<uint32_t> apicIndex(0x00);
 constexpr arch::scalar_register<uint32_t> apicData(0x10);
 
@@ -391,11 +490,14 @@ namespace {
 			void mask() override;
 			void unmask() override;
 			void sendEoi() override;
+			bool retarget(CpuData *cpu) override;
 
 		private:
 			IoApic *_chip;
 			unsigned int _index;
+			CpuData *_cpu = nullptr;
 			int _vector = -1;
+			bool _masked = true;
 			
 			// The following variables store the current pin configuration.
 			bool _levelTriggered;
@@ -455,22 +557,18 @@ namespace {
 		}
 
 		// Allocate an IRQ vector for the I/O APIC pin.
-		if(_vector == -1)
-			for(int i = 0; i < 64; i++) {
-				if(!globalIrqSlots[i]->isAvailable())
-					continue;
-				frigg::infoLogger() << "thor: Allocating IRQ slot " << i
-						<< " to " << name() << frigg::endLog;
-				globalIrqSlots[i]->link(this);
-				_vector = 64 + i;
-				break;
-			}
+		// Pins that are configured before the APs are booted end up on the boot CPU.
+		if(_vector == -1) {
+			_cpu = pickIrqCpu();
+			_vector = allocateIrqVector(_cpu, this);
+		}
 		if(_vector == -1)
 			frigg::panicLogger() << "thor: Could not allocate interrupt vector for "
 					<< name() << frigg::endLog;
 
+		_masked = false;
 		_chip->_storeRegister(kIoApicInts + _index * 2 + 1,
-				static_cast<uint32_t>(pin_word2::destination(0)));
+				static_cast<uint32_t>(pin_word2::destination(_cpu->localApicId)));
 		_chip->_storeRegister(kIoApicInts + _index * 2,
 				static_cast<uint32_t>(pin_word1::vector(_vector)
 				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
@@ -480,6 +578,7 @@ namespace {
 	
 	void IoApic::Pin::mask() {
 //		frigg::infoLogger() << "thor: Masking pin " << _index << frigg::endLog;
+		_masked = true;
 		_chip->_storeRegister(kIoApicInts + _index * 2,
 				static_cast<uint32_t>(pin_word1::vector(_vector)
 				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
@@ -488,6 +587,7 @@ namespace {
 
 	void IoApic::Pin::unmask() {
 //		frigg::infoLogger() << "thor: Unmasking pin " << _index << frigg::endLog;
+		_masked = false;
 		_chip->_storeRegister(kIoApicInts + _index * 2,
 				static_cast<uint32_t>(pin_word1::vector(_vector)
 				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
@@ -498,6 +598,34 @@ namespace {
 		acknowledgeIrq(0);
 	}
 
+	bool IoApic::Pin::retarget(CpuData *cpu) {
+		assert(_vector != -1);
+		if(cpu == _cpu)
+			return true;
+
+		auto vector = allocateIrqVector(cpu, this);
+		if(vector == -1)
+			return false;
+
+		// Mask the pin while the destination and the vector are inconsistent.
+		// Level-triggered IRQs are redelivered once the pin is unmasked again.
+		_chip->_storeRegister(kIoApicInts + _index * 2,
+				static_cast<uint32_t>(pin_word1::vector(_vector)
+				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
+				| pin_word1::activeLow(_activeLow) | pin_word1::masked(true)));
+		freeIrqVector(_cpu, _vector);
+
+		_cpu = cpu;
+		_vector = vector;
+		_chip->_storeRegister(kIoApicInts + _index * 2 + 1,
+				static_cast<uint32_t>(pin_word2::destination(_cpu->localApicId)));
+		_chip->_storeRegister(kIoApicInts + _index * 2,
+				static_cast<uint32_t>(pin_word1::vector(_vector)
+				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
+				| pin_word1::activeLow(_activeLow) | pin_word1::masked(_masked)));
+		return true;
+	}
+
 	IoApic::IoApic(int apic_id, arch::mem_space space)
 	: _apicId(apic_id), _space{std::move(space)} {
 		_numPins = ((_loadRegister(kIoApicVersion) >> 16) & 0xFF) + 1;
@@ -636,6 +764,94 @@ bool checkLegacyPicIsr(int irq) {
 	}
 }
 
+// --------------------------------------------------------
+// IRQ vector management
+// --------------------------------------------------------
+
+namespace {
+	// Protects the irqSlots of all CPUs against concurrent allocation.
+	frigg::TicketLock irqVectorMutex;
+
+	std::atomic<unsigned int> nextIrqCpu;
+}
+
+int allocateIrqVector(CpuData *cpu, IrqPin *pin) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&irqVectorMutex);
+
+	for(int i = 0; i < 64; i++) {
+		if(!cpu->irqSlots[i].isAvailable())
+			continue;
+		frigg::infoLogger() << "thor: Allocating IRQ slot " << i
+				<< " of CPU #" << cpu->localApicId << " to " << pin->name() << frigg::endLog;
+		cpu->irqSlots[i].link(pin);
+		return 64 + i;
+	}
+	return -1;
+}
+
+void freeIrqVector(CpuData *cpu, int vector) {
+	assert(vector >= 64 && vector < 128);
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&irqVectorMutex);
+
+	cpu->irqSlots[vector - 64].unlink();
+}
+
+CpuData *pickIrqCpu() {
+	auto n = nextIrqCpu.fetch_add(1, std::memory_order_relaxed);
+	return getCpuData(n % getCpuCount());
+}
+
+// --------------------------------------------------------
+// MSI management
+// --------------------------------------------------------
+
+MsiPin::MsiPin(frigg::String<KernelAlloc> name, CpuData *cpu)
+: IrqPin{frigg::move(name)}, _cpu{cpu}, _apicId{static_cast<uint32_t>(cpu->localApicId)} {
+	_vector = allocateIrqVector(cpu, this);
+	if(_vector == -1)
+		frigg::panicLogger() << "thor: Could not allocate interrupt vector for "
+				<< this->name() << frigg::endLog;
+}
+
+uint64_t MsiPin::getMessageAddress() {
+	// Physical destination mode, no redirection hint.
+	// Without interrupt remapping, only 8-bit APIC IDs can be targeted.
+	assert(_apicId < 256);
+	return 0xFEE00000 | (_apicId << 12);
+}
+
+uint32_t MsiPin::getMessageData() {
+	// Edge-triggered, fixed delivery mode.
+	return _vector;
+}
+
+IrqStrategy MsiPin::program(TriggerMode mode, Polarity) {
+	assert(mode == TriggerMode::edge);
+	return IrqStrategy::justEoi;
+}
+
+void MsiPin::sendEoi() {
+	acknowledgeIrq(0);
+}
+
+bool MsiPin::retarget(CpuData *cpu) {
+	if(cpu == _cpu)
+		return true;
+
+	auto vector = allocateIrqVector(cpu, this);
+	if(vector == -1)
+		return false;
+	freeIrqVector(_cpu, _vector);
+
+	_cpu = cpu;
+	_apicId = cpu->localApicId;
+	_vector = vector;
+	updateMessage();
+	return true;
+}
+
 // --------------------------------------------------------
 // General functions
 // --------------------------------------------------------
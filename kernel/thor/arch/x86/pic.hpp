@@ -1,6 +1,8 @@
 #ifndef THOR_ARCH_X86_PIC_HPP
 #define THOR_ARCH_X86_PIC_HPP
 
+#include <atomic>
+
 #include "../../generic/irq.hpp"
 #include "../../generic/types.hpp"
 #include "../../generic/timer.hpp"
@@ -11,30 +13,19 @@ namespace thor {
 // Local APIC management
 // --------------------------------------------------------
 
-struct GlobalApicContext {
-	friend struct LocalApicContext;
+struct LocalApicContext {
+	// Alarm of this CPU's timer engine. Backed by the local APIC timer.
+	struct AlarmSlot : AlarmTracker {
+		AlarmSlot(LocalApicContext *context)
+		: _context{context} { }
 
-	struct GlobalAlarmSlot : AlarmTracker {
 		using AlarmTracker::fireAlarm;
 
 		void arm(uint64_t nanos) override;
-	};
-
-	AlarmTracker *globalAlarm() {
-		return &_globalAlarmInstance;
-	}
-
-private:
-	GlobalAlarmSlot _globalAlarmInstance;
-
-private:
-	frigg::TicketLock _mutex;
-
-	uint64_t _globalDeadline;
-};
 
-struct LocalApicContext {
-	friend struct GlobalApicContext;
+	private:
+		LocalApicContext *_context;
+	};
 
 	LocalApicContext();
 
@@ -42,15 +33,30 @@ struct LocalApicContext {
 
 	static void handleTimerIrq();
 
-private:
-	static void _updateLocalTimer();
+	// Reprograms the local APIC timer to the earliest deadline of this CPU.
+	static void updateLocalTimer();
+
+	AlarmTracker *localAlarm() {
+		return &_alarmInstance;
+	}
+
+	PrecisionTimerEngine *timerEngine() {
+		return _timerEngine;
+	}
 
 private:
+	uint32_t _apicId;
 	uint64_t _preemptionDeadline;
-	uint64_t _globalDeadline;
-};
 
-GlobalApicContext *globalApicContext();
+	// Written by AlarmSlot::arm(), potentially from other CPUs.
+	std::atomic<uint64_t> _alarmDeadline;
+	AlarmSlot _alarmInstance;
+
+	PrecisionTimerEngine *_timerEngine;
+
+	friend void initLocalApicPerCpu();
+	friend void calibrateApicTimer();
+};
 
 void initLocalApicOnTheSystem();
 void initLocalApicPerCpu();
@@ -82,6 +88,53 @@ void sendGlobalNmi();
 
 void setupIoApic(int apic_id, int gsi_base, PhysicalAddr address);
 
+// --------------------------------------------------------
+// IRQ vector management
+// --------------------------------------------------------
+
+struct CpuData;
+
+// Allocates one of the IRQ vectors 64 to 127 of the given CPU and links it to the pin.
+// Returns the vector or -1 if the CPU has no free vectors.
+int allocateIrqVector(CpuData *cpu, IrqPin *pin);
+
+// Returns a vector obtained from allocateIrqVector().
+void freeIrqVector(CpuData *cpu, int vector);
+
+// Returns the CPU that the next device IRQ should be routed to.
+// Device IRQs are distributed among all CPUs in round-robin order.
+CpuData *pickIrqCpu();
+
+// --------------------------------------------------------
+// MSI management
+// --------------------------------------------------------
+
+// Edge-triggered IrqPin that is raised by message signaled interrupts.
+// Masking is device specific and implemented by subclasses.
+struct MsiPin : IrqPin {
+	MsiPin(frigg::String<KernelAlloc> name, CpuData *cpu);
+
+	// Address and data that the device writes to raise this pin.
+	uint64_t getMessageAddress();
+	uint32_t getMessageData();
+
+protected:
+	// Subclasses call this before programming the device.
+	IrqStrategy program(TriggerMode mode, Polarity polarity) override;
+
+	void sendEoi() override;
+
+	bool retarget(CpuData *cpu) override;
+
+	// Writes getMessageAddress() and getMessageData() to the device.
+	virtual void updateMessage() = 0;
+
+private:
+	CpuData *_cpu;
+	uint32_t _apicId;
+	int _vector;
+};
+
 // --------------------------------------------------------
 // Legacy PIC management
 // --------------------------------------------------------
@@ -0,0 +1,57 @@
+#include "clock-page.hpp"
+#include "kernel.hpp"
+
+namespace thor {
+
+namespace {
+	PhysicalAddr clockPagePhysical = PhysicalAddr(-1);
+	frigg::LazyInitializer<frigg::SharedPtr<Memory>> clockPageInstance;
+
+	// Serializes writers of the clock page.
+	frigg::TicketLock clockPageMutex;
+}
+
+void initializeClockPage() {
+	clockPagePhysical = physicalAllocator->allocate(kPageSize);
+	assert(clockPagePhysical != PhysicalAddr(-1) && "OOM");
+
+	PageAccessor accessor{clockPagePhysical};
+	memset(accessor.get(), 0, kPageSize);
+
+	clockPageInstance.initialize(frigg::makeShared<HardwareMemory>(*kernelAlloc,
+			clockPagePhysical, kPageSize, CachingMode::null));
+}
+
+frigg::SharedPtr<Memory> clockPageMemory() {
+	return *clockPageInstance;
+}
+
+bool overlapsClockPage(uintptr_t address, size_t length) {
+	if(address + length < address)
+		return true;
+	return address < kHelClockPageAddress + kPageSize
+			&& address + length > kHelClockPageAddress;
+}
+
+void publishTscClock(uint64_t ref_tsc, uint64_t ref_nanos, uint64_t multiplier, uint32_t shift) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&clockPageMutex);
+
+	PageAccessor accessor{clockPagePhysical};
+	auto page = reinterpret_cast<HelClockPage *>(accessor.get());
+
+	// Writer side of the seqlock: readers retry while the sequence number is odd.
+	auto seq = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->seqlock, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&page->refTsc, ref_tsc, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->refNanos, ref_nanos, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->tscMultiplier, multiplier, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->tscShift, shift, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->flags, kHelClockPageTsc, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&page->seqlock, seq + 2, __ATOMIC_RELEASE);
+}
+
+} // namespace thor
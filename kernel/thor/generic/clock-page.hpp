@@ -0,0 +1,26 @@
+#ifndef THOR_GENERIC_CLOCK_PAGE_HPP
+#define THOR_GENERIC_CLOCK_PAGE_HPP
+
+#include <frigg/smart_ptr.hpp>
+#include "usermem.hpp"
+
+namespace thor {
+
+// The clock page is a single page of HelClockPage that is mapped read-only
+// into each user space AddressSpace at kHelClockPageAddress.
+void initializeClockPage();
+
+frigg::SharedPtr<Memory> clockPageMemory();
+
+// The clock page is shared by all address spaces. The kernel must never write to it
+// on behalf of user space (e.g., through an AddressSpaceLockHandle), as it bypasses
+// the read-only mapping. Also returns true if the range wraps around.
+bool overlapsClockPage(uintptr_t address, size_t length);
+
+// Publishes the parameters that convert TSC ticks to system clock nanoseconds.
+// nanos = refNanos + (((tsc - refTsc) * multiplier) >> shift).
+void publishTscClock(uint64_t ref_tsc, uint64_t ref_nanos, uint64_t multiplier, uint32_t shift);
+
+} // namespace thor
+
+#endif // THOR_GENERIC_CLOCK_PAGE_HPP
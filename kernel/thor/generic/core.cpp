@@ -153,38 +153,143 @@ IrqMutex &irqMutex() {
 ExecutorContext::ExecutorContext() { }
 
 CpuData::CpuData()
-: scheduler{this}, activeFiber{nullptr}, heartbeat{0} { }
+: scheduler{this}, cpuIndex{-1}, activeFiber{nullptr}, heartbeat{0} { }
 
 // --------------------------------------------------------
 // Threading related functions
 // --------------------------------------------------------
 
 Universe::Universe()
-: _descriptorMap{frg::hash<Handle>{}, *kernelAlloc}, _nextHandle{1} { }
+: _directory{nullptr}, _freeHead{0}, _nextHandle{1} { }
 
 Universe::~Universe() {
 	if(logCleanup)
 		frigg::infoLogger() << "\e[31mthor: Universe is deallocated\e[39m" << frigg::endLog;
+
+	auto directory = _directory.load(std::memory_order_relaxed);
+	if(directory) {
+		for(size_t i = 0; i < directory->numLeaves; i++)
+			frigg::destruct(*kernelAlloc, directory->leaves[i].load(std::memory_order_relaxed));
+	}
+	while(directory) {
+		auto retired = directory->retired;
+		frigg::destructN(*kernelAlloc, directory->leaves, directory->numLeaves);
+		frigg::destruct(*kernelAlloc, directory);
+		directory = retired;
+	}
 }
 
 Handle Universe::attachDescriptor(Guard &guard, AnyDescriptor descriptor) {
 	assert(guard.protects(&lock));
 
-	Handle handle = _nextHandle++;
-	_descriptorMap.insert(handle, frigg::move(descriptor));
+	Handle handle;
+	Slot *slot;
+	if(_freeHead) {
+		handle = _freeHead;
+		slot = _findSlot(handle);
+		_freeHead = slot->nextFree;
+	}else{
+		handle = _nextHandle++;
+		slot = _allocateSlot(guard, handle);
+	}
+
+	// Lookups only read the descriptor after they observe the live bit.
+	slot->descriptor = frigg::move(descriptor);
+	slot->state.fetch_or(Slot::live, std::memory_order_release);
 	return handle;
 }
 
-AnyDescriptor *Universe::getDescriptor(Guard &guard, Handle handle) {
-	assert(guard.protects(&lock));
+frg::optional<AnyDescriptor> Universe::getDescriptor(Handle handle) {
+	// Disabling IRQs ensures that we are not preempted while we access the slot.
+	// detachDescriptor() spins until all lookups leave the slot.
+	auto irq_lock = frigg::guard(&irqMutex());
+
+	auto slot = _findSlot(handle);
+	if(!slot)
+		return frg::null_opt;
 
-	return _descriptorMap.get(handle);
+	auto state = slot->state.fetch_add(1, std::memory_order_acquire);
+	if(!(state & Slot::live)) {
+		slot->state.fetch_sub(1, std::memory_order_release);
+		return frg::null_opt;
+	}
+
+	frg::optional<AnyDescriptor> result{slot->descriptor};
+	slot->state.fetch_sub(1, std::memory_order_release);
+	return result;
 }
 
 frg::optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.remove(handle);
+	auto slot = _findSlot(handle);
+	if(!slot)
+		return frg::null_opt;
+	if(!(slot->state.load(std::memory_order_relaxed) & Slot::live))
+		return frg::null_opt;
+
+	// Prevent new lookups from accessing the slot and wait for the current ones.
+	slot->state.fetch_and(~Slot::live, std::memory_order_relaxed);
+	while(slot->state.load(std::memory_order_acquire))
+		frigg::pause();
+
+	frg::optional<AnyDescriptor> result{frigg::move(slot->descriptor)};
+	slot->descriptor = AnyDescriptor{};
+
+	slot->nextFree = _freeHead;
+	_freeHead = handle;
+	return result;
+}
+
+auto Universe::_findSlot(Handle handle) -> Slot * {
+	if(handle <= 0)
+		return nullptr;
+
+	auto directory = _directory.load(std::memory_order_acquire);
+	if(!directory)
+		return nullptr;
+
+	size_t l = handle >> leafShift;
+	if(l >= directory->numLeaves)
+		return nullptr;
+	auto leaf = directory->leaves[l].load(std::memory_order_acquire);
+	if(!leaf)
+		return nullptr;
+	return &leaf->slots[handle & (leafSize - 1)];
+}
+
+auto Universe::_allocateSlot(Guard &guard, Handle handle) -> Slot * {
+	assert(guard.protects(&lock));
+	assert(handle > 0);
+
+	size_t l = handle >> leafShift;
+	auto directory = _directory.load(std::memory_order_relaxed);
+	if(!directory || l >= directory->numLeaves) {
+		// Grow the directory. We copy the leaf pointers and publish the new directory;
+		// lookups that still see the old one remain correct as leaves are shared.
+		size_t n = directory ? 2 * directory->numLeaves : 4;
+		while(l >= n)
+			n *= 2;
+
+		auto grown = frigg::construct<Directory>(*kernelAlloc);
+		grown->numLeaves = n;
+		grown->leaves = frigg::constructN<std::atomic<Leaf *>>(*kernelAlloc, n, nullptr);
+		grown->retired = directory;
+		if(directory) {
+			for(size_t i = 0; i < directory->numLeaves; i++)
+				grown->leaves[i].store(directory->leaves[i].load(std::memory_order_relaxed),
+						std::memory_order_relaxed);
+		}
+		_directory.store(grown, std::memory_order_release);
+		directory = grown;
+	}
+
+	auto leaf = directory->leaves[l].load(std::memory_order_relaxed);
+	if(!leaf) {
+		leaf = frigg::construct<Leaf>(*kernelAlloc);
+		directory->leaves[l].store(leaf, std::memory_order_release);
+	}
+	return &leaf->slots[handle & (leafSize - 1)];
 }
 
 } // namespace thor
@@ -2,7 +2,6 @@
 #define THOR_GENERIC_CORE_HPP
 
 #include <frg/optional.hpp>
-#include <frg/hash_map.hpp>
 #include <frigg/callback.hpp>
 #include <frigg/variant.hpp>
 #include "error.hpp"
@@ -72,6 +71,13 @@ struct CpuData : public PlatformCpuData {
 
 	IrqMutex irqMutex;
 	Scheduler scheduler;
+
+	// Index of this CPU, i.e., getCpuData(cpuIndex) returns this CpuData.
+	int cpuIndex;
+
+	// Slots of the IRQ vectors 64 to 127. Allocated by allocateIrqVector().
+	IrqSlot irqSlots[64];
+
 	bool haveVirtualization;
 
 	ExecutorContext *executorContext;
@@ -123,20 +129,53 @@ public:
 
 	Handle attachDescriptor(Guard &guard, AnyDescriptor descriptor);
 
-	AnyDescriptor *getDescriptor(Guard &guard, Handle handle);
+	// Lookups do not take the lock. Instead, the caller receives a copy of the descriptor.
+	frg::optional<AnyDescriptor> getDescriptor(Handle handle);
 	
 	frg::optional<AnyDescriptor> detachDescriptor(Guard &guard, Handle handle);
 
+	// Serializes attachDescriptor() and detachDescriptor().
 	Lock lock;
 
 private:
-	frg::hash_map<
-		Handle,
-		AnyDescriptor,
-		frg::hash<Handle>,
-		KernelAlloc
-	> _descriptorMap;
-
+	// Descriptors are stored in a two-level table: a directory of pointers to
+	// fixed-size leaves. Leaves are never freed before the universe is destructed.
+	// When the directory is grown, the old directory is retired (but not freed)
+	// such that concurrent lookups can still access it.
+	static constexpr int leafShift = 6;
+	static constexpr size_t leafSize = size_t(1) << leafShift;
+
+	struct Slot {
+		// Set in state if the slot contains a descriptor.
+		static constexpr uint32_t live = uint32_t(1) << 31;
+
+		Slot()
+		: state{0}, nextFree{0} { }
+
+		// Live bit plus the number of lookups that currently access the slot.
+		std::atomic<uint32_t> state;
+		AnyDescriptor descriptor;
+		// Next handle on the free list (only valid if the slot is not live).
+		Handle nextFree;
+	};
+
+	struct Leaf {
+		Slot slots[leafSize];
+	};
+
+	struct Directory {
+		size_t numLeaves;
+		std::atomic<Leaf *> *leaves;
+		Directory *retired;
+	};
+
+	Slot *_findSlot(Handle handle);
+	Slot *_allocateSlot(Guard &guard, Handle handle);
+
+	std::atomic<Directory *> _directory;
+
+	// Head of the list of recycled handles (zero if there are none).
+	Handle _freeHead;
 	Handle _nextHandle;
 };
 
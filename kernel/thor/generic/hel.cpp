@@ -6,6 +6,7 @@
 #include "ipc-queue.hpp"
 #include "irq.hpp"
 #include "kernlet.hpp"
+#include "clock-page.hpp"
 #include "../arch/x86/debug.hpp"
 #include <arch/x86/ept.hpp>
 #include <arch/x86/vmx.hpp>
@@ -179,10 +180,7 @@ HelError helTransferDescriptor(HelHandle handle, HelHandle universe_handle,
 	AnyDescriptor descriptor;
 	frigg::SharedPtr<Universe> universe;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard lock(&this_universe->lock);
-
-		auto descriptor_it = this_universe->getDescriptor(lock, handle);
+		auto descriptor_it = this_universe->getDescriptor(handle);
 		if(!descriptor_it)
 			return kHelErrNoDescriptor;
 		descriptor = *descriptor_it;
@@ -190,7 +188,7 @@ HelError helTransferDescriptor(HelHandle handle, HelHandle universe_handle,
 		if(universe_handle == kHelThisUniverse) {
 			universe = this_universe.toShared();
 		}else{
-			auto universe_it = this_universe->getDescriptor(lock, universe_handle);
+			auto universe_it = this_universe->getDescriptor(universe_handle);
 			if(!universe_it)
 				return kHelErrNoDescriptor;
 			if(!universe_it->is<UniverseDescriptor>())
@@ -214,10 +212,7 @@ HelError helDescriptorInfo(HelHandle handle, HelDescriptorInfo *info) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
-	auto irq_lock = frigg::guard(&irqMutex());
-	Universe::Guard universe_guard(&this_universe->lock);
-
-	auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+	auto wrapper = this_universe->getDescriptor(handle);
 	if(!wrapper)
 		return kHelErrNoDescriptor;
 	switch(wrapper->tag()) {
@@ -235,10 +230,7 @@ HelError helGetCredentials(HelHandle handle, uint32_t flags, char *credentials)
 
 	frigg::SharedPtr<Thread> thread;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -270,6 +262,13 @@ HelError helCreateQueue(HelQueue *head, uint32_t flags,
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
+	// The kernel writes to the queue struct, so it must not overlap the clock page.
+	if(size_shift >= 32)
+		return kHelErrIllegalArgs;
+	if(overlapsClockPage(reinterpret_cast<uintptr_t>(head),
+			sizeof(HelQueue) + (size_t{1} << size_shift) * sizeof(int)))
+		return kHelErrIllegalArgs;
+
 	auto queue = frigg::makeShared<IpcQueue>(*kernelAlloc,
 			this_thread->getAddressSpace().lock(), head,
 			size_shift, element_limit);
@@ -285,17 +284,22 @@ HelError helCreateQueue(HelQueue *head, uint32_t flags,
 	return kHelErrNone;
 }
 
-HelError helSetupChunk(HelHandle queue_handle, int index, HelChunk *chunk, uint32_t flags) {
+HelError helSetupChunk(HelHandle queue_handle, int index, HelChunk *chunk,
+		size_t size, uint32_t flags) {
 	assert(!flags);
+	// Chunk progress is tracked in the low bits of the progress futex.
+	if(!size || size > kHelProgressMask || (size & 7))
+		return kHelErrIllegalArgs;
+	if(reinterpret_cast<uintptr_t>(chunk) & 7)
+		return kHelErrIllegalArgs;
+	if(overlapsClockPage(reinterpret_cast<uintptr_t>(chunk), sizeof(HelChunk) + size))
+		return kHelErrIllegalArgs;
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -303,7 +307,11 @@ HelError helSetupChunk(HelHandle queue_handle, int index, HelChunk *chunk, uint3
 		queue = queue_wrapper->get<QueueDescriptor>().queue;
 	}
 
-	queue->setupChunk(index, this_thread->getAddressSpace().lock(), chunk);
+	if(index < 0)
+		return kHelErrIllegalArgs;
+	auto error = queue->setupChunk(index, this_thread->getAddressSpace().lock(), chunk, size);
+	if(error)
+		return kHelErrIllegalArgs;
 
 	return kHelErrNone;
 }
@@ -314,10 +322,7 @@ HelError helCancelAsync(HelHandle handle, uint64_t async_id) {
 
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto queue_wrapper = this_universe->getDescriptor(handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -376,10 +381,7 @@ HelError helResizeMemory(HelHandle handle, size_t new_size) {
 
 	frigg::SharedPtr<Memory> memory;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -448,10 +450,7 @@ HelError helCreateSliceView(HelHandle bundle_handle,
 
 	frigg::SharedPtr<Memory> bundle;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, bundle_handle);
+		auto wrapper = this_universe->getDescriptor(bundle_handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -525,7 +524,7 @@ HelError helCreateVirtualizedCpu(HelHandle handle, HelHandle *out) {
 	auto this_universe = this_thread->getUniverse();
 	Universe::Guard universe_guard(&this_universe->lock);
 
-	auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+	auto wrapper = this_universe->getDescriptor(handle);
 	if(!wrapper)
 		return kHelErrNoDescriptor;
 	if(!wrapper->is<VirtualizedSpaceDescriptor>())
@@ -545,9 +544,8 @@ HelError helRunVirtualizedCpu(HelHandle handle, HelVmexitReason *exitInfo) {
 	}
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
-	Universe::Guard universe_guard(&this_universe->lock);
 
-	auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+	auto wrapper = this_universe->getDescriptor(handle);
 	if(!wrapper)
 		return kHelErrNoDescriptor;
 	if(!wrapper->is<VirtualizedCpuDescriptor>())
@@ -567,13 +565,10 @@ HelError helForkSpace(HelHandle handle, HelHandle *forked_handle) {
 
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
 		if(handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, handle);
+			auto space_wrapper = this_universe->getDescriptor(handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -625,10 +620,7 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 	frigg::SharedPtr<MemorySlice> slice;
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, memory_handle);
+		auto memory_wrapper = this_universe->getDescriptor(memory_handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(memory_wrapper->is<MemorySliceDescriptor>()) {
@@ -645,7 +637,7 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -718,16 +710,17 @@ HelError helSubmitProtectMemory(HelHandle space_handle,
 	if(flags & kHelMapProtExecute)
 		protectFlags |= AddressSpace::kMapProtExecute;
 
+	// The clock page is shared by all address spaces; it must stay read-only.
+	if(overlapsClockPage(reinterpret_cast<uintptr_t>(pointer), length))
+		return kHelErrIllegalArgs;
+
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -735,7 +728,7 @@ HelError helSubmitProtectMemory(HelHandle space_handle,
 			space = space_wrapper->get<AddressSpaceDescriptor>().space;
 		}
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -791,13 +784,10 @@ HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
 
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -855,10 +845,7 @@ HelError helLoadForeign(HelHandle handle, uintptr_t address,
 
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(wrapper->is<AddressSpaceDescriptor>()) {
@@ -914,10 +901,7 @@ HelError helStoreForeign(HelHandle handle, uintptr_t address,
 
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(wrapper->is<AddressSpaceDescriptor>()) {
@@ -939,6 +923,10 @@ HelError helStoreForeign(HelHandle handle, uintptr_t address,
 		}
 	}
 
+	// Writes to the clock page would bypass its read-only mapping.
+	if(overlapsClockPage(address, length))
+		return kHelErrIllegalArgs;
+
 	auto accessor = AddressSpaceLockHandle{frigg::move(space),
 			(void *)address, length};
 
@@ -973,10 +961,7 @@ HelError helMemoryInfo(HelHandle handle, size_t *size) {
 
 	frigg::SharedPtr<Memory> memory;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -995,17 +980,14 @@ HelError helSubmitManageMemory(HelHandle handle, HelHandle queue_handle, uintptr
 	frigg::SharedPtr<Memory> memory;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1072,10 +1054,7 @@ HelError helUpdateMemory(HelHandle handle, int type,
 
 	frigg::SharedPtr<Memory> memory;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1110,17 +1089,14 @@ HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size
 	frigg::SharedPtr<Memory> memory;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1203,10 +1179,7 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 
 	frigg::SharedPtr<Memory> memory;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1214,12 +1187,29 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
-/*	auto handle_load = frigg::makeShared<AsyncInitiateLoad>(*kernelAlloc,
-			NullCompleter(), offset, length);
-	{
-		// TODO: protect memory object with a guard
-		memory->submitInitiateLoad(frigg::move(handle_load));
-	}*/
+	// Only managed memory benefits from loading ahead.
+	if(memory->tag() != MemoryTag::frontal)
+		return kHelErrNone;
+
+	// Loadahead is only a hint; silently ignore the part of the range past the end.
+	auto memory_length = memory->getLength();
+	if(offset >= memory_length)
+		return kHelErrNone;
+	length = frigg::min(length, memory_length - offset);
+
+	// In contrast to helSubmitLockMemoryView(), the pages are not locked;
+	// the closure only lives until the pages are initialized.
+	struct Closure {
+		Worklet worklet;
+		MonitorNode initiate;
+	} *closure = frigg::construct<Closure>(*kernelAlloc);
+
+	closure->worklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::worklet);
+		frigg::destruct(*kernelAlloc, closure);
+	});
+	closure->initiate.setup(ManageRequest::initialize, offset, length, &closure->worklet);
+	memory->submitInitiateLoad(&closure->initiate);
 
 	return kHelErrNone;
 }
@@ -1238,13 +1228,10 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	frigg::SharedPtr<Universe> universe;
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
 		if(universe_handle == kHelNullHandle) {
 			universe = this_thread->getUniverse().toShared();
 		}else{
-			auto universe_wrapper = this_universe->getDescriptor(universe_guard, universe_handle);
+			auto universe_wrapper = this_universe->getDescriptor(universe_handle);
 			if(!universe_wrapper)
 				return kHelErrNoDescriptor;
 			if(!universe_wrapper->is<UniverseDescriptor>())
@@ -1255,7 +1242,7 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -1298,10 +1285,7 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 	if(handle == kHelThisThread) {
 		thread = this_thread.toShared();
 	}else{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1326,10 +1310,7 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	if(handle == kHelThisThread) {
 		thread = this_thread.toShared();
 	}else{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1356,17 +1337,14 @@ HelError helSubmitObserve(HelHandle handle, uint64_t in_seq,
 	frigg::SharedPtr<Thread> thread;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
 			return kHelErrBadDescriptor;
 		thread = thread_wrapper->get<ThreadDescriptor>().thread;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1389,10 +1367,7 @@ HelError helKillThread(HelHandle handle) {
 
 	frigg::SharedPtr<Thread> thread;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1411,10 +1386,7 @@ HelError helInterruptThread(HelHandle handle) {
 
 	frigg::SharedPtr<Thread> thread;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1433,10 +1405,7 @@ HelError helResume(HelHandle handle) {
 
 	frigg::SharedPtr<Thread> thread;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1460,10 +1429,7 @@ HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 
 	frigg::SharedPtr<Thread> thread;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1517,10 +1483,7 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 		// FIXME: Properly handle this below.
 		thread = this_thread.toShared();
 	}else{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1579,12 +1542,12 @@ HelError helGetClock(uint64_t *counter) {
 	return kHelErrNone;
 }
 
-HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t context,
-		uint64_t *async_id) {
+HelError helSubmitAwaitClock(uint64_t counter, uint64_t slack, HelHandle queue_handle,
+		uintptr_t context, uint64_t *async_id) {
 	struct Closure final : CancelNode, PrecisionTimerNode, IpcNode {
-		static void issue(uint64_t nanos, frigg::SharedPtr<IpcQueue> queue,
+		static void issue(uint64_t nanos, uint64_t slack, frigg::SharedPtr<IpcQueue> queue,
 				uintptr_t context, uint64_t *async_id) {
-			auto closure = frigg::construct<Closure>(*kernelAlloc, nanos,
+			auto closure = frigg::construct<Closure>(*kernelAlloc, nanos, slack,
 					frigg::move(queue), context);
 			closure->queue->registerNode(closure);
 			*async_id = closure->asyncId();
@@ -1599,8 +1562,8 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 			closure->queue->submit(closure);
 		}
 
-		explicit Closure(uint64_t nanos, frigg::SharedPtr<IpcQueue> the_queue,
-				uintptr_t context)
+		explicit Closure(uint64_t nanos, uint64_t slack,
+				frigg::SharedPtr<IpcQueue> the_queue, uintptr_t context)
 		: queue{frigg::move(the_queue)},
 				source{&result, sizeof(HelSimpleResult), nullptr},
 				result{translateError(kErrSuccess), 0} {
@@ -1608,7 +1571,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 			setupSource(&source);
 
 			worklet.setup(&Closure::elapsed);
-			PrecisionTimerNode::setup(nanos, &worklet);
+			PrecisionTimerNode::setup(nanos, slack, &worklet);
 		}
 
 		void handleCancellation() override {
@@ -1630,10 +1593,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1644,7 +1604,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
 		return kHelErrQueueTooSmall;
 
-	Closure::issue(counter, frigg::move(queue), context, async_id);
+	Closure::issue(counter, slack, frigg::move(queue), context, async_id);
 
 	return kHelErrNone;
 }
@@ -1678,13 +1638,10 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	LaneHandle lane;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
 		if(handle == kHelThisThread) {
 			lane = this_thread->inferiorLane();
 		}else{
-			auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+			auto wrapper = this_universe->getDescriptor(handle);
 			if(!wrapper)
 				return kHelErrNoDescriptor;
 			if(wrapper->is<LaneDescriptor>()) {
@@ -1696,7 +1653,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			}
 		}
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1733,6 +1690,8 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			node_size += ipcSourceSize(128);
 			break;
 		case kHelActionRecvToBuffer:
+			if(overlapsClockPage(reinterpret_cast<uintptr_t>(action.buffer), action.length))
+				return kHelErrIllegalArgs;
 			node_size += ipcSourceSize(sizeof(HelLengthResult));
 			break;
 		case kHelActionPushDescriptor:
@@ -1970,10 +1929,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		case kHelActionPushDescriptor: {
 			AnyDescriptor operand;
 			{
-				auto irq_lock = frigg::guard(&irqMutex());
-				Universe::Guard universe_guard(&this_universe->lock);
-
-				auto wrapper = this_universe->getDescriptor(universe_guard, action.handle);
+				auto wrapper = this_universe->getDescriptor(action.handle);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				operand = *wrapper;
@@ -2019,10 +1975,7 @@ HelError helShutdownLane(HelHandle handle) {
 
 	LaneHandle lane;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<LaneDescriptor>())
@@ -2129,10 +2082,7 @@ HelError helRaiseEvent(HelHandle handle) {
 
 	AnyDescriptor descriptor;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
@@ -2179,10 +2129,7 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 
 	frigg::SharedPtr<IrqObject> irq;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
@@ -2222,6 +2169,7 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 			auto closure = frg::container_of(worklet, &IrqClosure::worklet);
 			closure->result.error = translateError(closure->irqNode.error());
 			closure->result.sequence = closure->irqNode.sequence();
+			closure->irqNode.reportDelivery();
 			closure->_queue->submit(closure);
 		}
 
@@ -2301,15 +2249,12 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 	AnyDescriptor descriptor;
 	frigg::SharedPtr<IpcQueue> queue;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -2348,17 +2293,14 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	frigg::SharedPtr<IrqObject> irq;
 	frigg::SharedPtr<BoundKernlet> kernlet;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
 			return kHelErrBadDescriptor;
 		irq = irq_wrapper->get<IrqDescriptor>().irq;
 
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, kernlet_handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(kernlet_handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<BoundKernletDescriptor>())
@@ -2371,6 +2313,87 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	return kHelErrNone;
 }
 
+HelError helSetIrqAffinity(HelHandle handle, uint32_t flags, int cpu) {
+	if(flags & ~uint32_t{kHelIrqAffinityThisCpu})
+		return kHelErrIllegalArgs;
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	frigg::SharedPtr<IrqObject> irq;
+	{
+		auto irq_wrapper = this_universe->getDescriptor(handle);
+		if(!irq_wrapper)
+			return kHelErrNoDescriptor;
+		if(!irq_wrapper->is<IrqDescriptor>())
+			return kHelErrBadDescriptor;
+		irq = irq_wrapper->get<IrqDescriptor>().irq;
+	}
+
+	// Threads are never migrated; hence, the current CPU is the thread's CPU.
+	CpuData *cpu_data;
+	if(flags & kHelIrqAffinityThisCpu) {
+		cpu_data = getCpuData();
+	}else{
+		if(cpu < 0 || cpu >= getCpuCount())
+			return kHelErrIllegalArgs;
+		cpu_data = getCpuData(cpu);
+	}
+
+	auto pin = irq->getPin();
+	if(!pin)
+		return kHelErrIllegalState;
+
+	auto error = pin->setAffinity(cpu_data);
+	if(error == kErrIllegalArgs) {
+		return kHelErrIllegalArgs;
+	}else if(error == kErrIllegalState) {
+		return kHelErrIllegalState;
+	}else{
+		assert(!error);
+		return kHelErrNone;
+	}
+}
+
+HelError helQueryIrqStats(HelHandle handle, HelIrqStats *user_stats) {
+	static_assert(kHelIrqLatencyBuckets == numIrqLatencyBuckets,
+			"Number of latency buckets does not match");
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	frigg::SharedPtr<IrqObject> irq;
+	{
+		auto irq_wrapper = this_universe->getDescriptor(handle);
+		if(!irq_wrapper)
+			return kHelErrNoDescriptor;
+		if(!irq_wrapper->is<IrqDescriptor>())
+			return kHelErrBadDescriptor;
+		irq = irq_wrapper->get<IrqDescriptor>().irq;
+	}
+
+	auto pin = irq->getPin();
+	if(!pin)
+		return kHelErrIllegalState;
+	auto pin_stats = pin->getStats();
+
+	HelIrqStats stats;
+	memset(&stats, 0, sizeof(HelIrqStats));
+	stats.numRaises = pin_stats.numRaises;
+	stats.numAcks = pin_stats.numAcks;
+	stats.numNacks = pin_stats.numNacks;
+	stats.numSyncAcks = pin_stats.numSyncAcks;
+	stats.numSyncNacks = pin_stats.numSyncNacks;
+	for(int i = 0; i < numIrqLatencyBuckets; i++) {
+		stats.deliveryLatency[i] = pin_stats.deliveryLatency[i];
+		stats.ackLatency[i] = pin_stats.ackLatency[i];
+	}
+
+	writeUserObject(user_stats, stats);
+
+	return kHelErrNone;
+}
+
 HelError helAccessIo(uintptr_t *port_array, size_t num_ports,
 		HelHandle *handle) {
 	auto this_thread = getCurrentThread();
@@ -2398,10 +2421,7 @@ HelError helEnableIo(HelHandle handle) {
 
 	frigg::SharedPtr<IoSpace> io_space;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<IoDescriptor>())
@@ -2430,10 +2450,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 
 	frigg::SharedPtr<KernletObject> kernlet;
 	{
-		auto irq_lock = frigg::guard(&irqMutex());
-		Universe::Guard universe_guard(&this_universe->lock);
-
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<KernletObjectDescriptor>())
@@ -2458,10 +2475,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 		}else if(defn.type == KernletParameterType::memoryView) {
 			frigg::SharedPtr<Memory> memory;
 			{
-				auto irq_lock = frigg::guard(&irqMutex());
-				Universe::Guard universe_guard(&this_universe->lock);
-
-				auto wrapper = this_universe->getDescriptor(universe_guard, x);
+				auto wrapper = this_universe->getDescriptor(x);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<MemoryViewDescriptor>())
@@ -2485,10 +2499,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 
 			frigg::SharedPtr<BitsetEvent> event;
 			{
-				auto irq_lock = frigg::guard(&irqMutex());
-				Universe::Guard universe_guard(&this_universe->lock);
-
-				auto wrapper = this_universe->getDescriptor(universe_guard, x);
+				auto wrapper = this_universe->getDescriptor(x);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<BitsetEventDescriptor>())
@@ -16,23 +16,42 @@ IpcQueue::IpcQueue(smarter::shared_ptr<AddressSpace, BindableHandle> space, void
 		unsigned int size_shift, size_t)
 : _space{frigg::move(space)}, _pointer{pointer}, _sizeShift{size_shift},
 		_nextIndex{0},
-		_currentChunk{nullptr}, _currentProgress{0},
-		_chunks{*kernelAlloc} {
+		_currentChunk{nullptr}, _currentProgress{0}, _publishedProgress{0},
+		_chunks{*kernelAlloc}, _minChunkSize{0}, _maxElementSize{sizeof(HelSimpleResult)} {
 	_chunks.resize(1 << _sizeShift);
 }
 
 bool IpcQueue::validSize(size_t size) {
-	// TODO: Note that the chunk size is currently hardcoded.
-	return sizeof(ElementStruct) + size <= 4096;
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	auto min_size = _minChunkSize ? _minChunkSize : defaultChunkSize;
+	if(sizeof(ElementStruct) + size > min_size)
+		return false;
+
+	// Chunks that are set up later must be able to hold this element.
+	if(size > _maxElementSize)
+		_maxElementSize = size;
+	return true;
 }
 
-void IpcQueue::setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer) {
+Error IpcQueue::setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space,
+		void *pointer, size_t size) {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
-	assert(index < _chunks.size());
-	assert(&_chunks[index] != _currentChunk);
-	_chunks[index] = Chunk{frigg::move(space), pointer};
+	if(index >= _chunks.size())
+		return kErrIllegalArgs;
+	if(&_chunks[index] == _currentChunk)
+		return kErrIllegalState;
+	// Elements that were already accepted must fit into every chunk.
+	if(sizeof(ElementStruct) + _maxElementSize > size)
+		return kErrIllegalArgs;
+	_chunks[index] = Chunk{frigg::move(space), pointer, size};
+
+	if(!_minChunkSize || size < _minChunkSize)
+		_minChunkSize = size;
+	return kErrSuccess;
 }
 
 void IpcQueue::submit(IpcNode *node) {
@@ -66,48 +85,6 @@ void IpcQueue::_progress() {
 			assert(self->_queueLock);
 			self->_progress();
 		}
-
-		static void acquiredElement(Worklet *worklet) {
-			auto self = frg::container_of(worklet, &IpcQueue::_worklet);
-			auto irq_lock = frigg::guard(&irqMutex());
-			auto lock = frigg::guard(&self->_mutex);
-
-			emitElement(self);
-			self->_progress();
-		}
-
-		// Emit the next element to the current chunk.
-		static void emitElement(IpcQueue *self) {
-			assert(self->_elementLock);
-
-			auto node = self->_nodeQueue.front();
-
-			size_t length = 0;
-			for(auto source = node->_source; source; source = source->link)
-				length += (source->size + 7) & ~size_t(7);
-
-			ElementStruct element;
-			memset(&element, 0, sizeof(element));
-			element.length = length;
-			element.context = reinterpret_cast<void *>(node->_context);
-			auto err = self->_elementLock.write(0, &element, sizeof(ElementStruct));
-			assert(!err);
-
-			size_t disp = sizeof(ElementStruct);
-			for(auto source = node->_source; source; source = source->link) {
-				err = self->_elementLock.write(disp, source->pointer, source->size);
-				assert(!err);
-				disp += (source->size + 7) & ~size_t(7);
-			}
-
-			self->_elementLock = AddressSpaceLockHandle{};
-			self->_nodeQueue.pop_front();
-			node->complete();
-
-			// Update the chunk progress futex.
-			self->_currentProgress += sizeof(ElementStruct) + length;
-			self->_wakeProgressFutex(false);
-		}
 	};
 
 	assert(_inProgressLoop);
@@ -129,35 +106,66 @@ void IpcQueue::_progress() {
 		}
 
 		// Check if there is enough space in the current chunk.
+		auto node = _nodeQueue.front();
+		auto sources = node->_source;
+
 		size_t length = 0;
-		for(auto source = _nodeQueue.front()->_source; source; source = source->link)
+		for(auto source = sources; source; source = source->link)
 			length += (source->size + 7) & ~size_t(7);
 
-		assert(length <= _currentChunk->bufferSize);
+		// setupChunk() and validSize() should prevent this. If the element does not fit
+		// into the chunk anyway, complete it with an error instead of the actual result.
+		// All result structs start with a HelError, so user-space sees the error.
+		HelSimpleResult error_result{kHelErrQueueTooSmall, 0};
+		QueueSource error_source;
+		if(sizeof(ElementStruct) + length > _currentChunk->bufferSize) {
+			frigg::infoLogger() << "\e[31m" "thor: IPC element of size " << length
+					<< " does not fit into chunk of size " << _currentChunk->bufferSize
+					<< "\e[39m" << frigg::endLog;
+			error_source.setup(&error_result, sizeof(HelSimpleResult));
+			error_source.link = nullptr;
+			sources = &error_source;
+			length = sizeof(HelSimpleResult);
+		}
 
 		// Check if we need to retire the current chunk.
-		if(_currentProgress + length > _currentChunk->bufferSize) {
+		if(_currentProgress + sizeof(ElementStruct) + length > _currentChunk->bufferSize) {
 			_wakeProgressFutex(true);
 
 			_chunkLock = AddressSpaceLockHandle{};
 			_currentChunk = nullptr;
 			_currentProgress = 0;
+			_publishedProgress = 0;
 			continue;
 		}
 
 		// Emit the next element to the current chunk.
-		auto dest = reinterpret_cast<Address>(_currentChunk->pointer)
-				+ offsetof(ChunkStruct, buffer) + _currentProgress;
-		assert(!(dest & 0x7));
-		_elementLock = AddressSpaceLockHandle{_currentChunk->space,
-				reinterpret_cast<void *>(dest), sizeof(ElementStruct) + length};
-		_worklet.setup(&Ops::acquiredElement);
-		_acquireNode.setup(&_worklet);
-		if(!_elementLock.acquire(&_acquireNode))
-			return;
-		Ops::emitElement(this);
+		// The whole chunk is locked, so this does not need to wait for memory.
+		size_t disp = offsetof(ChunkStruct, buffer) + _currentProgress;
+		assert(!(disp & 0x7));
+
+		ElementStruct element;
+		memset(&element, 0, sizeof(element));
+		element.length = length;
+		element.context = reinterpret_cast<void *>(node->_context);
+		auto err = _chunkLock.write(disp, &element, sizeof(ElementStruct));
+		assert(!err);
+
+		disp += sizeof(ElementStruct);
+		for(auto source = sources; source; source = source->link) {
+			err = _chunkLock.write(disp, source->pointer, source->size);
+			assert(!err);
+			disp += (source->size + 7) & ~size_t(7);
+		}
+
+		_nodeQueue.pop_front();
+		node->complete();
+
+		_currentProgress += sizeof(ElementStruct) + length;
 	}
 
+	// All elements that were emitted in this loop become visible with a single futex wake.
+	_flushProgress();
 	_inProgressLoop = false;
 }
 
@@ -187,7 +195,7 @@ bool IpcQueue::_advanceChunk() {
 	_currentChunk = &_chunks[cn];
 	_nextIndex = ((_nextIndex + 1) & kHeadMask);
 	_chunkLock = AddressSpaceLockHandle{_currentChunk->space,
-			_currentChunk->pointer, sizeof(ChunkStruct)};
+			_currentChunk->pointer, sizeof(ChunkStruct) + _currentChunk->bufferSize};
 	_worklet.setup(&Ops::acquired);
 	_acquireNode.setup(&_worklet);
 	return _chunkLock.acquire(&_acquireNode);
@@ -231,7 +239,15 @@ bool IpcQueue::_waitHeadFutex() {
 	}
 }
 
+void IpcQueue::_flushProgress() {
+	if(!_currentChunk || _currentProgress == _publishedProgress)
+		return;
+	_wakeProgressFutex(false);
+}
+
 void IpcQueue::_wakeProgressFutex(bool done) {
+	_publishedProgress = _currentProgress;
+
 	auto progress = _currentProgress;
 	if(done)
 		progress |= kProgressDone;
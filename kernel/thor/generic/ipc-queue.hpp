@@ -93,8 +93,9 @@ private:
 		Chunk()
 		: pointer{nullptr} { }
 
-		Chunk(smarter::shared_ptr<AddressSpace, BindableHandle> space_, void *pointer_)
-		: space{frigg::move(space_)}, pointer{pointer_}, bufferSize{4096} { }
+		Chunk(smarter::shared_ptr<AddressSpace, BindableHandle> space_, void *pointer_,
+				size_t buffer_size)
+		: space{frigg::move(space_)}, pointer{pointer_}, bufferSize{buffer_size} { }
 
 		// Pointer (+ address space) to queue chunk struct.
 		smarter::shared_ptr<AddressSpace, BindableHandle> space;
@@ -112,9 +113,15 @@ public:
 
 	IpcQueue &operator= (const IpcQueue &) = delete;
 
+	// Chunk size that is assumed until user-space sets up the first chunk.
+	static constexpr size_t defaultChunkSize = 4096;
+
+	// Returns true if an element with a payload of the given size fits into all chunks.
 	bool validSize(size_t size);
 
-	void setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer);
+	// Fails if the chunk cannot hold elements that were already accepted by validSize().
+	Error setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space,
+			void *pointer, size_t size);
 
 	void submit(IpcNode *node);
 
@@ -122,6 +129,7 @@ private:
 	void _progress();
 	bool _advanceChunk();
 	bool _waitHeadFutex();
+	void _flushProgress();
 	void _wakeProgressFutex(bool done);
 
 private:
@@ -147,16 +155,21 @@ private:
 
 	// Points to the chunk that we're currently writing.
 	Chunk *_currentChunk;
-	// Accessor for the current chunk.
+	// Accessor for the current chunk (including its buffer).
 	AddressSpaceLockHandle _chunkLock;
 	// Progress into the current chunk.
 	int _currentProgress;
-
-	// Accessor for the current element.
-	AddressSpaceLockHandle _elementLock;
+	// Progress that was already published to the chunk's futex.
+	// Elements are written in batches; the futex is only updated once per batch.
+	int _publishedProgress;
 
 	frigg::Vector<Chunk, KernelAlloc> _chunks;
 
+	// Size of the smallest chunk. Elements must fit into every chunk.
+	size_t _minChunkSize;
+	// Payload size of the largest element that was accepted by validSize().
+	size_t _maxElementSize;
+
 	frg::intrusive_list<
 		IpcNode,
 		frg::locate_member<
@@ -1,10 +1,45 @@
 
+#include "core.hpp"
 #include "irq.hpp"
 #include "../arch/x86/ints.hpp"
 #include "../arch/x86/hpet.hpp"
 
 namespace thor {
 
+namespace {
+	// IRQs can already be raised before the system clock is set up.
+	uint64_t currentIrqClock() {
+		auto source = systemClockSource();
+		if(!source)
+			return 0;
+		return source->currentNanos();
+	}
+
+	int latencyBucket(uint64_t nanos) {
+		auto micros = nanos / 1000;
+		int k = 0;
+		while(micros && k < numIrqLatencyBuckets - 1) {
+			micros >>= 1;
+			k++;
+		}
+		return k;
+	}
+}
+
+// --------------------------------------------------------
+// AwaitIrqNode
+// --------------------------------------------------------
+
+void AwaitIrqNode::reportDelivery() {
+	if(!_pin)
+		return;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_pin->_mutex);
+
+	_pin->_recordLatency(_pin->_stats.deliveryLatency, _raiseClock);
+}
+
 // --------------------------------------------------------
 // IrqSlot
 // --------------------------------------------------------
@@ -15,8 +50,14 @@ void IrqSlot::raise() {
 }
 
 void IrqSlot::link(IrqPin *pin) {
-	assert(!_pin);
+	assert(!_linked);
 	_pin = pin;
+	_linked = true;
+}
+
+void IrqSlot::unlink() {
+	assert(_linked);
+	_linked = false;
 }
 
 // --------------------------------------------------------
@@ -24,7 +65,7 @@ void IrqSlot::link(IrqPin *pin) {
 // --------------------------------------------------------
 
 IrqSink::IrqSink(frigg::String<KernelAlloc> name)
-: _name{frigg::move(name)}, _pin{nullptr}, _currentSequence{0},
+: _name{frigg::move(name)}, _pin{nullptr}, _currentSequence{0}, _currentRaiseClock{0},
 		_responseSequence{0}, _status{IrqStatus::null} { }
 
 IrqPin *IrqSink::getPin() {
@@ -66,8 +107,10 @@ Error IrqPin::ackSink(IrqSink *sink, uint64_t sequence) {
 		// Because _responseSequence is lagging behind, the IRQ status must be null here.
 		assert(sink->_status == IrqStatus::null);
 		sink->_status = IrqStatus::acked;
+		pin->_recordLatency(pin->_stats.ackLatency, sink->currentRaiseClock());
 	}
 	sink->_responseSequence = sequence;
+	pin->_stats.numAcks++;
 
 	// Note that we have to unblock the IRQ regardless of whether the ACK targets the
 	// currentSequence(). That avoids a race in the following scenario:
@@ -101,9 +144,11 @@ Error IrqPin::nackSink(IrqSink *sink, uint64_t sequence) {
 		// Because _responseSequence is lagging behind, the IRQ status must be null here.
 		assert(sink->_status == IrqStatus::null);
 		sink->_status = IrqStatus::nacked;
+		pin->_recordLatency(pin->_stats.ackLatency, sink->currentRaiseClock());
 		pin->_nack();
 	}
 	sink->_responseSequence = sequence;
+	pin->_stats.numNacks++;
 
 	return kErrSuccess;
 }
@@ -123,10 +168,31 @@ Error IrqPin::kickSink(IrqSink *sink) {
 // IrqPin
 // --------------------------------------------------------
 
+namespace {
+	frigg::LazyInitializer<frigg::Vector<IrqPin *, KernelAlloc>> configuredPins;
+
+	// Protects configuredPins. Must be protected against IRQs.
+	frigg::TicketLock configuredPinsMutex;
+}
+
+frigg::Vector<IrqPin *, KernelAlloc> getConfiguredIrqPins() {
+	frigg::Vector<IrqPin *, KernelAlloc> pins{*kernelAlloc};
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&configuredPinsMutex);
+
+	if(!configuredPins)
+		return pins;
+	pins.resize(configuredPins->size());
+	for(size_t i = 0; i < configuredPins->size(); i++)
+		pins[i] = (*configuredPins)[i];
+	return pins;
+}
+
 IrqPin::IrqPin(frigg::String<KernelAlloc> name)
 : _name{std::move(name)}, _strategy{IrqStrategy::null},
 		_raiseSequence{0}, _sinkSequence{0}, _inService{false}, _dueSinks{0},
-		_maskState{0} { }
+		_maskState{0}, _raiseClock{0}, _latencyClock{0}, _raiseCounts{*kernelAlloc} { }
 
 void IrqPin::configure(IrqConfiguration desired) {
 	assert(desired.specified());
@@ -138,8 +204,16 @@ void IrqPin::configure(IrqConfiguration desired) {
 		frigg::infoLogger() << "thor: Configuring IRQ " << _name
 				<< " to trigger mode: " << static_cast<int>(desired.trigger)
 				<< ", polarity: " << static_cast<int>(desired.polarity) << frigg::endLog;
+		_raiseCounts.resize(getCpuCount(), 0);
 		_strategy = program(desired.trigger, desired.polarity);
 
+		{
+			auto pins_lock = frigg::guard(&configuredPinsMutex);
+			if(!configuredPins)
+				configuredPins.initialize(*kernelAlloc);
+			configuredPins->push(this);
+		}
+
 		_activeCfg = desired;
 		_raiseSequence = 0;
 		_sinkSequence = 0;
@@ -151,9 +225,58 @@ void IrqPin::configure(IrqConfiguration desired) {
 	}
 }
 
+Error IrqPin::setAffinity(CpuData *cpu) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	if(!_activeCfg.specified())
+		return kErrIllegalState;
+
+	// The vector can only grow if CPUs were booted after the pin was configured.
+	if(_raiseCounts.size() < static_cast<size_t>(getCpuCount()))
+		_raiseCounts.resize(getCpuCount(), 0);
+	if(!retarget(cpu))
+		return kErrIllegalArgs;
+
+	frigg::infoLogger() << "thor: IRQ " << _name << " was moved to CPU #"
+			<< cpu->cpuIndex << frigg::endLog;
+	return kErrSuccess;
+}
+
+IrqStats IrqPin::getStats() {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	return _stats;
+}
+
+frigg::Vector<uint64_t, KernelAlloc> IrqPin::getRaiseCounts() {
+	frigg::Vector<uint64_t, KernelAlloc> counts{*kernelAlloc};
+	counts.resize(getCpuCount(), 0);
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	for(size_t i = 0; i < _raiseCounts.size() && i < counts.size(); i++)
+		counts[i] = _raiseCounts[i];
+	return counts;
+}
+
+bool IrqPin::retarget(CpuData *) {
+	return false;
+}
+
 void IrqPin::raise() {
 	assert(!intsAreEnabled());
 	auto lock = frigg::guard(&_mutex);
+
+	// Latencies are measured from the first raise that was not passed to the sinks yet.
+	if(_sinkSequence == _raiseSequence)
+		_latencyClock = currentIrqClock();
+	_stats.numRaises++;
+	auto index = static_cast<size_t>(getCpuData()->cpuIndex);
+	if(index < _raiseCounts.size())
+		_raiseCounts[index]++;
 	
 	if(_strategy == IrqStrategy::null) {
 		frigg::infoLogger() << "\e[35mthor: Unconfigured IRQ was raised\e[39m" << frigg::endLog;
@@ -162,8 +285,15 @@ void IrqPin::raise() {
 				|| _strategy == IrqStrategy::maskThenEoi);
 	}
 
-	// If the IRQ is already masked, we're encountering a hardware race.
-	assert(!_maskState);
+	if(_maskState) {
+		// Pins that cannot be masked in hardware (e.g., MSIs without per-vector masking)
+		// can be raised while they are masked. Latch the IRQ; _acknowledge() or _kick()
+		// deliver it to the sinks. For level-triggered pins, this is a hardware race.
+		assert(_strategy == IrqStrategy::justEoi);
+		_raiseSequence++;
+		sendEoi();
+		return;
+	}
 
 	auto already_in_service = _inService;
 	_raiseSequence++;
@@ -254,7 +384,7 @@ void IrqPin::_callSinks() {
 	_dueSinks = 0;
 
 	if(_inService) {
-		_raiseClock = systemClockSource()->currentNanos();
+		_raiseClock = currentIrqClock();
 		_warnedAfterPending = false;
 	}
 
@@ -265,6 +395,7 @@ void IrqPin::_callSinks() {
 	for(auto it = _sinkList.begin(); it != _sinkList.end(); ++it) {
 		auto lock = frigg::guard(&(*it)->_mutex);
 		(*it)->_currentSequence = _sinkSequence;
+		(*it)->_currentRaiseClock = _latencyClock;
 		auto status = (*it)->raise();
 
 		(*it)->_status = status;
@@ -272,8 +403,10 @@ void IrqPin::_callSinks() {
 			(*it)->_responseSequence = _sinkSequence;
 
 		if(status == IrqStatus::acked) {
+			_stats.numSyncAcks++;
 			_inService = false;
 		}else if(status == IrqStatus::nacked) {
+			_stats.numSyncNacks++;
 			// We do not need to do anything here; we just do not increment _dueSinks.
 		}else{
 			_dueSinks++;
@@ -281,6 +414,11 @@ void IrqPin::_callSinks() {
 	}
 }
 
+void IrqPin::_recordLatency(uint64_t *histogram, uint64_t raise_clock) {
+	auto now = currentIrqClock();
+	histogram[latencyBucket(now > raise_clock ? now - raise_clock : 0)]++;
+}
+
 void IrqPin::_updateMask() {
 	// TODO: Avoid the virtual calls if the state does not change?
 	if(!_maskState) {
@@ -311,6 +449,8 @@ IrqStatus IrqObject::raise() {
 		auto node = _waitQueue.pop_front();
 		node->_error = kErrSuccess;
 		node->_sequence = currentSequence();
+		node->_pin = getPin();
+		node->_raiseClock = currentRaiseClock();
 		WorkQueue::post(node->_awaited);
 	}
 
@@ -336,6 +476,8 @@ void IrqObject::submitAwait(AwaitIrqNode *node, uint64_t sequence) {
 	if(sequence < currentSequence()) {
 		node->_error = kErrSuccess;
 		node->_sequence = currentSequence();
+		node->_pin = getPin();
+		node->_raiseClock = currentRaiseClock();
 		WorkQueue::post(node->_awaited);
 	}else{
 		_waitQueue.push_back(node);
@@ -4,6 +4,7 @@
 #include <frigg/debug.hpp>
 #include <frigg/linked.hpp>
 #include <frigg/string.hpp>
+#include <frigg/vector.hpp>
 #include <frg/list.hpp>
 #include "error.hpp"
 #include "kernel_heap.hpp"
@@ -12,6 +13,8 @@
 
 namespace thor {
 
+struct IrqPin;
+
 struct AwaitIrqNode {
 	friend struct IrqObject;
 
@@ -22,35 +25,47 @@ struct AwaitIrqNode {
 	Error error() { return _error; }
 	uint64_t sequence() { return _sequence; }
 
+	// Called once the result was delivered to userspace.
+	// Records the latency from the IRQ to its delivery.
+	void reportDelivery();
+
 private:
 	Worklet *_awaited;
 
 	Error _error;
 	uint64_t _sequence;
 
+	IrqPin *_pin = nullptr;
+	uint64_t _raiseClock;
+
 	frg::default_list_hook<AwaitIrqNode> _queueNode;
 };
 
 // ----------------------------------------------------------------------------
 
-struct IrqPin;
+struct CpuData;
 
 // Represents a slot in the CPU's interrupt table.
-// Slots might be global or per-CPU.
+// Each CPU has its own set of slots (see CpuData::irqSlots).
 struct IrqSlot {
 	bool isAvailable() {
-		return _pin == nullptr;
+		return !_linked;
 	}
 
 	// Links an IrqPin to this slot.
 	// From now on all IRQ raises will go to this IrqPin.
 	void link(IrqPin *pin);
 
+	// Makes the slot available again (e.g., after the pin moved to another CPU).
+	// IRQs that are still in flight are routed to the old pin until the slot is reused.
+	void unlink();
+
 	// The kernel calls this function when an IRQ is raised.
 	void raise();
 
 private:
 	IrqPin *_pin = nullptr;
+	bool _linked = false;
 };
 
 // ----------------------------------------------------------------------------
@@ -118,6 +133,12 @@ protected:
 		return _currentSequence;
 	}
 
+	// Time of the IRQ that corresponds to currentSequence(). Relative to currentNanos().
+	// Protected by the pin->_mutex and sinkMutex().
+	uint64_t currentRaiseClock() {
+		return _currentRaiseClock;
+	}
+
 private:
 	frigg::String<KernelAlloc> _name;
 
@@ -129,10 +150,30 @@ private:
 	// The following fields are protected by pin->_mutex and _mutex.
 private:
 	uint64_t _currentSequence;
+	uint64_t _currentRaiseClock;
 	uint64_t _responseSequence;
 	IrqStatus _status;
 };
 
+// Latencies are recorded in buckets of exponentially growing size: bucket 0 counts
+// latencies below 1us, bucket k counts latencies in [2^(k-1), 2^k) us.
+// The last bucket also counts all larger latencies.
+constexpr int numIrqLatencyBuckets = 16;
+
+struct IrqStats {
+	uint64_t numRaises = 0;
+	// Acks and nacks through IrqPin::ackSink() and IrqPin::nackSink() (i.e., by userspace).
+	uint64_t numAcks = 0;
+	uint64_t numNacks = 0;
+	// Acks and nacks that sinks returned synchronously (i.e., by kernlets or by the kernel).
+	uint64_t numSyncAcks = 0;
+	uint64_t numSyncNacks = 0;
+	// Latency from IRQ entry until the IRQ is delivered to a helSubmitAwaitEvent() caller.
+	uint64_t deliveryLatency[numIrqLatencyBuckets] = {};
+	// Latency from IRQ entry until the IRQ is acked or nacked by userspace.
+	uint64_t ackLatency[numIrqLatencyBuckets] = {};
+};
+
 enum class IrqStrategy {
 	null,
 	justEoi,
@@ -142,6 +183,8 @@ enum class IrqStrategy {
 // Represents a (not necessarily physical) "pin" of an interrupt controller.
 // This class handles the IRQ configuration and acknowledgement.
 struct IrqPin {
+	friend struct AwaitIrqNode;
+
 private:
 	static constexpr int maskedForService = 1;
 	static constexpr int maskedForNack = 2;
@@ -165,6 +208,15 @@ public:
 
 	void configure(IrqConfiguration cfg);
 
+	// Routes the IRQ to the given CPU.
+	// Fails with kErrIllegalArgs if the pin cannot be moved.
+	Error setAffinity(CpuData *cpu);
+
+	// Returns the number of raise() calls per CPU (indexed by CpuData::cpuIndex).
+	frigg::Vector<uint64_t, KernelAlloc> getRaiseCounts();
+
+	IrqStats getStats();
+
 	// This function is called from IrqSlot::raise().
 	void raise();
 
@@ -182,12 +234,17 @@ protected:
 	virtual void mask() = 0;
 	virtual void unmask() = 0;
 
+	// Moves the IRQ to another CPU. Pins that do not support this return false.
+	// Called with the pin's mutex held.
+	virtual bool retarget(CpuData *cpu);
+
 	// Sends an end-of-interrupt signal to the interrupt controller.
 	virtual void sendEoi() = 0;
 
 private:
 	void _callSinks();
 	void _updateMask();
+	void _recordLatency(uint64_t *histogram, uint64_t raise_clock);
 
 	frigg::String<KernelAlloc> _name;
 
@@ -204,12 +261,22 @@ private:
 	unsigned int _dueSinks;
 	int _maskState;
 
-	// Timestamp of the last acknowledge() operation.
-	// Relative to currentNanos().
+	// Timestamp at which the IRQ was passed to the sinks while it went into service.
+	// Used to warn about pending IRQs. Relative to currentNanos().
 	uint64_t _raiseClock;
+
+	// Timestamp of the first raise() that was not yet passed to the sinks.
+	// Only used for the latency statistics.
+	uint64_t _latencyClock;
 	
 	bool _warnedAfterPending;
 
+	// Number of raise() calls per CPU. Only resized in configure() and setAffinity(),
+	// i.e., before the pin can be raised on a new CPU.
+	frigg::Vector<uint64_t, KernelAlloc> _raiseCounts;
+
+	IrqStats _stats;
+
 	// TODO: This list should change rarely. Use a RCU list.
 	frg::intrusive_list<
 		IrqSink,
@@ -221,6 +288,9 @@ private:
 	> _sinkList;
 };
 
+// Returns all IrqPins that were configured so far. Such pins are never destroyed.
+frigg::Vector<IrqPin *, KernelAlloc> getConfiguredIrqPins();
+
 // ----------------------------------------------------------------------------
 
 // This class implements the user-visible part of IRQ handling.
@@ -2,6 +2,7 @@
 
 #include "descriptor.hpp"
 #include "fiber.hpp"
+#include "irq.hpp"
 #include "kerncfg.hpp"
 #include "service_helpers.hpp"
 
@@ -15,6 +16,9 @@ extern frigg::LazyInitializer<frg::string<KernelAlloc>> kernelCommandLine;
 
 namespace {
 
+// Keep responses well below the size that clients can receive inline.
+constexpr size_t maxIrqStatsResponse = 4096;
+
 bool handleReq(LaneHandle lane) {
 	auto branch = fiberAccept(lane);
 	if(!branch)
@@ -33,6 +37,42 @@ bool handleReq(LaneHandle lane) {
 		resp.SerializeToString(&ser);
 		fiberSend(branch, ser.data(), ser.size());
 		fiberSend(branch, kernelCommandLine->data(), kernelCommandLine->size());
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_IRQ_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_num_cpus(getCpuCount());
+
+		auto pins = getConfiguredIrqPins();
+		resp.set_num_irqs(pins.size());
+		for(size_t i = req.irq_offset(); i < pins.size(); i++) {
+			auto &name = pins[i]->name();
+			auto counts = pins[i]->getRaiseCounts();
+			auto pin_stats = pins[i]->getStats();
+
+			managarm::kerncfg::IrqStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_name(frg::string<KernelAlloc>{*kernelAlloc, name.data(), name.size()});
+			for(size_t k = 0; k < counts.size(); k++)
+				stats.add_counts(counts[k]);
+			stats.set_num_acks(pin_stats.numAcks);
+			stats.set_num_nacks(pin_stats.numNacks);
+			stats.set_num_sync_acks(pin_stats.numSyncAcks);
+			stats.set_num_sync_nacks(pin_stats.numSyncNacks);
+			for(int k = 0; k < numIrqLatencyBuckets; k++) {
+				stats.add_delivery_latency(pin_stats.deliveryLatency[k]);
+				stats.add_ack_latency(pin_stats.ackLatency[k]);
+			}
+
+			// Always send at least one IRQ such that clients make progress.
+			// The constant accounts for the tag and length prefix of the embedded message.
+			if(resp.irqs_size()
+					&& resp.ByteSize() + stats.ByteSize() + 16 > maxIrqStatsResponse)
+				break;
+			resp.add_irqs(std::move(stats));
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		fiberSend(branch, ser.data(), ser.size());
 	}else{
 		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 		resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
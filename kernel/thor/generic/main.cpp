@@ -2,6 +2,7 @@
 #include <algorithm>
 
 #include "kernel.hpp"
+#include "clock-page.hpp"
 #include "module.hpp"
 #include "irq.hpp"
 #include "fiber.hpp"
@@ -30,8 +31,6 @@ bool debugToVga = false;
 bool debugToSerial = false;
 bool debugToBochs = false;
 
-frigg::LazyInitializer<IrqSlot> globalIrqSlots[64];
-
 MfsDirectory *mfsRoot;
 frigg::LazyInitializer<frg::string<KernelAlloc>> kernelCommandLine;
 
@@ -94,14 +93,12 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	kernelCommandLine.initialize(*kernelAlloc, reinterpret_cast<const char *>(info->commandLine));
 	earlyFibers.initialize(*kernelAlloc);
 
-	for(int i = 0; i < 64; i++)
-		globalIrqSlots[i].initialize();
-
 	initializeTheSystemEarly();
 	initializeBootProcessor();
 	initializeThisProcessor();
 
 	initializeReclaim();
+	initializeClockPage();
 
 	if(logInitialization)
 		frigg::infoLogger() << "thor: Bootstrap processor initialized successfully."
@@ -460,7 +457,7 @@ void handleIrq(IrqImageAccessor image, int number) {
 	if(logEveryIrq)
 		frigg::infoLogger() << "thor: IRQ slot #" << number << frigg::endLog;
 
-	globalIrqSlots[number]->raise();
+	getCpuData()->irqSlots[number].raise();
 
 	// TODO: Can this function actually be called from non-preemptible domains?
 	assert(image.inPreemptibleDomain());
@@ -578,7 +575,7 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallSetupChunk: {
 		HelHandle handle;
 		*image.error() = helSetupChunk((HelHandle)arg0, (int)arg1,
-				(HelChunk *)arg2, (uint32_t)arg3);
+				(HelChunk *)arg2, (size_t)arg3, (uint32_t)arg4);
 	} break;
 	case kHelCallCancelAsync: {
 		HelHandle handle;
@@ -730,8 +727,8 @@ void handleSyscall(SyscallImageAccessor image) {
 	} break;
 	case kHelCallSubmitAwaitClock: {
 		uint64_t async_id;
-		*image.error() = helSubmitAwaitClock((uint64_t)arg0,
-				(HelHandle)arg1, (uintptr_t)arg2, &async_id);
+		*image.error() = helSubmitAwaitClock((uint64_t)arg0, (uint64_t)arg1,
+				(HelHandle)arg2, (uintptr_t)arg3, &async_id);
 		*image.out0() = async_id;
 	} break;
 
@@ -787,6 +784,12 @@ void handleSyscall(SyscallImageAccessor image) {
 		HelHandle handle;
 		*image.error() = helAutomateIrq((HelHandle)arg0, (uint32_t)arg1, (HelHandle)arg2);
 	} break;
+	case kHelCallSetIrqAffinity: {
+		*image.error() = helSetIrqAffinity((HelHandle)arg0, (uint32_t)arg1, (int)arg2);
+	} break;
+	case kHelCallQueryIrqStats: {
+		*image.error() = helQueryIrqStats((HelHandle)arg0, (HelIrqStats *)arg1);
+	} break;
 
 	case kHelCallAccessIo: {
 		HelHandle handle;
@@ -1,6 +1,7 @@
 
 #include <frigg/debug.hpp>
 
+#include "kernel.hpp"
 #include "timer.hpp"
 #include "../arch/x86/ints.hpp"
 
@@ -10,7 +11,6 @@ static constexpr bool logTimers = false;
 static constexpr bool logProgress = false;
 
 ClockSource *globalClockSource;
-PrecisionTimerEngine *globalTimerEngine;
 
 void PrecisionTimerNode::cancelTimer() {
 	auto irq_lock = frigg::guard(&irqMutex());
@@ -39,7 +39,8 @@ void PrecisionTimerEngine::installTimer(PrecisionTimerNode *timer) {
 	if(logTimers) {
 		auto current = _clock->currentNanos();
 		frigg::infoLogger() << "thor: Setting timer at " << timer->_deadline
-				<< " (counter is " << current << ")" << frigg::endLog;
+				<< " (expires at " << timer->_expiry
+				<< ", counter is " << current << ")" << frigg::endLog;
 	}
 
 	_timerQueue.push(timer);
@@ -61,6 +62,9 @@ void PrecisionTimerEngine::firedAlarm() {
 
 // This function is somewhat complicated because we have to avoid a race between
 // the comparator setup and the main counter.
+// The queue is ordered by expiry (i.e. deadline plus slack). The alarm is armed for
+// the earliest expiry; once it fires, all timers at the top of the queue whose
+// deadline has passed are completed together.
 void PrecisionTimerEngine::_progress() {
 	auto current = _clock->currentNanos();
 	do {
@@ -88,7 +92,7 @@ void PrecisionTimerEngine::_progress() {
 
 		// Setup the comparator and iterate if there was a race.
 		assert(!_timerQueue.empty());
-		_alarm->arm(_timerQueue.top()->_deadline);
+		_alarm->arm(_timerQueue.top()->_expiry);
 		current = _clock->currentNanos();
 	} while(_timerQueue.top()->_deadline <= current);
 }
@@ -98,7 +102,9 @@ ClockSource *systemClockSource() {
 }
 
 PrecisionTimerEngine *generalTimerEngine() {
-	return globalTimerEngine;
+	auto engine = getCpuData()->apicContext.timerEngine();
+	assert(engine);
+	return engine;
 }
 
 } // namespace thor
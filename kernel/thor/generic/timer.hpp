@@ -51,7 +51,15 @@ struct PrecisionTimerNode {
 	: _engine{nullptr}, _inQueue{false} { }
 
 	void setup(uint64_t deadline, Worklet *elapsed) {
+		setup(deadline, 0, elapsed);
+	}
+
+	// The timer elapses at some point in [deadline, deadline + slack]. This allows
+	// the engine to coalesce timers with nearby deadlines into a single alarm.
+	void setup(uint64_t deadline, uint64_t slack, Worklet *elapsed) {
 		_deadline = deadline;
+		if(__builtin_add_overflow(deadline, slack, &_expiry))
+			_expiry = UINT64_MAX;
 		_elapsed = elapsed;
 	}
 
@@ -65,6 +73,7 @@ struct PrecisionTimerNode {
 
 private:
 	uint64_t _deadline;
+	uint64_t _expiry;
 	Worklet *_elapsed;
 
 	// TODO: If we allow timer engines to be destructed, this needs to be refcounted.
@@ -76,7 +85,7 @@ private:
 
 struct CompareTimer {
 	bool operator() (const PrecisionTimerNode *a, const PrecisionTimerNode *b) const {
-		return a->_deadline > b->_deadline;
+		return a->_expiry > b->_expiry;
 	}
 };
 
@@ -116,6 +125,8 @@ private:
 };
 
 ClockSource *systemClockSource();
+
+// Returns the timer engine of the current CPU.
 PrecisionTimerEngine *generalTimerEngine();
 
 } // namespace thor
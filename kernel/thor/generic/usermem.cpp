@@ -1,6 +1,7 @@
 
 #include <type_traits>
 #include "kernel.hpp"
+#include "clock-page.hpp"
 #include "fiber.hpp"
 #include "service_helpers.hpp"
 #include <frg/container_of.hpp>
@@ -2417,6 +2418,21 @@ void AddressSpace::dispose(BindableHandle) {
 void AddressSpace::setupDefaultMappings() {
 	auto hole = frigg::construct<Hole>(*kernelAlloc, 0x100000, 0x7ffffff00000);
 	_holes.insert(hole);
+
+	// Map the clock page (read-only). Since it is not dropped at fork, forked spaces share it.
+	// helSubmitProtectMemory() refuses to change the protection of this page and
+	// kernel writes on behalf of user space refuse to touch it (see overlapsClockPage()).
+	auto slice = frigg::makeShared<MemorySlice>(*kernelAlloc,
+			clockPageMemory(), 0, kPageSize);
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	AddressSpace::Guard space_guard(&lock);
+
+	VirtualAddr actual_address;
+	auto error = map(space_guard, slice, kHelClockPageAddress, 0, kPageSize,
+			kMapFixed | kMapProtRead, &actual_address);
+	assert(!error);
+	assert(actual_address == kHelClockPageAddress);
 }
 
 smarter::shared_ptr<Mapping> AddressSpace::getMapping(VirtualAddr address) {
@@ -3025,6 +3041,8 @@ void AddressSpaceLockHandle::load(size_t offset, void *pointer, size_t size) {
 Error AddressSpaceLockHandle::write(size_t offset, const void *pointer, size_t size) {
 	assert(_active);
 	assert(offset + size <= _length);
+	if(overlapsClockPage(_address + offset, size))
+		return kErrFault;
 
 	size_t progress = 0;
 	while(progress < size) {
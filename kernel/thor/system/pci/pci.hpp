@@ -166,6 +166,19 @@ struct PciDevice : PciEntity {
 
 	frigg::Vector<Capability, KernelAlloc> caps;
 
+	// Indices into caps of the MSI and MSI-X capabilities (or -1).
+	int msiIndex = -1;
+	int msixIndex = -1;
+	// Number of MSI vectors that the device supports.
+	// If the device supports MSI-X, this is the size of the MSI-X table.
+	unsigned int numMsis = 0;
+	// Kernel mapping of the MSI-X table.
+	void *msixMapping = nullptr;
+	// Pins of all MSIs that have been set up so far (indexed by MSI index).
+	frigg::Vector<IrqPin *, KernelAlloc> msiPins{*kernelAlloc};
+	// Sinks that are handed out by ACCESS_MSI (indexed by MSI index).
+	frigg::Vector<frigg::SharedPtr<IrqObject>, KernelAlloc> msiObjects{*kernelAlloc};
+
 	// Device attachments.
 	FbInfo *associatedFrameBuffer;
 	BootScreen *associatedScreen;
@@ -201,6 +214,10 @@ void enumerateSystemBusses();
 
 void runAllDevices();
 
+// Sets up the MSI (or MSI-X vector) with the given index.
+// This disables the legacy INTx interrupt of the device.
+IrqPin *setupMsi(PciDevice *device, unsigned int index);
+
 } } // namespace thor::pci
 
 // read from pci configuration space
@@ -64,6 +64,7 @@ namespace {
 				}
 				resp.add_bars(std::move(msg));
 			}
+			resp.set_num_msis(device->numMsis);
 
 			frg::string<KernelAlloc> ser(*kernelAlloc);
 			resp.SerializeToString(&ser);
@@ -100,6 +101,44 @@ namespace {
 					+ frigg::to_string(*kernelAlloc, device->function));
 			IrqPin::attachSink(device->interrupt, object.get());
 
+			frg::string<KernelAlloc> ser(*kernelAlloc);
+			resp.SerializeToString(&ser);
+			fiberSend(branch, ser.data(), ser.size());
+			fiberPushDescriptor(branch, IrqDescriptor{object});
+		}else if(req.req_type() == managarm::hw::CntReqType::ACCESS_MSI) {
+			if(req.index() < 0 || static_cast<unsigned int>(req.index()) >= device->numMsis) {
+				managarm::hw::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+				resp.set_error(managarm::hw::Errors::OUT_OF_BOUNDS);
+
+				frg::string<KernelAlloc> ser(*kernelAlloc);
+				resp.SerializeToString(&ser);
+				fiberSend(branch, ser.data(), ser.size());
+				return true;
+			}
+
+			// Attach only one sink per vector, even if the MSI is accessed multiple times.
+			unsigned int index = req.index();
+			while(device->msiObjects.size() <= index)
+				device->msiObjects.push(frigg::SharedPtr<IrqObject>{});
+			if(!device->msiObjects[index]) {
+				auto pin = setupMsi(device.get(), index);
+				auto object = frigg::makeShared<IrqObject>(*kernelAlloc,
+						frigg::String<KernelAlloc>{*kernelAlloc, "pci-msi."}
+						+ frigg::to_string(*kernelAlloc, device->bus)
+						+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+						+ frigg::to_string(*kernelAlloc, device->slot)
+						+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+						+ frigg::to_string(*kernelAlloc, device->function)
+						+ frigg::String<KernelAlloc>{*kernelAlloc, "."}
+						+ frigg::to_string(*kernelAlloc, index));
+				IrqPin::attachSink(pin, object.get());
+				device->msiObjects[index] = object;
+			}
+			auto object = device->msiObjects[index];
+
+			managarm::hw::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::hw::Errors::SUCCESS);
+
 			frg::string<KernelAlloc> ser(*kernelAlloc);
 			resp.SerializeToString(&ser);
 			fiberSend(branch, ser.data(), ser.size());
@@ -550,6 +589,12 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function) {
 				if(type == 0x09)
 					size = readPciByte(bus->busId, slot, function, offset + 2);
 
+				if(type == 0x05) {
+					device->msiIndex = device->caps.size();
+				}else if(type == 0x11) {
+					device->msixIndex = device->caps.size();
+				}
+
 				device->caps.push({type, offset, size});
 
 				uint8_t successor = readPciByte(bus->busId, slot, function, offset + 1);
@@ -557,6 +602,17 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function) {
 			}
 		}
 
+		// Prefer MSI-X over MSI. We only support a single MSI (not multiple messages).
+		if(device->msixIndex >= 0) {
+			auto control = readPciHalf(bus->busId, slot, function,
+					device->caps[device->msixIndex].offset + 2);
+			device->numMsis = (control & 0x7FF) + 1;
+			frigg::infoLogger() << "            Supports " << device->numMsis
+					<< " MSI-X vectors" << frigg::endLog;
+		}else if(device->msiIndex >= 0) {
+			device->numMsis = 1;
+		}
+
 		// Determine the BARs
 		for(int i = 0; i < 6; i++) {
 			uint32_t offset = kPciRegularBar0 + i * 4;
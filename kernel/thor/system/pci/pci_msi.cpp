@@ -0,0 +1,224 @@
+
+#include <arch/bits.hpp>
+#include <arch/mem_space.hpp>
+#include <arch/register.hpp>
+#include <frigg/debug.hpp>
+#include "../../arch/x86/pic.hpp"
+#include "../../generic/kernel.hpp"
+#include "pci.hpp"
+
+namespace thor {
+namespace pci {
+
+namespace {
+	// Registers of the MSI capability.
+	constexpr uint32_t msiControl = 2;
+	constexpr uint32_t msiAddressLow = 4;
+	constexpr uint32_t msiAddressHigh = 8; // Only if the capability is 64-bit.
+
+	constexpr uint16_t msiControlEnable = 1;
+	constexpr uint16_t msiControl64Bit = 0x80;
+	constexpr uint16_t msiControlPerVectorMask = 0x100;
+
+	// Registers of the MSI-X capability.
+	constexpr uint32_t msixControl = 2;
+	constexpr uint32_t msixTable = 4;
+
+	constexpr uint16_t msixControlFunctionMask = 0x4000;
+	constexpr uint16_t msixControlEnable = 0x8000;
+
+	// Layout of MSI-X table entries.
+	constexpr size_t msixEntrySize = 16;
+	constexpr arch::scalar_register<uint32_t> msixEntryAddressLow(0);
+	constexpr arch::scalar_register<uint32_t> msixEntryAddressHigh(4);
+	constexpr arch::scalar_register<uint32_t> msixEntryData(8);
+	constexpr arch::scalar_register<uint32_t> msixEntryVectorControl(12);
+
+	frigg::String<KernelAlloc> buildName(PciDevice *device, unsigned int index) {
+		return frigg::String<KernelAlloc>{*kernelAlloc, "pci-msi."}
+				+ frigg::to_string(*kernelAlloc, device->bus)
+				+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+				+ frigg::to_string(*kernelAlloc, device->slot)
+				+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+				+ frigg::to_string(*kernelAlloc, device->function)
+				+ frigg::String<KernelAlloc>{*kernelAlloc, "."}
+				+ frigg::to_string(*kernelAlloc, index);
+	}
+
+	void disableLegacyIrq(PciDevice *device) {
+		auto command = readPciHalf(device->bus, device->slot, device->function, kPciCommand);
+		writePciHalf(device->bus, device->slot, device->function,
+				kPciCommand, command | uint16_t{0x400});
+	}
+
+	// Pin of an MSI-X table entry.
+	struct MsixPin : MsiPin {
+		MsixPin(frigg::String<KernelAlloc> name, CpuData *cpu, arch::mem_space entry)
+		: MsiPin{frigg::move(name), cpu}, _entry{entry} { }
+
+		IrqStrategy program(TriggerMode mode, Polarity polarity) override {
+			auto strategy = MsiPin::program(mode, polarity);
+			updateMessage();
+			unmask();
+			return strategy;
+		}
+
+		void mask() override {
+			_masked = true;
+			_entry.store(msixEntryVectorControl, 1);
+		}
+
+		void unmask() override {
+			_masked = false;
+			_entry.store(msixEntryVectorControl, 0);
+		}
+
+		void updateMessage() override {
+			// The entry must be masked while it is modified.
+			_entry.store(msixEntryVectorControl, 1);
+
+			auto address = getMessageAddress();
+			_entry.store(msixEntryAddressLow, address);
+			_entry.store(msixEntryAddressHigh, address >> 32);
+			_entry.store(msixEntryData, getMessageData());
+
+			// Pending messages are delivered (to the new address) once the entry is unmasked.
+			if(!_masked)
+				_entry.store(msixEntryVectorControl, 0);
+		}
+
+	private:
+		arch::mem_space _entry;
+		bool _masked = true;
+	};
+
+	// Pin of a (single-message) MSI capability.
+	struct PlainMsiPin : MsiPin {
+		PlainMsiPin(frigg::String<KernelAlloc> name, CpuData *cpu, PciDevice *device)
+		: MsiPin{frigg::move(name), cpu}, _device{device} {
+			_offset = device->caps[device->msiIndex].offset;
+			_control = readPciHalf(device->bus, device->slot, device->function,
+					_offset + msiControl);
+		}
+
+		IrqStrategy program(TriggerMode mode, Polarity polarity) override {
+			auto strategy = MsiPin::program(mode, polarity);
+			updateMessage();
+
+			// Enable a single message (i.e., clear the multiple message enable field).
+			_control = (_control & ~uint16_t{0x70}) | msiControlEnable;
+			writePciHalf(_device->bus, _device->slot, _device->function,
+					_offset + msiControl, _control);
+			unmask();
+			return strategy;
+		}
+
+		// Without per-vector masking, the pin cannot be masked. IrqPin latches
+		// IRQs that arrive while the pin is logically masked.
+		void mask() override {
+			if(_control & msiControlPerVectorMask)
+				writePciWord(_device->bus, _device->slot, _device->function,
+						_maskOffset(), 1);
+		}
+
+		void unmask() override {
+			if(_control & msiControlPerVectorMask)
+				writePciWord(_device->bus, _device->slot, _device->function,
+						_maskOffset(), 0);
+		}
+
+		// Without per-vector masking, a message that is sent while the address and
+		// data registers are updated can raise an unrelated vector. Such spurious IRQs
+		// are harmless as drivers check their devices' status anyway.
+		void updateMessage() override {
+			auto address = getMessageAddress();
+			uint32_t data_offset;
+			writePciWord(_device->bus, _device->slot, _device->function,
+					_offset + msiAddressLow, address);
+			if(_control & msiControl64Bit) {
+				writePciWord(_device->bus, _device->slot, _device->function,
+						_offset + msiAddressHigh, address >> 32);
+				data_offset = 12;
+			}else{
+				assert(!(address >> 32));
+				data_offset = 8;
+			}
+			writePciHalf(_device->bus, _device->slot, _device->function,
+					_offset + data_offset, getMessageData());
+		}
+
+	private:
+		uint32_t _maskOffset() {
+			return _offset + ((_control & msiControl64Bit) ? 16 : 12);
+		}
+
+		PciDevice *_device;
+		uint32_t _offset;
+		uint16_t _control;
+	};
+
+	void mapMsixTable(PciDevice *device) {
+		auto offset = device->caps[device->msixIndex].offset;
+		auto table = readPciWord(device->bus, device->slot, device->function,
+				offset + msixTable);
+		auto bir = table & 7;
+		auto table_offset = table & ~uint32_t{7};
+		assert(device->bars[bir].type == PciDevice::kBarMemory);
+
+		PhysicalAddr physical = device->bars[bir].address + table_offset;
+		auto misalign = physical & (kPageSize - 1);
+		auto size = (misalign + device->numMsis * msixEntrySize + (kPageSize - 1))
+				& ~(kPageSize - 1);
+
+		auto window = KernelVirtualMemory::global().allocate(size);
+		for(size_t pg = 0; pg < size; pg += kPageSize)
+			KernelPageSpace::global().mapSingle4k(VirtualAddr(window) + pg,
+					(physical & ~(kPageSize - 1)) + pg,
+					page_access::write, CachingMode::null);
+		device->msixMapping = reinterpret_cast<char *>(window) + misalign;
+
+		// Mask all vectors before MSI-X is enabled.
+		for(unsigned int i = 0; i < device->numMsis; i++) {
+			arch::mem_space entry{reinterpret_cast<char *>(device->msixMapping)
+					+ i * msixEntrySize};
+			entry.store(msixEntryVectorControl, 1);
+		}
+
+		auto control = readPciHalf(device->bus, device->slot, device->function,
+				offset + msixControl);
+		control = (control & ~msixControlFunctionMask) | msixControlEnable;
+		writePciHalf(device->bus, device->slot, device->function,
+				offset + msixControl, control);
+	}
+}
+
+IrqPin *setupMsi(PciDevice *device, unsigned int index) {
+	assert(index < device->numMsis);
+	if(index < device->msiPins.size() && device->msiPins[index])
+		return device->msiPins[index];
+
+	auto cpu = pickIrqCpu();
+
+	MsiPin *pin;
+	if(device->msixIndex >= 0) {
+		if(!device->msixMapping)
+			mapMsixTable(device);
+		arch::mem_space entry{reinterpret_cast<char *>(device->msixMapping)
+				+ index * msixEntrySize};
+		pin = frigg::construct<MsixPin>(*kernelAlloc, buildName(device, index), cpu, entry);
+	}else{
+		assert(device->msiIndex >= 0);
+		assert(!index);
+		pin = frigg::construct<PlainMsiPin>(*kernelAlloc, buildName(device, index), cpu, device);
+	}
+
+	disableLegacyIrq(device);
+	pin->configure({TriggerMode::edge, Polarity::high});
+
+	while(device->msiPins.size() <= index)
+		device->msiPins.push(nullptr);
+	device->msiPins[index] = pin;
+	return pin;
+}
+
+} } // namespace thor::pci
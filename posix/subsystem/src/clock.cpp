@@ -76,19 +76,25 @@ async::result<void> enumerateTracker() {
 struct timespec getRealtime() {
 	auto page = reinterpret_cast<TrackerPage *>(trackerPageMapping.get());
 
-	// Start the seqlock read.
-	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
-	assert(!(seqlock & 1));
-
-	// Perform the actual loads.
-	auto ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
-	auto base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
-
-	// Finish the seqlock read.
-	__atomic_thread_fence(__ATOMIC_ACQUIRE);
-	assert(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock);
-
-	// Calculate the current time.
+	int64_t ref, base;
+	while(true) {
+		// Start the seqlock read.
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+
+		// Perform the actual loads.
+		ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
+		base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
+
+		// Finish the seqlock read.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock)
+			break;
+	}
+
+	// Calculate the current time. helGetClock() reads the kernel's clock page,
+	// hence this does not require any syscall.
 	uint64_t now;
 	HEL_CHECK(helGetClock(&now));
 
@@ -10,10 +10,13 @@
 #include <sys/sysmacros.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include <async/jump.hpp>
+#include <protocols/fs/serialize.hpp>
 #include <protocols/mbus/client.hpp>
 #include <helix/timer.hpp>
 
@@ -434,7 +437,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			managarm::posix::SvrResponse resp;
 			resp.set_error(err);
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -458,7 +461,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_pid(self->pid());
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -483,7 +486,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				mode |= 0x400 | (signo << 24);
 			resp.set_mode(mode);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -512,7 +515,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_ru_user_time(stats.userTime);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -527,7 +530,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req.mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
 				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -572,7 +575,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_offset(reinterpret_cast<uintptr_t>(address));
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -590,7 +593,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_offset(reinterpret_cast<uintptr_t>(address));
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -603,7 +606,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req.mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
 				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -623,7 +626,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					reinterpret_cast<void *>(req.address()), req.size(), native_flags);
 
 			resp.set_error(managarm::posix::Errors::SUCCESS);
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -640,7 +643,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -658,7 +661,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -693,7 +696,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -712,7 +715,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -721,7 +724,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -741,7 +744,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -750,7 +753,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -768,7 +771,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!file) {
 				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -781,7 +784,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -798,7 +801,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -807,7 +810,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -830,7 +833,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(co_await parent->getLink(resolver.nextComponent())) {
 				resp.set_error(managarm::posix::Errors::ALREADY_EXISTS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -844,7 +847,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -852,7 +855,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -876,7 +879,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -896,7 +899,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolver.currentLink()) {
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -918,7 +921,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -943,45 +946,46 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(resolver.currentLink()) {
 				auto stats = co_await resolver.currentLink()->getTarget()->getStats();
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::SUCCESS);
+				protocols::fs::StatResponse fields;
 
 				DeviceId devnum;
 				switch(resolver.currentLink()->getTarget()->getType()) {
 				case VfsType::regular:
-					resp.set_file_type(managarm::posix::FT_REGULAR);
+					fields.fileType = managarm::posix::FT_REGULAR;
 					break;
 				case VfsType::directory:
-					resp.set_file_type(managarm::posix::FT_DIRECTORY);
+					fields.fileType = managarm::posix::FT_DIRECTORY;
 					break;
 				case VfsType::charDevice:
-					resp.set_file_type(managarm::posix::FT_CHAR_DEVICE);
+					fields.fileType = managarm::posix::FT_CHAR_DEVICE;
 					devnum = resolver.currentLink()->getTarget()->readDevice();
-					resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+					fields.refDevnum = makedev(devnum.first, devnum.second);
 					break;
 				case VfsType::blockDevice:
-					resp.set_file_type(managarm::posix::FT_BLOCK_DEVICE);
+					fields.fileType = managarm::posix::FT_BLOCK_DEVICE;
 					devnum = resolver.currentLink()->getTarget()->readDevice();
-					resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+					fields.refDevnum = makedev(devnum.first, devnum.second);
 					break;
 				default:
 					break;
 				}
 
-				resp.set_fs_inode(stats.inodeNumber);
-				resp.set_mode(stats.mode);
-				resp.set_num_links(stats.numLinks);
-				resp.set_uid(stats.uid);
-				resp.set_gid(stats.gid);
-				resp.set_file_size(stats.fileSize);
-				resp.set_atime_secs(stats.atimeSecs);
-				resp.set_atime_nanos(stats.atimeNanos);
-				resp.set_mtime_secs(stats.mtimeSecs);
-				resp.set_mtime_nanos(stats.mtimeNanos);
-				resp.set_ctime_secs(stats.ctimeSecs);
-				resp.set_ctime_nanos(stats.ctimeNanos);
-
-				auto ser = resp.SerializeAsString();
+				fields.inodeNumber = stats.inodeNumber;
+				fields.mode = stats.mode;
+				fields.numLinks = stats.numLinks;
+				fields.uid = stats.uid;
+				fields.gid = stats.gid;
+				fields.fileSize = stats.fileSize;
+				fields.atimeSecs = stats.atimeSecs;
+				fields.atimeNanos = stats.atimeNanos;
+				fields.mtimeSecs = stats.mtimeSecs;
+				fields.mtimeNanos = stats.mtimeNanos;
+				fields.ctimeSecs = stats.ctimeSecs;
+				fields.ctimeNanos = stats.ctimeNanos;
+
+				protocols::fs::FastResponse ser;
+				protocols::fs::encodeStatResponse(ser, managarm::posix::Errors::SUCCESS, fields);
+
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -990,7 +994,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1009,7 +1013,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 						helix::action(&send_data, nullptr, 0));
@@ -1025,7 +1029,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 						helix::action(&send_data, nullptr, 0));
@@ -1037,7 +1041,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 						helix::action(&send_data, target.data(), target.size()));
@@ -1070,7 +1074,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!resolver.currentLink()) {
 					resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-					auto ser = resp.SerializeAsString();
+					protocols::fs::SerializedMessage ser{resp};
 					auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 							helix::action(&send_resp, ser.data(), ser.size()));
 					co_await transmit.async_wait();
@@ -1087,7 +1091,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					if(req.flags() & managarm::posix::OF_EXCLUSIVE) {
 						resp.set_error(managarm::posix::Errors::ALREADY_EXISTS);
 
-						auto ser = resp.SerializeAsString();
+						protocols::fs::SerializedMessage ser{resp};
 						auto &&transmit = helix::submitAsync(conversation,
 								helix::Dispatcher::global(),
 								helix::action(&send_resp, ser.data(), ser.size()));
@@ -1125,10 +1129,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				int fd = self->fileContext()->attachFile(file,
 						req.flags() & managarm::posix::OF_CLOEXEC);
 
-				resp.set_error(managarm::posix::Errors::SUCCESS);
-				resp.set_fd(fd);
+				protocols::fs::FastResponse ser;
+				protocols::fs::encodeFdResponse(ser, managarm::posix::Errors::SUCCESS, fd);
 
-				auto ser = resp.SerializeAsString();
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1138,7 +1141,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					std::cout << "posix:     OPEN failed: file not found" << std::endl;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1152,10 +1155,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			self->fileContext()->closeFile(req.fd());
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+			protocols::fs::FastResponse ser;
+			protocols::fs::encodeErrorResponse(ser, managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1178,7 +1180,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(newfd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1203,7 +1205,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1218,45 +1220,46 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			helix::SendBuffer send_resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+			protocols::fs::StatResponse fields;
 
 			DeviceId devnum;
 			switch(file->associatedLink()->getTarget()->getType()) {
 			case VfsType::regular:
-				resp.set_file_type(managarm::posix::FT_REGULAR);
+				fields.fileType = managarm::posix::FT_REGULAR;
 				break;
 			case VfsType::directory:
-				resp.set_file_type(managarm::posix::FT_DIRECTORY);
+				fields.fileType = managarm::posix::FT_DIRECTORY;
 				break;
 			case VfsType::charDevice:
-				resp.set_file_type(managarm::posix::FT_CHAR_DEVICE);
+				fields.fileType = managarm::posix::FT_CHAR_DEVICE;
 				devnum = file->associatedLink()->getTarget()->readDevice();
-				resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+				fields.refDevnum = makedev(devnum.first, devnum.second);
 				break;
 			case VfsType::blockDevice:
-				resp.set_file_type(managarm::posix::FT_BLOCK_DEVICE);
+				fields.fileType = managarm::posix::FT_BLOCK_DEVICE;
 				devnum = file->associatedLink()->getTarget()->readDevice();
-				resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+				fields.refDevnum = makedev(devnum.first, devnum.second);
 				break;
 			default:
 				break;
 			}
 
-			resp.set_fs_inode(stats.inodeNumber);
-			resp.set_mode(stats.mode);
-			resp.set_num_links(stats.numLinks);
-			resp.set_uid(stats.uid);
-			resp.set_gid(stats.gid);
-			resp.set_file_size(stats.fileSize);
-			resp.set_atime_secs(stats.atimeSecs);
-			resp.set_atime_nanos(stats.atimeNanos);
-			resp.set_mtime_secs(stats.mtimeSecs);
-			resp.set_mtime_nanos(stats.mtimeNanos);
-			resp.set_ctime_secs(stats.ctimeSecs);
-			resp.set_ctime_nanos(stats.ctimeNanos);
-
-			auto ser = resp.SerializeAsString();
+			fields.inodeNumber = stats.inodeNumber;
+			fields.mode = stats.mode;
+			fields.numLinks = stats.numLinks;
+			fields.uid = stats.uid;
+			fields.gid = stats.gid;
+			fields.fileSize = stats.fileSize;
+			fields.atimeSecs = stats.atimeSecs;
+			fields.atimeNanos = stats.atimeNanos;
+			fields.mtimeSecs = stats.mtimeSecs;
+			fields.mtimeNanos = stats.mtimeNanos;
+			fields.ctimeSecs = stats.ctimeSecs;
+			fields.ctimeNanos = stats.ctimeNanos;
+
+			protocols::fs::FastResponse ser;
+			protocols::fs::encodeStatResponse(ser, managarm::posix::Errors::SUCCESS, fields);
+
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1274,7 +1277,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_mode(file->isTerminal());
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1290,7 +1293,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_path("/dev/ttyS0");
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1332,7 +1335,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_size(path.size());
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 					helix::action(&send_path, path.data(),
@@ -1355,7 +1358,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1364,7 +1367,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1381,7 +1384,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				managarm::posix::SvrResponse resp;
 				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1397,7 +1400,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_flags(flags);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1467,7 +1470,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				resp.set_sig_handler(-3);
 			}
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1495,7 +1498,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.mutable_fds()->Add(r_fd);
 			resp.mutable_fds()->Add(w_fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1544,7 +1547,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1577,7 +1580,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.mutable_fds()->Add(fd0);
 			resp.mutable_fds()->Add(fd1);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1598,7 +1601,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1647,7 +1650,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			for(size_t m = 0; m < k; m++)
 				resp.set_events(events[m].data.u32, events[m].events);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1668,7 +1671,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1692,7 +1695,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1713,7 +1716,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1734,7 +1737,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1773,7 +1776,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 					helix::action(&send_data, events, k * sizeof(struct epoll_event)));
@@ -1794,7 +1797,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1814,7 +1817,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1835,7 +1838,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1856,7 +1859,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1878,7 +1881,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolver.currentLink()) {
 				resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				protocols::fs::SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -1891,7 +1894,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_wd(wd);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1917,7 +1920,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				resp.set_fd(fd);
 			}
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1929,7 +1932,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::ILLEGAL_REQUEST);
 
-			auto ser = resp.SerializeAsString();
+			protocols::fs::SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -1994,6 +1997,112 @@ struct CmdlineNode final : public procfs::RegularNode {
 	}
 };
 
+async::result<managarm::kerncfg::SvrResponse> getIrqStatsPage(uint64_t offset) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+
+	managarm::kerncfg::CntRequest req;
+	req.set_req_type(managarm::kerncfg::CntReqType::GET_IRQ_STATS);
+	req.set_irq_offset(offset);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::kerncfg::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	co_return resp;
+}
+
+// The kernel limits the size of each response; collect the stats of all IRQs.
+async::result<managarm::kerncfg::SvrResponse> getIrqStats() {
+	auto resp = co_await getIrqStatsPage(0);
+	while(static_cast<uint64_t>(resp.irqs_size()) < resp.num_irqs()) {
+		auto page = co_await getIrqStatsPage(resp.irqs_size());
+		if(!page.irqs_size())
+			break;
+		for(const auto &irq : page.irqs())
+			*resp.add_irqs() = irq;
+	}
+	co_return resp;
+}
+
+// Similar to Linux' /proc/interrupts: one line per IRQ with per-CPU counters.
+struct InterruptsNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		auto resp = co_await getIrqStats();
+
+		size_t name_width = 0;
+		for(const auto &irq : resp.irqs())
+			name_width = std::max(name_width, irq.name().size() + 1);
+
+		std::stringstream ss;
+		ss << std::setw(name_width) << "";
+		for(uint32_t k = 0; k < resp.num_cpus(); k++)
+			ss << std::setw(11) << ("CPU" + std::to_string(k));
+		ss << '\n';
+		for(const auto &irq : resp.irqs()) {
+			ss << std::setw(name_width) << std::left << (irq.name() + ":") << std::right;
+			for(uint32_t k = 0; k < resp.num_cpus(); k++)
+				ss << std::setw(11) << (k < static_cast<uint32_t>(irq.counts_size())
+						? irq.counts(k) : 0);
+			ss << '\n';
+		}
+		co_return ss.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/interrupts");
+	}
+};
+
+// Ack/nack counters and latency histograms of all IRQs.
+struct IrqStatsNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		auto resp = co_await getIrqStats();
+
+		auto printHistogram = [] (std::stringstream &ss, const char *what,
+				const google::protobuf::RepeatedField<uint64_t> &buckets) {
+			ss << "    " << what << ":";
+			for(int k = 0; k < buckets.size(); k++) {
+				if(k + 1 < buckets.size()) {
+					ss << " <" << (1 << k) << "us " << buckets.Get(k);
+				}else{
+					ss << " >=" << (1 << (k - 1)) << "us " << buckets.Get(k);
+				}
+			}
+			ss << '\n';
+		};
+
+		std::stringstream ss;
+		for(const auto &irq : resp.irqs()) {
+			uint64_t num_raises = 0;
+			for(int k = 0; k < irq.counts_size(); k++)
+				num_raises += irq.counts(k);
+
+			ss << irq.name() << ": raised " << num_raises
+					<< ", acked " << irq.num_acks() << ", nacked " << irq.num_nacks()
+					<< ", kernlet-acked " << irq.num_sync_acks()
+					<< ", kernlet-nacked " << irq.num_sync_nacks() << '\n';
+			printHistogram(ss, "delivery latency", irq.delivery_latency());
+			printHistogram(ss, "ack latency", irq.ack_latency());
+		}
+		co_return ss.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/irqstats");
+	}
+};
+
 async::result<void> enumerateKerncfg() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -2014,6 +2123,8 @@ async::result<void> enumerateKerncfg() {
 
 	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
 	procfs_root->directMkregular("cmdline", std::make_shared<CmdlineNode>());
+	procfs_root->directMkregular("interrupts", std::make_shared<InterruptsNode>());
+	procfs_root->directMkregular("irqstats", std::make_shared<IrqStatsNode>());
 }
 
 // --------------------------------------------------------
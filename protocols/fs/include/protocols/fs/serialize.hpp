@@ -0,0 +1,149 @@
+#ifndef LIBFS_SERIALIZE_HPP
+#define LIBFS_SERIALIZE_HPP
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <optional>
+
+namespace protocols {
+namespace fs {
+
+// Serializes a protobuf message into an inline buffer. Only messages that do not fit
+// into InlineSize bytes fall back to a heap allocation. Use this instead of
+// SerializeAsString(), which always allocates a std::string.
+template<typename Message, size_t InlineSize = 128>
+struct SerializedMessage {
+	explicit SerializedMessage(const Message &msg) {
+		_size = msg.ByteSizeLong();
+		if(_size > InlineSize) {
+			_heap.reset(new uint8_t[_size]);
+			_data = _heap.get();
+		}else{
+			_data = _inline;
+		}
+		msg.SerializeWithCachedSizesToArray(_data);
+	}
+
+	SerializedMessage(const SerializedMessage &) = delete;
+
+	SerializedMessage &operator= (const SerializedMessage &) = delete;
+
+	const void *data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+private:
+	uint8_t *_data;
+	size_t _size;
+	std::unique_ptr<uint8_t[]> _heap;
+	uint8_t _inline[InlineSize];
+};
+
+// ----------------------------------------------------------------------------
+// Fixed-layout encoding of hot responses.
+// ----------------------------------------------------------------------------
+
+// The following field numbers are shared by managarm.fs.SvrResponse and
+// managarm.posix.SvrResponse. They must be kept in sync with fs.proto and posix.proto.
+namespace response_fields {
+	enum : uint32_t {
+		fd = 1,
+		error = 3,
+		fileSize = 4,
+		fileType = 5,
+		offset = 6,
+		atimeSecs = 7,
+		atimeNanos = 8,
+		mtimeSecs = 9,
+		mtimeNanos = 10,
+		ctimeSecs = 11,
+		ctimeNanos = 12,
+		mode = 13,
+		inodeNumber = 14,
+		uid = 15,
+		gid = 16,
+		numLinks = 17,
+		refDevnum = 23 // Only present in posix.proto.
+	};
+}
+
+// Buffer that responses are encoded into. The encoding is the protobuf wire format,
+// hence clients parse the result with the ordinary generated code. As long as fields
+// are appended in ascending order, the result is byte-identical to SerializeAsString().
+struct FastResponse {
+	static constexpr size_t maxSize = 256;
+
+	FastResponse()
+	: _size{0} { }
+
+	FastResponse(const FastResponse &) = delete;
+
+	FastResponse &operator= (const FastResponse &) = delete;
+
+	void appendVarint(uint32_t field, uint64_t value) {
+		// Tag and value take at most 5 + 10 bytes.
+		assert(_size + 15 <= maxSize);
+		_emit(static_cast<uint64_t>(field) << 3); // Wire type 0 (varint).
+		_emit(value);
+	}
+
+	// Negative int32 and int64 values are sign-extended to 64 bits on the wire.
+	void appendInt(uint32_t field, int64_t value) {
+		appendVarint(field, static_cast<uint64_t>(value));
+	}
+
+	const void *data() const {
+		return _buffer;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+private:
+	void _emit(uint64_t value) {
+		while(value >= 0x80) {
+			_buffer[_size++] = static_cast<uint8_t>(value | 0x80);
+			value >>= 7;
+		}
+		_buffer[_size++] = static_cast<uint8_t>(value);
+	}
+
+	uint8_t _buffer[maxSize];
+	size_t _size;
+};
+
+struct StatResponse {
+	std::optional<int> fileType;
+	std::optional<uint64_t> inodeNumber;
+	std::optional<uint64_t> refDevnum;
+	uint64_t fileSize;
+	int mode;
+	uint64_t numLinks;
+	int64_t uid, gid;
+	int64_t atimeSecs, atimeNanos;
+	int64_t mtimeSecs, mtimeNanos;
+	int64_t ctimeSecs, ctimeNanos;
+};
+
+// Responses that only carry an error code (e.g. WRITE, CLOSE).
+void encodeErrorResponse(FastResponse &out, int error);
+
+// Responses of the SEEK_* requests.
+void encodeOffsetResponse(FastResponse &out, int error, uint64_t offset);
+
+// Responses of OPEN-like requests.
+void encodeFdResponse(FastResponse &out, int error, int fd);
+
+// Responses of STAT-like requests.
+void encodeStatResponse(FastResponse &out, int error, const StatResponse &stats);
+
+} } // namespace protocols::fs
+
+#endif // LIBFS_SERIALIZE_HPP
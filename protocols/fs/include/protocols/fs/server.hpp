@@ -42,6 +42,16 @@ using SeekResult = std::variant<Error, int64_t>;
 
 using AccessMemoryResult = std::pair<helix::BorrowedDescriptor, uint64_t>;
 
+// Data that is returned by FileOperations::readView. The data is sent from the
+// given memory directly; it stays valid as long as keepAlive is alive.
+struct ReadView {
+	const void *data;
+	size_t length;
+	std::shared_ptr<void> keepAlive;
+};
+
+using ReadViewResult = std::variant<Error, ReadView>;
+
 using GetLinkResult = std::tuple<std::shared_ptr<void>, int64_t, FileType>;
 
 using OpenResult = std::pair<helix::UniqueLane, helix::UniqueLane>;
@@ -67,6 +77,11 @@ struct FileOperations {
 		read = f;
 		return *this;
 	}
+	constexpr FileOperations &withReadView(async::result<ReadViewResult> (*f)(void *object,
+			const char *, size_t length)) {
+		readView = f;
+		return *this;
+	}
 	constexpr FileOperations &withWrite(async::result<void> (*f)(void *object,
 			const char *, const void *buffer, size_t length)) {
 		write = f;
@@ -137,6 +152,10 @@ struct FileOperations {
 	async::result<SeekResult> (*seekEof)(void *object, int64_t offset);
 	async::result<ReadResult> (*read)(void *object, const char *credentials,
 			void *buffer, size_t length);
+	// Like read but avoids copying the data to an intermediate buffer.
+	// If present, this is preferred over read.
+	async::result<ReadViewResult> (*readView)(void *object, const char *credentials,
+			size_t length);
 	async::result<void> (*write)(void *object, const char *credentials,
 			const void *buffer, size_t length);
 	async::result<ReadEntriesResult> (*readEntries)(void *object);
@@ -0,0 +1,43 @@
+#include <protocols/fs/serialize.hpp>
+
+namespace protocols {
+namespace fs {
+
+// All encoders append fields in ascending order of their field numbers.
+
+void encodeErrorResponse(FastResponse &out, int error) {
+	out.appendInt(response_fields::error, error);
+}
+
+void encodeOffsetResponse(FastResponse &out, int error, uint64_t offset) {
+	out.appendInt(response_fields::error, error);
+	out.appendVarint(response_fields::offset, offset);
+}
+
+void encodeFdResponse(FastResponse &out, int error, int fd) {
+	out.appendInt(response_fields::fd, fd);
+	out.appendInt(response_fields::error, error);
+}
+
+void encodeStatResponse(FastResponse &out, int error, const StatResponse &stats) {
+	out.appendInt(response_fields::error, error);
+	out.appendVarint(response_fields::fileSize, stats.fileSize);
+	if(stats.fileType)
+		out.appendInt(response_fields::fileType, *stats.fileType);
+	out.appendInt(response_fields::atimeSecs, stats.atimeSecs);
+	out.appendInt(response_fields::atimeNanos, stats.atimeNanos);
+	out.appendInt(response_fields::mtimeSecs, stats.mtimeSecs);
+	out.appendInt(response_fields::mtimeNanos, stats.mtimeNanos);
+	out.appendInt(response_fields::ctimeSecs, stats.ctimeSecs);
+	out.appendInt(response_fields::ctimeNanos, stats.ctimeNanos);
+	out.appendInt(response_fields::mode, stats.mode);
+	if(stats.inodeNumber)
+		out.appendVarint(response_fields::inodeNumber, *stats.inodeNumber);
+	out.appendInt(response_fields::uid, stats.uid);
+	out.appendInt(response_fields::gid, stats.gid);
+	out.appendVarint(response_fields::numLinks, stats.numLinks);
+	if(stats.refDevnum)
+		out.appendVarint(response_fields::refDevnum, *stats.refDevnum);
+}
+
+} } // namespace protocols::fs
@@ -7,6 +7,7 @@
 
 #include <helix/ipc.hpp>
 
+#include <protocols/fs/serialize.hpp>
 #include <protocols/fs/server.hpp>
 #include "fs.pb.h"
 
@@ -24,11 +25,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		assert(file_ops->seekAbs);
 		auto result = co_await file_ops->seekAbs(file.get(), req.rel_offset());
 
-		managarm::fs::SvrResponse resp;
-		resp.set_error(managarm::fs::Errors::SUCCESS);
-		resp.set_offset(std::get<int64_t>(result));
+		FastResponse ser;
+		encodeOffsetResponse(ser, managarm::fs::Errors::SUCCESS, std::get<int64_t>(result));
 
-		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -40,16 +39,14 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		auto result = co_await file_ops->seekRel(file.get(), req.rel_offset());
 		auto error = std::get_if<Error>(&result);
 
-		managarm::fs::SvrResponse resp;
+		FastResponse ser;
 		if(error && *error == Error::seekOnPipe) {
-			resp.set_error(managarm::fs::Errors::SEEK_ON_PIPE);
+			encodeErrorResponse(ser, managarm::fs::Errors::SEEK_ON_PIPE);
 		}else{
 			assert(!error);
-			resp.set_error(managarm::fs::Errors::SUCCESS);
-			resp.set_offset(std::get<int64_t>(result));
+			encodeOffsetResponse(ser, managarm::fs::Errors::SUCCESS, std::get<int64_t>(result));
 		}
 
-		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -60,11 +57,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		assert(file_ops->seekEof);
 		auto result = co_await file_ops->seekEof(file.get(), req.rel_offset());
 
-		managarm::fs::SvrResponse resp;
-		resp.set_error(managarm::fs::Errors::SUCCESS);
-		resp.set_offset(std::get<int64_t>(result));
+		FastResponse ser;
+		encodeOffsetResponse(ser, managarm::fs::Errors::SUCCESS, std::get<int64_t>(result));
 
-		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -79,38 +74,58 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		co_await buff.async_wait();
 		HEL_CHECK(extract_creds.error());
 
-		std::string data;
-		data.resize(req.size());
-		assert(file_ops->read);
-		auto res = co_await file_ops->read(file.get(), extract_creds.credentials(),
-				data.data(), req.size());
+		// Prefer readView; it avoids copying the data to an intermediate buffer.
+		std::unique_ptr<char[]> buffer;
+		const void *data = nullptr;
+		size_t length = 0;
+		ReadView view;
+		std::optional<Error> error;
+		if(file_ops->readView) {
+			auto res = co_await file_ops->readView(file.get(), extract_creds.credentials(),
+					req.size());
+			if(auto e = std::get_if<Error>(&res); e) {
+				error = *e;
+			}else{
+				view = std::move(std::get<ReadView>(res));
+				data = view.data;
+				length = view.length;
+			}
+		}else{
+			// Do not zero-initialize the buffer; the file overwrites it anyway.
+			assert(file_ops->read);
+			buffer.reset(new char[req.size()]);
+			auto res = co_await file_ops->read(file.get(), extract_creds.credentials(),
+					buffer.get(), req.size());
+			if(auto e = std::get_if<Error>(&res); e) {
+				error = *e;
+			}else{
+				data = buffer.get();
+				length = std::get<size_t>(res);
+			}
+		}
 
-		managarm::fs::SvrResponse resp;
-		auto error = std::get_if<Error>(&res);
+		FastResponse ser;
 		if(error && *error == Error::wouldBlock) {
-			resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+			encodeErrorResponse(ser, managarm::fs::Errors::WOULD_BLOCK);
 
-			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(error && *error == Error::illegalArguments) {
-			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			encodeErrorResponse(ser, managarm::fs::Errors::ILLEGAL_ARGUMENT);
 
-			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else{
 			assert(!error);
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			encodeErrorResponse(ser, managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&send_data, data.data(), std::get<size_t>(res)));
+					helix::action(&send_data, data, length));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_data.error());
@@ -133,10 +148,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				buffer.data(), recv_buffer.actualLength());
 
 		helix::SendBuffer send_resp;
-		managarm::fs::SvrResponse resp;
-		resp.set_error(managarm::fs::Errors::SUCCESS);
+		FastResponse ser;
+		encodeErrorResponse(ser, managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -156,7 +170,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 		}
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -175,7 +189,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::END_OF_FILE);
 		}
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -193,7 +207,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_offset(memory.second);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 				helix::action(&push_memory, memory.first));
@@ -209,7 +223,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -223,7 +237,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -241,7 +255,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_pid(result);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -255,7 +269,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -279,7 +293,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_edges(std::get<1>(result));
 		resp.set_status(std::get<2>(result));
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -302,7 +316,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -325,7 +339,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -344,7 +358,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_file_size(actual_length);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 				helix::action(&send_data, addr.data(),
@@ -361,7 +375,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_flags(flags);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size(), 0));
 		co_await transmit.async_wait();
@@ -374,7 +388,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size(), 0));
 		co_await transmit.async_wait();
@@ -410,7 +424,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			assert(*error == Error::wouldBlock && "libfs_protocol: TODO: handle other errors");
 			resp.set_error(managarm::fs::WOULD_BLOCK);
 
-			auto ser = resp.SerializeAsString();
+			SerializedMessage ser{resp};
 			auto transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -419,7 +433,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		}
 
 		auto data = std::get<RecvData>(result);
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 				helix::action(&send_addr, addr.data(), data.addressLength, kHelItemChain),
@@ -463,7 +477,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		if(error && *error == Error::brokenPipe) {
 			resp.set_error(managarm::fs::Errors::BROKEN_PIPE);
 
-			auto ser = resp.SerializeAsString();
+			SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -476,7 +490,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_size(std::get<size_t>(result_or_error));
 
-		auto ser = resp.SerializeAsString();
+		SerializedMessage ser{resp};
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
@@ -590,21 +604,22 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			assert(node_ops->getStats);
 			auto result = co_await node_ops->getStats(node);
 
-			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
-			resp.set_file_size(result.fileSize);
-			resp.set_num_links(result.linkCount);
-			resp.set_mode(result.mode);
-			resp.set_uid(result.uid);
-			resp.set_gid(result.gid);
-			resp.set_atime_secs(result.accessTime.tv_sec);
-			resp.set_atime_nanos(result.accessTime.tv_nsec);
-			resp.set_mtime_secs(result.dataModifyTime.tv_sec);
-			resp.set_mtime_nanos(result.dataModifyTime.tv_nsec);
-			resp.set_ctime_secs(result.anyChangeTime.tv_sec);
-			resp.set_ctime_nanos(result.anyChangeTime.tv_nsec);
-
-			auto ser = resp.SerializeAsString();
+			StatResponse stats;
+			stats.fileSize = result.fileSize;
+			stats.numLinks = result.linkCount;
+			stats.mode = result.mode;
+			stats.uid = result.uid;
+			stats.gid = result.gid;
+			stats.atimeSecs = result.accessTime.tv_sec;
+			stats.atimeNanos = result.accessTime.tv_nsec;
+			stats.mtimeSecs = result.dataModifyTime.tv_sec;
+			stats.mtimeNanos = result.dataModifyTime.tv_nsec;
+			stats.ctimeSecs = result.anyChangeTime.tv_sec;
+			stats.ctimeNanos = result.anyChangeTime.tv_nsec;
+
+			FastResponse ser;
+			encodeStatResponse(ser, managarm::fs::Errors::SUCCESS, stats);
+
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -636,7 +651,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 					throw std::runtime_error("Unexpected file type");
 				}
 
-				auto ser = resp.SerializeAsString();
+				SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 						helix::action(&push_node, remote_lane));
@@ -647,7 +662,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 				managarm::fs::SvrResponse resp;
 				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -680,7 +695,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 					throw std::runtime_error("Unexpected file type");
 				}
 
-				auto ser = resp.SerializeAsString();
+				SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 						helix::action(&push_node, remote_lane));
@@ -691,7 +706,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 				managarm::fs::SvrResponse resp;
 				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 
-				auto ser = resp.SerializeAsString();
+				SerializedMessage ser{resp};
 				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
@@ -705,7 +720,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
@@ -720,7 +735,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 					helix::action(&push_file, std::get<0>(result), kHelItemChain),
@@ -738,7 +753,7 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+			SerializedMessage ser{resp};
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
 					helix::action(&send_link, link.data(), link.size()));
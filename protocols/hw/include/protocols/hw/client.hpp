@@ -29,6 +29,8 @@ struct Capability {
 struct PciInfo {
 	BarInfo barInfo[6];
 	std::vector<Capability> caps;
+	// Number of vectors that can be passed to accessMsi().
+	unsigned int numMsis;
 };
 
 struct FbInfo {
@@ -46,6 +48,9 @@ struct Device {
 	async::result<PciInfo> getPciInfo();
 	async::result<helix::UniqueDescriptor> accessBar(int index);
 	async::result<helix::UniqueDescriptor> accessIrq();
+	// Returns the IRQ of the MSI (or MSI-X vector) with the given index.
+	// Using MSIs disables the legacy IRQ returned by accessIrq().
+	async::result<helix::UniqueDescriptor> accessMsi(unsigned int index);
 
 	async::result<void> claimDevice();
 	async::result<void> enableBusIrq();
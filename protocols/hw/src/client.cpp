@@ -38,6 +38,7 @@ async::result<PciInfo> Device::getPciInfo() {
 
 	for(int i = 0; i < resp.capabilities_size(); i++)
 		info.caps.push_back({resp.capabilities(i).type()});
+	info.numMsis = resp.num_msis();
 
 	for(int i = 0; i < 6; i++) {
 		if(resp.bars(i).io_type() == managarm::hw::IoType::NO_BAR) {
@@ -115,6 +116,37 @@ async::result<helix::UniqueDescriptor> Device::accessIrq() {
 	co_return pull_irq.descriptor();
 }
 
+async::result<helix::UniqueDescriptor> Device::accessMsi(unsigned int index) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+	helix::PullDescriptor pull_irq;
+
+	managarm::hw::CntRequest req;
+	req.set_req_type(managarm::hw::CntReqType::ACCESS_MSI);
+	req.set_index(index);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(_lane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp, kHelItemChain),
+			helix::action(&pull_irq));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::hw::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	if(resp.error() == managarm::hw::Errors::OUT_OF_BOUNDS)
+		throw std::runtime_error("MSI index out of bounds");
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+	HEL_CHECK(pull_irq.error());
+
+	co_return pull_irq.descriptor();
+}
+
 async::result<void> Device::claimDevice() {
 	helix::Offer offer;
 	helix::SendBuffer send_req;
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// Every benchmark function performs a single iteration and returns the number
+// of TSC ticks that the measured operation took. This allows benchmarks to
+// exclude setup and teardown costs from the measurement.
+
+#define DEFINE_BENCHMARK(s, f) \
+	static benchmark_case bench_ ## s{#s, std::vector<size_t>{0}, f};
+
+#define DEFINE_SIZED_BENCHMARK(s, sizes, f) \
+	static benchmark_case bench_ ## s{#s, std::vector<size_t>sizes, f};
+
+inline uint64_t read_tsc() {
+	uint32_t low, high;
+	asm volatile ("lfence\n"
+			"\trdtsc\n"
+			"\tlfence" : "=a" (low), "=d" (high) : : "memory");
+	return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+// Busy-waits for the given number of TSC ticks.
+inline void spin_ticks(uint64_t ticks) {
+	auto start = read_tsc();
+	while(read_tsc() - start < ticks)
+		asm volatile ("pause");
+}
+
+// Number of TSC ticks per microsecond. Determined by the runner before any
+// benchmark is executed.
+extern uint64_t tsc_ticks_per_us;
+
+struct abstract_benchmark {
+private:
+	static void register_case(abstract_benchmark *bp);
+
+public:
+	abstract_benchmark(const char *name, std::vector<size_t> sizes)
+	: name_{name}, sizes_{std::move(sizes)} {
+		register_case(this);
+	}
+
+	abstract_benchmark(const abstract_benchmark &) = delete;
+
+	virtual ~abstract_benchmark() = default;
+
+	abstract_benchmark &operator= (const abstract_benchmark &) = delete;
+
+	const char *name() {
+		return name_;
+	}
+
+	// Parameters (usually transfer sizes in bytes) that the benchmark is run with.
+	// Unparameterized benchmarks use a single size of zero.
+	const std::vector<size_t> &sizes() {
+		return sizes_;
+	}
+
+	virtual uint64_t run(size_t size) = 0;
+
+private:
+	const char *name_;
+	std::vector<size_t> sizes_;
+};
+
+template<typename F>
+struct benchmark_case : abstract_benchmark {
+	benchmark_case(const char *name, std::vector<size_t> sizes, F functor)
+	: abstract_benchmark{name, std::move(sizes)}, functor_{std::move(functor)} { }
+
+	uint64_t run(size_t size) override {
+		return functor_(size);
+	}
+
+private:
+	F functor_;
+};
+
+// Helper thread that runs in the same universe and address space as the caller.
+// The thread is created via helCreateThread() and thus bypasses the C library;
+// its entry function must not touch TLS (e.g. errno or iostreams).
+struct raw_thread {
+	raw_thread(void (*entry)());
+
+	raw_thread(const raw_thread &) = delete;
+
+	~raw_thread();
+
+	raw_thread &operator= (const raw_thread &) = delete;
+
+private:
+	int64_t handle_;
+	void *stack_;
+};
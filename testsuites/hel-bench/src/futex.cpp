@@ -0,0 +1,94 @@
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "benchmark.hpp"
+
+namespace {
+
+// Blocks until *word differs from value. Returns the new value.
+int wait_for_change(int *word, int value) {
+	while(true) {
+		auto current = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+		if(current != value)
+			return current;
+		HEL_CHECK(helFutexWait(word, value));
+	}
+}
+
+void publish(int *word, int value) {
+	__atomic_store_n(word, value, __ATOMIC_RELEASE);
+	HEL_CHECK(helFutexWake(word));
+}
+
+// ----------------------------------------------------------------------------
+// Ping-pong between two threads.
+// ----------------------------------------------------------------------------
+
+int ping_word;
+int pong_word;
+
+void pong_thread() {
+	int last = 0;
+	while(true) {
+		last = wait_for_change(&ping_word, last);
+		publish(&pong_word, last);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Wake-up latency of a blocked thread.
+// ----------------------------------------------------------------------------
+
+int wake_word;
+int waiting_word;
+int done_word;
+uint64_t wake_stamp;
+uint64_t wake_delta;
+
+void sleeper_thread() {
+	int last = 0;
+	while(true) {
+		__atomic_store_n(&waiting_word, last, __ATOMIC_RELEASE);
+		last = wait_for_change(&wake_word, last);
+		auto end = read_tsc();
+		wake_delta = end - __atomic_load_n(&wake_stamp, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&done_word, last, __ATOMIC_RELEASE);
+	}
+}
+
+} // anonymous namespace
+
+// Round trip of two futex wake-ups between two threads.
+DEFINE_BENCHMARK(futex_ping_pong, ([] (size_t) -> uint64_t {
+	static raw_thread thread{&pong_thread};
+	static int seq = 0;
+
+	seq++;
+	auto start = read_tsc();
+	publish(&ping_word, seq);
+	auto result = wait_for_change(&pong_word, seq - 1);
+	auto end = read_tsc();
+	assert(result == seq);
+	return end - start;
+}))
+
+// Time from helFutexWake() until the thread blocked in helFutexWait() returns
+// to user space.
+DEFINE_BENCHMARK(futex_wake_latency, ([] (size_t) -> uint64_t {
+	static raw_thread thread{&sleeper_thread};
+	static int seq = 0;
+
+	// Wait until the other thread is about to block, then give it some time to
+	// actually enter the kernel.
+	while(__atomic_load_n(&waiting_word, __ATOMIC_ACQUIRE) != seq)
+		asm volatile ("pause");
+	spin_ticks(20 * tsc_ticks_per_us);
+
+	seq++;
+	__atomic_store_n(&wake_stamp, read_tsc(), __ATOMIC_RELEASE);
+	publish(&wake_word, seq);
+
+	while(__atomic_load_n(&done_word, __ATOMIC_ACQUIRE) != seq)
+		asm volatile ("pause");
+	return wake_delta;
+}))
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <vector>
+
+#include <helix/ipc.hpp>
+
+#include "benchmark.hpp"
+
+// All IPC benchmarks complete their operations on the global dispatcher.
+// Since nothing else submits to it, Dispatcher::wait() retrieves exactly the
+// elements that belong to the benchmark.
+
+namespace {
+
+std::pair<helix::UniqueLane, helix::UniqueLane> &lanes() {
+	static auto pair = helix::createStream();
+	return pair;
+}
+
+void wait_for_completions(int n) {
+	for(int i = 0; i < n; i++)
+		helix::Dispatcher::global().wait();
+}
+
+} // anonymous namespace
+
+// Cost of submitting a single request with a matching receiver and retrieving both
+// completions from the queue. This is the minimal round trip of any RPC.
+DEFINE_BENCHMARK(submit_async_roundtrip, ([] (size_t) -> uint64_t {
+	helix::Offer offer;
+	helix::Accept accept;
+
+	auto start = read_tsc();
+	auto &&submit_offer = helix::submitAsync(lanes().first, helix::Dispatcher::global(),
+			helix::action(&offer));
+	auto &&submit_accept = helix::submitAsync(lanes().second, helix::Dispatcher::global(),
+			helix::action(&accept));
+	wait_for_completions(2);
+	auto end = read_tsc();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(accept.error());
+	return end - start;
+}))
+
+// The kernel currently limits inline receives to 128 bytes.
+DEFINE_SIZED_BENCHMARK(inline_message, ({8, 16, 32, 64, 128}), ([] (size_t size) -> uint64_t {
+	static char buffer[128];
+
+	helix::SendBuffer send;
+	helix::RecvInline recv;
+
+	auto start = read_tsc();
+	auto &&submit_send = helix::submitAsync(lanes().first, helix::Dispatcher::global(),
+			helix::action(&send, buffer, size));
+	auto &&submit_recv = helix::submitAsync(lanes().second, helix::Dispatcher::global(),
+			helix::action(&recv));
+	wait_for_completions(2);
+	auto end = read_tsc();
+	HEL_CHECK(send.error());
+	HEL_CHECK(recv.error());
+	assert(recv.length() == size);
+	return end - start;
+}))
+
+DEFINE_SIZED_BENCHMARK(buffer_message,
+		({64, 512, 4096, 16384, 65536, 262144, 1048576}),
+		([] (size_t size) -> uint64_t {
+	static std::vector<char> source(1048576);
+	static std::vector<char> sink(1048576);
+
+	helix::SendBuffer send;
+	helix::RecvBuffer recv;
+
+	auto start = read_tsc();
+	auto &&submit_send = helix::submitAsync(lanes().first, helix::Dispatcher::global(),
+			helix::action(&send, source.data(), size));
+	auto &&submit_recv = helix::submitAsync(lanes().second, helix::Dispatcher::global(),
+			helix::action(&recv, sink.data(), size));
+	wait_for_completions(2);
+	auto end = read_tsc();
+	HEL_CHECK(send.error());
+	HEL_CHECK(recv.error());
+	assert(recv.actualLength() == size);
+	return end - start;
+}))
+
+DEFINE_BENCHMARK(descriptor_push_pull, ([] (size_t) -> uint64_t {
+	static HelHandle memory = [] {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &handle));
+		return handle;
+	}();
+
+	helix::PushDescriptor push;
+	helix::PullDescriptor pull;
+
+	auto start = read_tsc();
+	auto &&submit_push = helix::submitAsync(lanes().first, helix::Dispatcher::global(),
+			helix::action(&push, helix::BorrowedDescriptor{memory}));
+	auto &&submit_pull = helix::submitAsync(lanes().second, helix::Dispatcher::global(),
+			helix::action(&pull));
+	wait_for_completions(2);
+	auto end = read_tsc();
+	HEL_CHECK(push.error());
+	HEL_CHECK(pull.error());
+	pull.descriptor(); // Closes the descriptor.
+	return end - start;
+}))
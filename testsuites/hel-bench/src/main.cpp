@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "benchmark.hpp"
+
+uint64_t tsc_ticks_per_us;
+
+static std::vector<abstract_benchmark *> benchmark_ptrs;
+
+void abstract_benchmark::register_case(abstract_benchmark *bp) {
+	benchmark_ptrs.push_back(bp);
+}
+
+namespace {
+	constexpr size_t stack_size = 0x10000;
+}
+
+raw_thread::raw_thread(void (*entry)()) {
+	stack_ = aligned_alloc(16, stack_size);
+	assert(stack_);
+
+	// The SysV ABI expects (%rsp + 8) to be 16-byte aligned on function entry.
+	auto sp = reinterpret_cast<char *>(stack_) + stack_size - 8;
+	HEL_CHECK(helCreateThread(kHelNullHandle, kHelNullHandle, kHelAbiSystemV,
+			reinterpret_cast<void *>(entry), sp, 0, &handle_));
+}
+
+raw_thread::~raw_thread() {
+	HEL_CHECK(helKillThread(handle_));
+	HEL_CHECK(helCloseDescriptor(handle_));
+	// We cannot free() the stack as we do not know when the kernel stops running the thread.
+}
+
+namespace {
+
+void calibrate_tsc() {
+	uint64_t start_nanos, end_nanos;
+	HEL_CHECK(helGetClock(&start_nanos));
+	auto start_tsc = read_tsc();
+	do {
+		HEL_CHECK(helGetClock(&end_nanos));
+	} while(end_nanos - start_nanos < 100'000'000);
+	auto end_tsc = read_tsc();
+
+	tsc_ticks_per_us = (end_tsc - start_tsc) * 1000 / (end_nanos - start_nanos);
+	assert(tsc_ticks_per_us);
+}
+
+uint64_t ticks_to_nanos(uint64_t ticks) {
+	return ticks * 1000 / tsc_ticks_per_us;
+}
+
+// Returns the p-th percentile (0 <= p <= 1000, in per mille) of a sorted sample vector.
+uint64_t percentile(const std::vector<uint64_t> &sorted, int p) {
+	auto k = (sorted.size() - 1) * p / 1000;
+	return sorted[k];
+}
+
+void print_result(abstract_benchmark *bp, size_t size, std::vector<uint64_t> &samples,
+		bool first) {
+	std::sort(samples.begin(), samples.end());
+
+	uint64_t total = 0;
+	for(auto s : samples)
+		total += s;
+	auto mean = ticks_to_nanos(total / samples.size());
+
+	std::cout << (first ? "\n" : ",\n")
+			<< "    {\"name\": \"" << bp->name() << "\""
+			<< ", \"size\": " << size
+			<< ", \"iterations\": " << samples.size()
+			<< ", \"unit\": \"ns\""
+			<< ", \"min\": " << ticks_to_nanos(samples.front())
+			<< ", \"mean\": " << mean
+			<< ", \"p50\": " << ticks_to_nanos(percentile(samples, 500))
+			<< ", \"p90\": " << ticks_to_nanos(percentile(samples, 900))
+			<< ", \"p99\": " << ticks_to_nanos(percentile(samples, 990))
+			<< ", \"p999\": " << ticks_to_nanos(percentile(samples, 999))
+			<< ", \"max\": " << ticks_to_nanos(samples.back());
+	if(size && mean)
+		std::cout << ", \"bytes_per_sec\": " << size * 1'000'000'000 / mean;
+	std::cout << "}";
+}
+
+} // anonymous namespace
+
+// Usage: hel-bench [iterations] [name-filter]
+// The results are printed to stdout as a single JSON document.
+int main(int argc, char **argv) {
+	size_t iterations = 10000;
+	const char *filter = nullptr;
+	if(argc > 1)
+		iterations = strtoul(argv[1], nullptr, 10);
+	if(argc > 2)
+		filter = argv[2];
+	assert(iterations);
+
+	calibrate_tsc();
+
+	std::cout << "{\n  \"suite\": \"hel-bench\",\n"
+			<< "  \"tsc_ticks_per_us\": " << tsc_ticks_per_us << ",\n"
+			<< "  \"results\": [";
+
+	bool first = true;
+	for(abstract_benchmark *bp : benchmark_ptrs) {
+		if(filter && !strstr(bp->name(), filter))
+			continue;
+
+		for(size_t size : bp->sizes()) {
+			// Warm up caches and let the kernel grow its data structures.
+			for(size_t i = 0; i < iterations / 10; i++)
+				bp->run(size);
+
+			std::vector<uint64_t> samples;
+			samples.reserve(iterations);
+			for(size_t i = 0; i < iterations; i++)
+				samples.push_back(bp->run(size));
+
+			print_result(bp, size, samples, first);
+			first = false;
+		}
+	}
+
+	std::cout << "\n  ]\n}" << std::endl;
+}
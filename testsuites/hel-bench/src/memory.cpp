@@ -0,0 +1,43 @@
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "benchmark.hpp"
+
+namespace {
+
+HelHandle allocate(size_t size) {
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+	return handle;
+}
+
+} // anonymous namespace
+
+DEFINE_SIZED_BENCHMARK(map_unmap, ({0x1000, 0x10000, 0x100000}), ([] (size_t size) -> uint64_t {
+	static HelHandle memory = allocate(0x100000);
+
+	void *window;
+	auto start = read_tsc();
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr, 0, size,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+	return read_tsc() - start;
+}))
+
+// Measures the cost of the first access to a fresh page of anonymous memory.
+// Allocation and mapping of the memory object are not part of the measurement.
+DEFINE_BENCHMARK(page_fault, ([] (size_t) -> uint64_t {
+	auto memory = allocate(0x1000);
+
+	void *window;
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr, 0, 0x1000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	auto start = read_tsc();
+	*reinterpret_cast<volatile char *>(window) = 1;
+	auto end = read_tsc();
+
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x1000));
+	HEL_CHECK(helCloseDescriptor(memory));
+	return end - start;
+}))
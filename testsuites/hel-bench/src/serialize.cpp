@@ -0,0 +1,239 @@
+#include <string.h>
+#include <string>
+
+#include <protocols/fs/serialize.hpp>
+
+#include "benchmark.hpp"
+#include "fs.pb.h"
+#include "posix.pb.h"
+
+// Serialization and parsing cost of the messages on the hot paths of the POSIX
+// subsystem and of the fs protocol. Each response type is measured with three
+// encoders: SerializeAsString(), SerializedMessage (inline buffer) and the
+// fixed-layout FastResponse encoders.
+
+namespace {
+
+// Prevents the compiler from optimizing away the serialized data.
+void consume(const void *data, size_t size) {
+	asm volatile ("" : : "r" (data), "r" (size) : "memory");
+}
+
+// Checks that the fixed-layout encoding matches the output of protobuf.
+void verify(const std::string &expected, const protocols::fs::FastResponse &actual) {
+	assert(expected.size() == actual.size());
+	assert(!memcmp(expected.data(), actual.data(), actual.size()));
+}
+
+// ----------------------------------------------------------------------------
+// Response construction.
+// ----------------------------------------------------------------------------
+
+void fill_error(managarm::fs::SvrResponse &resp) {
+	resp.set_error(managarm::fs::Errors::SUCCESS);
+}
+
+void fill_seek(managarm::fs::SvrResponse &resp) {
+	resp.set_error(managarm::fs::Errors::SUCCESS);
+	resp.set_offset(0x12345678);
+}
+
+void fill_open(managarm::posix::SvrResponse &resp) {
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(42);
+}
+
+void fill_stat(managarm::posix::SvrResponse &resp) {
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_file_type(managarm::posix::FT_REGULAR);
+	resp.set_fs_inode(123456);
+	resp.set_mode(0644);
+	resp.set_num_links(1);
+	resp.set_uid(1000);
+	resp.set_gid(1000);
+	resp.set_file_size(1 << 20);
+	resp.set_atime_secs(1600000000);
+	resp.set_atime_nanos(123456789);
+	resp.set_mtime_secs(1600000000);
+	resp.set_mtime_nanos(123456789);
+	resp.set_ctime_secs(1600000000);
+	resp.set_ctime_nanos(123456789);
+}
+
+void encode_error(protocols::fs::FastResponse &out) {
+	protocols::fs::encodeErrorResponse(out, managarm::fs::Errors::SUCCESS);
+}
+
+void encode_seek(protocols::fs::FastResponse &out) {
+	protocols::fs::encodeOffsetResponse(out, managarm::fs::Errors::SUCCESS, 0x12345678);
+}
+
+void encode_open(protocols::fs::FastResponse &out) {
+	protocols::fs::encodeFdResponse(out, managarm::posix::Errors::SUCCESS, 42);
+}
+
+void encode_stat(protocols::fs::FastResponse &out) {
+	protocols::fs::StatResponse fields;
+	fields.fileType = managarm::posix::FT_REGULAR;
+	fields.inodeNumber = 123456;
+	fields.mode = 0644;
+	fields.numLinks = 1;
+	fields.uid = 1000;
+	fields.gid = 1000;
+	fields.fileSize = 1 << 20;
+	fields.atimeSecs = 1600000000;
+	fields.atimeNanos = 123456789;
+	fields.mtimeSecs = 1600000000;
+	fields.mtimeNanos = 123456789;
+	fields.ctimeSecs = 1600000000;
+	fields.ctimeNanos = 123456789;
+	protocols::fs::encodeStatResponse(out, managarm::posix::Errors::SUCCESS, fields);
+}
+
+template<typename Message>
+uint64_t serialize_string(void (*fill)(Message &)) {
+	auto start = read_tsc();
+	Message resp;
+	fill(resp);
+	auto ser = resp.SerializeAsString();
+	consume(ser.data(), ser.size());
+	return read_tsc() - start;
+}
+
+template<typename Message>
+uint64_t serialize_inline(void (*fill)(Message &)) {
+	auto start = read_tsc();
+	Message resp;
+	fill(resp);
+	protocols::fs::SerializedMessage ser{resp};
+	consume(ser.data(), ser.size());
+	return read_tsc() - start;
+}
+
+template<typename Message>
+uint64_t serialize_fast(void (*fill)(Message &),
+		void (*encode)(protocols::fs::FastResponse &)) {
+	auto start = read_tsc();
+	protocols::fs::FastResponse ser;
+	encode(ser);
+	consume(ser.data(), ser.size());
+	auto end = read_tsc();
+
+	Message resp;
+	fill(resp);
+	verify(resp.SerializeAsString(), ser);
+	return end - start;
+}
+
+// ----------------------------------------------------------------------------
+// Request construction.
+// ----------------------------------------------------------------------------
+
+std::string fs_request(managarm::fs::CntReqType type) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(type);
+	if(type == managarm::fs::CntReqType::READ || type == managarm::fs::CntReqType::WRITE)
+		req.set_size(4096);
+	if(type == managarm::fs::CntReqType::SEEK_ABS)
+		req.set_rel_offset(0x12345678);
+	return req.SerializeAsString();
+}
+
+std::string posix_request(managarm::posix::CntReqType type) {
+	managarm::posix::CntRequest req;
+	req.set_request_type(type);
+	if(type == managarm::posix::CntReqType::OPEN) {
+		req.set_path("/usr/lib/libc.so");
+		req.set_flags(managarm::posix::OF_CLOEXEC);
+	}else if(type == managarm::posix::CntReqType::STAT) {
+		req.set_path("/usr/lib/libc.so");
+	}else{
+		req.set_fd(42);
+	}
+	return req.SerializeAsString();
+}
+
+template<typename Message>
+uint64_t parse(const std::string &ser) {
+	auto start = read_tsc();
+	Message msg;
+	msg.ParseFromArray(ser.data(), ser.size());
+	consume(&msg, sizeof(Message));
+	return read_tsc() - start;
+}
+
+} // anonymous namespace
+
+// READ, WRITE and CLOSE responses only carry an error code.
+DEFINE_BENCHMARK(serialize_error_string, ([] (size_t) -> uint64_t {
+	return serialize_string(&fill_error);
+}))
+DEFINE_BENCHMARK(serialize_error_inline, ([] (size_t) -> uint64_t {
+	return serialize_inline(&fill_error);
+}))
+DEFINE_BENCHMARK(serialize_error_fast, ([] (size_t) -> uint64_t {
+	return serialize_fast(&fill_error, &encode_error);
+}))
+
+DEFINE_BENCHMARK(serialize_seek_string, ([] (size_t) -> uint64_t {
+	return serialize_string(&fill_seek);
+}))
+DEFINE_BENCHMARK(serialize_seek_inline, ([] (size_t) -> uint64_t {
+	return serialize_inline(&fill_seek);
+}))
+DEFINE_BENCHMARK(serialize_seek_fast, ([] (size_t) -> uint64_t {
+	return serialize_fast(&fill_seek, &encode_seek);
+}))
+
+DEFINE_BENCHMARK(serialize_open_string, ([] (size_t) -> uint64_t {
+	return serialize_string(&fill_open);
+}))
+DEFINE_BENCHMARK(serialize_open_inline, ([] (size_t) -> uint64_t {
+	return serialize_inline(&fill_open);
+}))
+DEFINE_BENCHMARK(serialize_open_fast, ([] (size_t) -> uint64_t {
+	return serialize_fast(&fill_open, &encode_open);
+}))
+
+DEFINE_BENCHMARK(serialize_stat_string, ([] (size_t) -> uint64_t {
+	return serialize_string(&fill_stat);
+}))
+DEFINE_BENCHMARK(serialize_stat_inline, ([] (size_t) -> uint64_t {
+	return serialize_inline(&fill_stat);
+}))
+DEFINE_BENCHMARK(serialize_stat_fast, ([] (size_t) -> uint64_t {
+	return serialize_fast(&fill_stat, &encode_stat);
+}))
+
+DEFINE_BENCHMARK(parse_read_request, ([] (size_t) -> uint64_t {
+	static auto ser = fs_request(managarm::fs::CntReqType::READ);
+	return parse<managarm::fs::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_write_request, ([] (size_t) -> uint64_t {
+	static auto ser = fs_request(managarm::fs::CntReqType::WRITE);
+	return parse<managarm::fs::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_seek_request, ([] (size_t) -> uint64_t {
+	static auto ser = fs_request(managarm::fs::CntReqType::SEEK_ABS);
+	return parse<managarm::fs::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_open_request, ([] (size_t) -> uint64_t {
+	static auto ser = posix_request(managarm::posix::CntReqType::OPEN);
+	return parse<managarm::posix::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_close_request, ([] (size_t) -> uint64_t {
+	static auto ser = posix_request(managarm::posix::CntReqType::CLOSE);
+	return parse<managarm::posix::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_stat_request, ([] (size_t) -> uint64_t {
+	static auto ser = posix_request(managarm::posix::CntReqType::STAT);
+	return parse<managarm::posix::CntRequest>(ser);
+}))
+DEFINE_BENCHMARK(parse_stat_response, ([] (size_t) -> uint64_t {
+	static auto ser = [] {
+		managarm::posix::SvrResponse resp;
+		fill_stat(resp);
+		return resp.SerializeAsString();
+	}();
+	return parse<managarm::posix::SvrResponse>(ser);
+}))
@@ -0,0 +1,27 @@
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "benchmark.hpp"
+
+// helLog() with an empty string does not perform any work inside the kernel.
+// Hence, this measures the raw cost of entering and leaving the kernel.
+DEFINE_BENCHMARK(null_syscall, ([] (size_t) -> uint64_t {
+	auto start = read_tsc();
+	HEL_CHECK(helLog(nullptr, 0));
+	return read_tsc() - start;
+}))
+
+DEFINE_BENCHMARK(get_clock, ([] (size_t) -> uint64_t {
+	uint64_t nanos;
+	auto start = read_tsc();
+	HEL_CHECK(helGetClock(&nanos));
+	return read_tsc() - start;
+}))
+
+// helGetClock() reads the clock page; this measures the syscall that it replaces.
+DEFINE_BENCHMARK(get_clock_syscall, ([] (size_t) -> uint64_t {
+	HelWord nanos;
+	auto start = read_tsc();
+	HEL_CHECK(helSyscall0_1(kHelCallGetClock, &nanos));
+	return read_tsc() - start;
+}))